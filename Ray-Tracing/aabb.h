@@ -0,0 +1,91 @@
+// aabb.h
+// An axis-aligned bounding box: the smallest box, with sides parallel to the
+//      x, y, and z axes, that something fits inside. Checking a ray against
+//      a box is much cheaper than checking it against everything inside the
+//      box, so if the ray misses the box we can skip its contents entirely.
+
+# ifndef AABB_H
+# define AABB_H
+
+# include "rtweekend.h"
+
+class aabb {
+    public:
+        // Constructor- an "empty" box that anything grows it to fit.
+        aabb() : minimum(infinity, infinity, infinity), maximum(-infinity, -infinity, -infinity) {}
+        aabb( const point3& a, const point3& b ) : minimum(a), maximum(b) {}
+
+        point3 min() const { return minimum; }
+        point3 max() const { return maximum; }
+
+        // The "slab" test: for each axis, work out where the ray enters and
+        //      leaves the pair of planes on either side of the box. The ray
+        //      hits the box if it's between all three pairs at once.
+        //      "inv_dir" is 1/direction, worked out once per ray rather than
+        //      once per box. On a hit, "t_enter" says where the ray goes in.
+        bool hit( const point3& origin, const vec3& inv_dir, double t_min, double t_max,
+                  double& t_enter ) const {
+            for ( int a = 0; a < 3; a++ ) {
+                auto t0 = (minimum[a] - origin[a]) * inv_dir[a];
+                auto t1 = (maximum[a] - origin[a]) * inv_dir[a];
+                if ( inv_dir[a] < 0.0 )
+                    std::swap( t0, t1 );
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
+                if ( t_max < t_min )
+                    return false;
+            }
+            t_enter = t_min;
+            return true;
+        }
+
+        bool hit( const ray& r, double t_min, double t_max ) const {
+            double t_enter;
+            vec3 d = r.direction();
+            return hit( r.origin(), vec3(1/d.x(), 1/d.y(), 1/d.z()), t_min, t_max, t_enter );
+        }
+
+        // Grows the box to include a point or another box.
+        void expand( const point3& p ) {
+            for ( int a = 0; a < 3; a++ ) {
+                minimum[a] = fmin( minimum[a], p[a] );
+                maximum[a] = fmax( maximum[a], p[a] );
+            }
+        }
+        //      (Not just expand() by its two corners: an empty box's corners
+        //      are at infinity, and it mustn't grow anything.)
+        void expand( const aabb& b ) {
+            for ( int a = 0; a < 3; a++ ) {
+                minimum[a] = fmin( minimum[a], b.minimum[a] );
+                maximum[a] = fmax( maximum[a], b.maximum[a] );
+            }
+        }
+
+        point3 centroid() const { return 0.5 * (minimum + maximum); }
+
+        // Half the surface area. Only ratios of areas matter to us, so the 2x is skipped.
+        double half_area() const {
+            vec3 d = maximum - minimum;
+            if ( d.x() < 0 )
+                return 0;
+            return d.x()*d.y() + d.y()*d.z() + d.z()*d.x();
+        }
+
+        // Which axis the box is longest along.
+        int longest_axis() const {
+            vec3 d = maximum - minimum;
+            return d.x() > d.y() && d.x() > d.z() ? 0 : d.y() > d.z() ? 1 : 2;
+        }
+
+    public:
+        point3 minimum;
+        point3 maximum;
+};
+
+inline aabb surrounding_box( aabb box0, const aabb& box1 ) {
+    box0.expand( box1 );
+    return box0;
+}
+
+
+# endif
@@ -0,0 +1,86 @@
+// aarect.h
+// Rectangles lined up with the axes: floors, walls, ceilings, light panels.
+//      Because the rectangle sits at a fixed value of one coordinate (say
+//      y = k for a floor), where a ray hits it is just one subtraction and
+//      one division, and then two range checks to see if that point is
+//      inside the rectangle. Much cheaper than a sphere's quadratic.
+//
+// "axis" is the one the rectangle is flat along (the direction its normal
+//      points): 0 for x, 1 for y, 2 for z. The other two run from a0 to a1
+//      and b0 to b1, in x, y, z order- so an xz_rect goes from x0 to x1 and
+//      z0 to z1, like in the book.
+
+# ifndef AARECT_H
+# define AARECT_H
+
+# include "rtweekend.h"
+
+# include "hittable.h"
+
+template <int axis>
+class aarect : public hittable {
+    public:
+        aarect() {}
+        aarect( double _a0, double _a1, double _b0, double _b1, double _k, shared_ptr<material> m )
+            : a0(_a0), a1(_a1), b0(_b0), b1(_b1), k(_k), mat_ptr(m) {}
+
+        virtual bool hit( const ray& r, double t_min, double t_max, hit_record& rec ) const override;
+
+        // The box has to be a little thick in the flat direction, or it would
+        //      have no volume and the BVH's slab tests could miss it.
+        virtual bool bounding_box( double time0, double time1, aabb& output_box ) const override {
+            point3 lo, hi;
+            lo[axis] = k - 0.0001;
+            hi[axis] = k + 0.0001;
+            lo[a_axis] = a0;
+            hi[a_axis] = a1;
+            lo[b_axis] = b0;
+            hi[b_axis] = b1;
+            output_box = aabb( lo, hi );
+            return true;
+        }
+
+    public:
+        // The two axes the rectangle spans, in x, y, z order.
+        static const int a_axis = axis == 0 ? 1 : 0;
+        static const int b_axis = axis == 2 ? 1 : 2;
+
+        double a0, a1, b0, b1, k;
+        shared_ptr<material> mat_ptr;
+};
+
+using yz_rect = aarect<0>;
+using xz_rect = aarect<1>;
+using xy_rect = aarect<2>;
+
+
+template <int axis>
+bool aarect<axis>::hit( const ray& r, double t_min, double t_max, hit_record& rec ) const {
+    const point3 origin = r.origin();
+    const vec3 d = r.direction();
+    // A ray running parallel to the rectangle gives t = +-infinity (or NaN),
+    //      which fails the range check below, so there's no special case.
+    auto t = (k - origin[axis]) / d[axis];
+    if ( !(t >= t_min && t <= t_max) )
+        return false;
+    auto a = origin[a_axis] + t*d[a_axis];
+    auto b = origin[b_axis] + t*d[b_axis];
+    if ( a < a0 || a > a1 || b < b0 || b > b1 )
+        return false;
+
+    rec.t = t;
+    rec.p[axis] = k;        // exactly on the rectangle, with no rounding error
+    rec.p[a_axis] = a;
+    rec.p[b_axis] = b;
+    rec.u = (a - a0) / (a1 - a0);
+    rec.v = (b - b0) / (b1 - b0);
+    rec.uv_length = a1 - a0;
+    vec3 outward_normal( 0, 0, 0 );
+    outward_normal[axis] = 1;
+    rec.set_face_normal( r, outward_normal );
+    rec.mat_ptr = mat_ptr.get();
+    return true;
+}
+
+
+# endif
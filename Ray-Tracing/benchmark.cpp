@@ -0,0 +1,869 @@
+// benchmark.cpp
+// Microbenchmarks for the hot parts of the renderer. Each one times a small
+//      piece of work in a loop and prints how many per second we managed.
+//      "./benchmark" runs them all, "./benchmark NAME" runs just one.
+//      Build with optimization on, or the numbers don't mean much.
+
+# include "rtweekend.h"
+
+# include "aarect.h"
+# include "box.h"
+# include "bvh.h"
+# include "camera.h"
+# include "cpu_dispatch.h"
+# include "framebuffer.h"
+# include "golden.h"
+# include "grid_medium.h"
+# include "perlin.h"
+# include "hittable.h"
+# include "hittable_list.h"
+# include "irradiance_cache.h"
+# include "material.h"
+# include "plane.h"
+# include "sphere.h"
+# include "sphere_collection.h"
+# include "render.h"
+# include "render_engine.h"
+# include "scenes.h"
+# include "wavefront.h"
+
+# include <chrono>
+# include <functional>
+# include <iomanip>
+# include <iostream>
+# include <string>
+# include <vector>
+
+using namespace std ;
+
+// Keeps the compiler from throwing away work whose result we never use.
+volatile double sink = 0 ;
+
+// Checks that went wrong; any makes the benchmark exit with an error.
+int failures = 0 ;
+
+// Runs "body" once and returns how long it took in seconds.
+double time_seconds( const function<void()>& body ) {
+    auto start = chrono::steady_clock::now() ;
+    body() ;
+    return chrono::duration<double>( chrono::steady_clock::now() - start ).count() ;
+}
+
+void report( const string& name, double count, double seconds, const string& unit ) {
+    cout << "  " << left << setw(34) << name << right << setw(10) << fixed << setprecision(2)
+         << count / seconds / 1e6 << " M" << unit << "/s\n" ;
+}
+
+
+// scatter: how fast each kind of material bounces a ray.
+//      "direct" calls the concrete class, "material" goes through the
+//      std::variant in material.h, and "virtual" goes through a virtual
+//      function like materials used to, for comparison.
+
+struct virtual_material {
+    virtual ~virtual_material() = default ;
+    virtual bool scatter( const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered ) const = 0 ;
+};
+
+template <typename kind>
+struct virtual_adapter : virtual_material {
+    virtual_adapter( const kind& k ) : m(k) {}
+    bool scatter( const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered ) const override {
+        return m.scatter( r_in, rec, attenuation, scattered ) ;
+    }
+    kind m ;
+};
+
+struct scatter_input {
+    ray r_in ;
+    hit_record rec ;
+};
+
+vector<scatter_input> make_scatter_inputs( int n ) {
+    vector<scatter_input> inputs( n ) ;
+    for ( auto& in : inputs ) {
+        in.rec.p = vec3::random( -1, 1 ) ;
+        in.rec.normal = random_unit_vector() ;
+        in.rec.front_face = random_double() < 0.5 ;
+        in.rec.u = random_double() ;
+        in.rec.v = random_double() ;
+        in.rec.t = 1 ;
+        in.r_in = ray( point3(0,0,0), random_unit_vector() - in.rec.normal ) ;
+    }
+    return inputs ;
+}
+
+template <typename scatter_fn>
+double run_scatters( const vector<scatter_input>& inputs, int rounds, scatter_fn scatter ) {
+    double total = 0 ;
+    double seconds = time_seconds( [&] {
+        color attenuation ;
+        ray scattered ;
+        for ( int round = 0; round < rounds; ++round ) {
+            for ( size_t k = 0; k < inputs.size(); ++k ) {
+                if ( scatter( k, inputs[k].r_in, inputs[k].rec, attenuation, scattered ) )
+                    total += attenuation.x() + scattered.direction().x() ;
+            }
+        }
+    } ) ;
+    sink = sink + total ;
+    return seconds ;
+}
+
+void bench_scatter() {
+    cout << "scatter\n" ;
+    const int n = 1 << 16 ;
+    const int rounds = 40 ;
+    auto inputs = make_scatter_inputs( n ) ;
+
+    vector<material> kinds = {
+        lambertian( color(0.5, 0.5, 0.5) ), metal( color(0.7, 0.6, 0.5), 0.2 ), dielectric( 1.5 )
+    } ;
+    vector<shared_ptr<virtual_material>> virtual_kinds = {
+        make_shared<virtual_adapter<lambertian>>( get<lambertian>(kinds[0].bsdf) ),
+        make_shared<virtual_adapter<metal>>( get<metal>(kinds[1].bsdf) ),
+        make_shared<virtual_adapter<dielectric>>( get<dielectric>(kinds[2].bsdf) ),
+    } ;
+    const char* names[] = { "lambertian", "metal", "dielectric" } ;
+
+    for ( int m = 0; m < 3; ++m ) {
+        const material& mat = kinds[m] ;
+        const virtual_material& virt = *virtual_kinds[m] ;
+        // Picking the kind once, outside the loop, leaves a plain direct call inside it.
+        double direct = visit( [&]( const auto& k ) {
+            return run_scatters( inputs, rounds, [&]( size_t, const ray& r, const hit_record& rec, color& a, ray& s ) {
+                return k.scatter( r, rec, a, s ) ;
+            } ) ;
+        }, mat.bsdf ) ;
+        double variant = run_scatters( inputs, rounds, [&]( size_t, const ray& r, const hit_record& rec, color& a, ray& s ) {
+            return mat.scatter( r, rec, a, s ) ;
+        } ) ;
+        double virtual_call = run_scatters( inputs, rounds, [&]( size_t, const ray& r, const hit_record& rec, color& a, ray& s ) {
+            return virt.scatter( r, rec, a, s ) ;
+        } ) ;
+        report( string(names[m]) + " direct", double(n) * rounds, direct, "scatters" ) ;
+        report( string(names[m]) + " material", double(n) * rounds, variant, "scatters" ) ;
+        report( string(names[m]) + " virtual", double(n) * rounds, virtual_call, "scatters" ) ;
+    }
+
+    // The realistic case: a random mix, so the kind changes from call to call.
+    vector<int> mix( n ) ;
+    for ( auto& m : mix )
+        m = random_int( 0, 2 ) ;
+    double variant = run_scatters( inputs, rounds, [&]( size_t k, const ray& r, const hit_record& rec, color& a, ray& s ) {
+        return kinds[ mix[k] ].scatter( r, rec, a, s ) ;
+    } ) ;
+    double virtual_call = run_scatters( inputs, rounds, [&]( size_t k, const ray& r, const hit_record& rec, color& a, ray& s ) {
+        return virtual_kinds[ mix[k] ]->scatter( r, rec, a, s ) ;
+    } ) ;
+    report( "mixed material", double(n) * rounds, variant, "scatters" ) ;
+    report( "mixed virtual", double(n) * rounds, virtual_call, "scatters" ) ;
+}
+
+
+// wavefront: rays per second through random_scene() for the recursive
+//      ray_color loop and for the wavefront integrator with each kind of
+//      sorting. Both trace exactly the same rays, so the wavefront's ray
+//      count is used for both.
+void bench_wavefront() {
+    cout << "wavefront\n" ;
+    const int width = 240, height = 135, spp = 4, max_depth = 50 ;
+    seed_random( 1 ) ;
+    auto world = random_scene() ;
+    camera cam( point3(13,2,3), point3(0,0,0), vec3(0,1,0), 20, 16.0/9.0, 0.1, 10.0 ) ;
+    render_region all{ 0, 0, width, height, 0, spp } ;
+
+    wavefront_stats counted ;
+    const pair<const char*, wavefront_sort> sorts[] = {
+        { "wavefront, unsorted", wavefront_sort::none },
+        { "wavefront, by material", wavefront_sort::material },
+        { "wavefront, by material+octant", wavefront_sort::material_octant },
+    } ;
+    vector<pair<string, double>> times ;
+    for ( auto& s : sorts ) {
+        framebuffer fb( width, height ) ;
+        wavefront_integrator integrator( world, max_depth, s.second ) ;
+        times.push_back( { s.first, time_seconds( [&] { integrator.render( cam, 1, all, fb ) ; } ) } ) ;
+        counted = integrator.stats ;
+    }
+
+    // How big the queue is, sorted by material: one strip of one sample
+    //      (what a 16x16 tile used to get), and up.
+    for ( int queue : { 256, 1024, wavefront_integrator::default_queue, 16384, 65536 } ) {
+        framebuffer fb( width, height ) ;
+        wavefront_integrator integrator( world, max_depth, wavefront_sort::material, queue ) ;
+        times.push_back( { "wavefront, queue of " + to_string(queue),
+                           time_seconds( [&] { integrator.render( cam, 1, all, fb ) ; } ) } ) ;
+    }
+
+    framebuffer fb( width, height ) ;
+    double recursive = time_seconds( [&] { render( world, cam, 1, max_depth, all, fb ) ; } ) ;
+    report( "recursive ray_color", double(counted.rays), recursive, "rays" ) ;
+    for ( auto& t : times )
+        report( t.first, double(counted.rays), t.second, "rays" ) ;
+}
+
+
+// scene: build time and memory per sphere for random_scene() grids from a
+//      thousand to ten million small spheres.
+void bench_scene() {
+    cout << "scene\n" ;
+    for ( long long target = 1000; target <= 10000000; target *= 10 ) {
+        scene_params params ;
+        params.extent = static_cast<int>( ceil( sqrt( double(target) ) / 2 ) ) ;
+        params.big_spheres = false ;
+        params.accel = scene_accel::none ;   // timed by bench_bvh
+        scene_stats stats ;
+        random_scene( params, &stats ) ;
+        cout << "  " << fixed << setw(9) << stats.spheres << " spheres  "
+             << setw(9) << setprecision(2) << stats.build_seconds * 1000 << " ms  "
+             << setw(6) << setprecision(1) << stats.build_seconds * 1e9 / stats.spheres << " ns/sphere  "
+             << setw(4) << stats.bytes / stats.spheres << " bytes/sphere\n" ;
+    }
+}
+
+
+// bvh: build time, size, and SAH cost of each kind of BVH, and how fast
+//      rays go through it, for random_scene() and two bigger grids.
+//      "none" is the plain list, for comparison; it's skipped for the big
+//      grids, where it would take minutes.
+void bench_bvh() {
+    cout << "bvh\n" ;
+    const int width = 96, height = 54, spp = 2, max_depth = 50 ;
+    camera cam( point3(13,2,3), point3(0,0,0), vec3(0,1,0), 20, 16.0/9.0, 0.1, 10.0 ) ;
+    render_region all{ 0, 0, width, height, 0, spp } ;
+    const pair<const char*, scene_accel> accels[] = {
+        { "none", scene_accel::none }, { "sah", scene_accel::sah }, { "lbvh", scene_accel::lbvh },
+    } ;
+
+    for ( int extent : { 11, 158, 500 } ) {
+        for ( auto& a : accels ) {
+            if ( a.second == scene_accel::none && extent > 11 )
+                continue ;
+            scene_params params ;
+            params.extent = extent ;
+            params.accel = a.second ;
+            scene_stats stats ;
+            auto world = random_scene( params, &stats ) ;
+
+            framebuffer fb( width, height ) ;
+            wavefront_integrator integrator( world, max_depth, wavefront_sort::none ) ;
+            double seconds = time_seconds( [&] { integrator.render( cam, 1, all, fb ) ; } ) ;
+            cout << "  " << setw(8) << stats.spheres << " spheres " << left << setw(5) << a.first << right
+                 << fixed << setprecision(1) << setw(9) << stats.accel_seconds * 1000 << " ms build "
+                 << setw(9) << stats.accel_nodes << " nodes  SAH cost " << setw(6) << setprecision(1)
+                 << stats.accel_cost << setw(9) << setprecision(2) << integrator.stats.rays / seconds / 1e6
+                 << " Mrays/s\n" ;
+        }
+    }
+}
+
+
+// leaves: the largest leaf each builder makes over spheres stacked on top
+//      of each other, which no split by position can tell apart. Fails if
+//      either goes over bvh::leaf_limit.
+void bench_leaves() {
+    cout << "leaves\n" ;
+    hittable_list world ;
+    auto gray = make_shared<material>( lambertian( color(0.5, 0.5, 0.5) ) ) ;
+    for ( int k = 0; k < 1000; ++k ) {
+        world.add( make_shared<sphere>( point3(0, 1, 0), 1.0, gray ) ) ;
+        world.add( make_shared<sphere>( point3(4, 1, 0), 1.0, gray ) ) ;
+    }
+    for ( int k = 0; k < 100; ++k )
+        world.add( make_shared<sphere>( point3( random_double(-8, 8), 0.2, random_double(-8, 8) ), 0.2, gray ) ) ;
+
+    const pair<const char*, bvh_builder> builders[] = { { "sah", bvh_builder::sah }, { "lbvh", bvh_builder::lbvh } } ;
+    for ( auto& b : builders ) {
+        bvh tree( world, b.second, 1 ) ;
+        size_t largest = tree.largest_leaf() ;
+        bool ok = largest <= bvh::leaf_limit ;
+        cout << "  " << left << setw(5) << b.first << right << setw(6) << tree.node_count() << " nodes, largest leaf "
+             << largest << ( ok ? "" : "  TOO BIG" ) << '\n' ;
+        if ( !ok )
+            ++failures ;
+    }
+}
+
+
+// threads: how rendering random_scene() scales from one thread to one per
+//      core, with each way of pinning the threads.
+void bench_threads() {
+    cout << "threads\n" ;
+    const int width = 320, height = 180, spp = 4, max_depth = 50 ;
+    auto world = random_scene() ;
+    camera cam( point3(13,2,3), point3(0,0,0), vec3(0,1,0), 20, 16.0/9.0, 0.1, 10.0 ) ;
+
+    vector<int> counts ;
+    for ( int t = 1; t < default_thread_count(); t *= 2 )
+        counts.push_back( t ) ;
+    counts.push_back( default_thread_count() ) ;
+
+    const pair<const char*, pin_mode> pins[] = {
+        { "none", pin_mode::none }, { "compact", pin_mode::compact }, { "spread", pin_mode::spread },
+    } ;
+    for ( auto& p : pins ) {
+        double one = 0 ;
+        for ( int threads : counts ) {
+            framebuffer fb( width, height ) ;
+            double seconds = time_seconds( [&] {
+                render_tiles( width, height, 0, spp, threads, p.second, [&] {
+                    return [&, batch = ray_batch()]( const render_region& region ) mutable {
+                        render( world, cam, 1, max_depth, region, fb, batch ) ;
+                    } ;
+                }, []( long long ) {} ) ;
+            } ) ;
+            if ( threads == 1 )
+                one = seconds ;
+            cout << "  " << left << setw(34) << string(p.first) + ", " + to_string(threads) + " threads"
+                 << right << setw(10) << fixed << setprecision(2) << double(width) * height * spp / seconds / 1e6
+                 << " Msamples/s" << setw(8) << one / seconds << "x\n" ;
+        }
+    }
+}
+
+
+// glass: how fast an all-glass random_scene() converges with and without
+//      Russian roulette, with clear glass and with tinted glass. A 1024
+//      sample render without roulette is the reference; every other
+//      render's error is its rms difference from it (in 8 bit levels).
+//      Roulette makes samples cheaper but noisier, so the number that
+//      counts is 1/(error^2 x time): higher is better.
+void bench_glass() {
+    cout << "glass\n" ;
+    const int width = 160, height = 90 ;
+    camera cam( point3(13,2,3), point3(0,0,0), vec3(0,1,0), 20, 16.0/9.0, 0.1, 10.0 ) ;
+    output_encoder encoder ;
+
+    for ( bool tinted : { false, true } ) {
+        scene_params params ;
+        params.diffuse = 0 ;
+        params.metal = 0 ;
+        if ( tinted )
+            params.glass_absorption = color( 0.5, 2, 4 ) ;
+        auto world = random_scene( params ) ;
+
+        auto render_image = [&]( int spp, const path_settings& path, vector<unsigned char>& rgb ) {
+            framebuffer fb( width, height ) ;
+            double seconds = time_seconds( [&] {
+                render_tiles( width, height, 0, spp, 0, pin_mode::none, [&] {
+                    return [&, batch = ray_batch()]( const render_region& region ) mutable {
+                        render( world, cam, 1, path, region, fb, batch ) ;
+                    } ;
+                }, []( long long ) {} ) ;
+            } ) ;
+            rgb.resize( 3 * width * height ) ;
+            encoder.encode_image( fb, rgb.data() ) ;
+            return seconds ;
+        } ;
+
+        vector<unsigned char> reference, rgb ;
+        render_image( 1024, path_settings(50, 0), reference ) ;
+        for ( int roulette : { 0, 3 } ) {
+            for ( int spp = 4; spp <= 64; spp *= 4 ) {
+                double seconds = render_image( spp, path_settings(50, roulette), rgb ) ;
+                double rmse = compare_images( rgb.data(), reference.data(), width, height ).rmse ;
+                cout << "  " << (tinted ? "tinted" : "clear ") << ( roulette ? ", roulette" : ", no roulette" )
+                     << setw(5) << spp << " spp " << fixed << setprecision(3) << setw(8) << seconds
+                     << " s  rmse " << setprecision(2) << setw(6) << rmse << "  1/(rmse^2 s) "
+                     << setprecision(3) << setw(7) << 1 / (rmse * rmse * seconds) << '\n' ;
+            }
+        }
+    }
+}
+
+
+// volume: finding where rays hit a particle in a grid of smoke, with delta
+//      tracking (grid_medium) and with plain ray marching- stepping along
+//      the ray one voxel at a time, adding up density until it passes a
+//      random threshold- for comparison. Both should hit about the same
+//      fraction of rays; marching is a little off because it only looks
+//      at one spot per step.
+bool march_collision( const grid_medium& grid, const aabb& box, double step, const ray& r, double& t ) {
+    vec3 d = r.direction() ;
+    double t_enter, t_exit = infinity ;
+    if ( !box.hit( r.origin(), vec3(1/d.x(), 1/d.y(), 1/d.z()), 0, infinity, t_enter ) )
+        return false ;
+    for ( int a = 0; a < 3; ++a )
+        t_exit = fmin( t_exit, ( (d[a] < 0 ? box.min()[a] : box.max()[a]) - r.origin()[a] ) / d[a] ) ;
+
+    double dt = step / d.length() ;
+    double depth = -log( 1 - random_double() ) ;
+    for ( double s = t_enter + 0.5*dt; s < t_exit; s += dt ) {
+        depth -= grid.sigma_at( r.at(s) ) * step ;
+        if ( depth <= 0 ) {
+            t = s ;
+            return true ;
+        }
+    }
+    return false ;
+}
+
+void bench_volume() {
+    cout << "volume\n" ;
+    // The cloud only fills the middle of its grid, like most smoke does.
+    point3 center( 0, 0, 0 ) ;
+    vec3 radii( 6, 1.2, 2.5 ) ;
+    aabb box( center - 2*radii, center + 2*radii ) ;
+    perlin noise ;
+    auto density = [&]( const point3& p ) {
+        vec3 q = p - center ;
+        double r = vec3( q.x()/radii.x(), q.y()/radii.y(), q.z()/radii.z() ).length() ;
+        return r >= 1 ? 0.0 : (1 - r) * clamp( 1.6 * noise.turb(0.8 * p) - 0.2, 0.0, 1.0 ) ;
+    } ;
+
+    for ( double sigma : { 1.0, 8.0 } ) {
+        seed_random( 1 ) ;
+        const int resolution = 128 ;
+        shared_ptr<grid_medium> grid ;
+        double build = time_seconds( [&] {
+            grid = make_shared<grid_medium>( box, resolution, density, sigma, color(1,1,1) ) ;
+        } ) ;
+        cout << "  sigma " << setprecision(0) << sigma << ": built in " << fixed << setprecision(1) << build * 1000 << " ms, "
+             << grid->memory_bytes() / 1024 << " KB (" << grid->dense_bytes() / 1024 << " KB dense, "
+             << grid->blocks_stored() << " blocks stored)\n" ;
+
+        // Rays from all around towards random points in the box.
+        const int n = 200000 ;
+        vector<ray> rays( n ) ;
+        for ( auto& r : rays ) {
+            point3 target( random_double(box.min().x(), box.max().x()), random_double(box.min().y(), box.max().y()),
+                           random_double(box.min().z(), box.max().z()) ) ;
+            point3 from = center + 20 * random_unit_vector() ;
+            r = ray( from, target - from ) ;
+        }
+
+        int hits = 0 ;
+        double t ;
+        double delta = time_seconds( [&] {
+            for ( auto& r : rays )
+                hits += grid->sample_collision( r, 0, infinity, t ) ;
+        } ) ;
+        cout << "  " << left << setw(34) << "delta tracking" << right << setw(10) << setprecision(2)
+             << n / delta / 1e6 << " Mrays/s" << setw(8) << setprecision(3) << double(hits) / n << " hit\n" ;
+
+        double step = fmax( radii.x(), fmax(radii.y(), radii.z()) ) * 4 / resolution ;
+        hits = 0 ;
+        double march = time_seconds( [&] {
+            for ( auto& r : rays )
+                hits += march_collision( *grid, box, step, r, t ) ;
+        } ) ;
+        cout << "  " << left << setw(34) << "ray marching, one voxel steps" << right << setw(10) << setprecision(2)
+             << n / march / 1e6 << " Mrays/s" << setw(8) << setprecision(3) << double(hits) / n << " hit\n" ;
+    }
+}
+
+
+// primitives: ray tests against a floor and a box, each made a few ways.
+//      The floor is the book's sphere of radius 1000, a plane, and a 22x22
+//      rectangle; the box is the book's six rectangles in a hittable_list
+//      and the single box primitive. Rays come from above and look down at
+//      the middle, so nearly all of them hit.
+void bench_primitives() {
+    cout << "primitives\n" ;
+    const int n = 1000000 ;
+    vector<ray> rays( n ) ;
+    for ( auto& r : rays ) {
+        point3 from = point3( 0, 2, 0 ) + 10 * random_unit_vector() ;
+        from[1] = fabs( from[1] ) + 0.5 ;
+        r = ray( from, point3( random_double(-8, 8), random_double(0, 1.5), random_double(-8, 8) ) - from ) ;
+    }
+
+    auto m = make_shared<material>( lambertian( color(0.5, 0.5, 0.5) ) ) ;
+    hittable_list six ;
+    point3 p0( -4, 0, -4 ), p1( 4, 1.5, 4 ) ;
+    six.add( make_shared<xy_rect>( p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), m ) ) ;
+    six.add( make_shared<xy_rect>( p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), m ) ) ;
+    six.add( make_shared<xz_rect>( p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), m ) ) ;
+    six.add( make_shared<xz_rect>( p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), m ) ) ;
+    six.add( make_shared<yz_rect>( p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), m ) ) ;
+    six.add( make_shared<yz_rect>( p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), m ) ) ;
+
+    const pair<const char*, shared_ptr<hittable>> shapes[] = {
+        { "floor: sphere, radius 1000", make_shared<sphere>( point3(0,-1000,0), 1000, m ) },
+        { "floor: plane", make_shared<plane>( point3(0,0,0), vec3(0,1,0), m ) },
+        { "floor: xz_rect", make_shared<xz_rect>( -11, 11, -11, 11, 0, m ) },
+        { "box: six rectangles", make_shared<hittable_list>( six ) },
+        { "box: one box", make_shared<box>( p0, p1, m ) },
+    } ;
+    for ( auto& shape : shapes ) {
+        hit_record rec ;
+        int hits = 0 ;
+        double seconds = time_seconds( [&] {
+            for ( auto& r : rays )
+                hits += shape.second->hit( r, 0.001, infinity, rec ) ;
+        } ) ;
+        sink = sink + rec.t ;
+        cout << "  " << left << setw(34) << shape.first << right << setw(10) << fixed << setprecision(2)
+             << n / seconds / 1e6 << " Mrays/s" << setw(8) << setprecision(3) << double(hits) / n << " hit\n" ;
+    }
+}
+
+
+// engine: many small render jobs on one resident scene, each starting its
+//      own threads (render_tiles) against all of them sharing one
+//      render_engine, one after another or submitted together. Then how
+//      quickly a big job stops when cancelled.
+void bench_engine() {
+    cout << "engine\n" ;
+    const int width = 96, height = 54, spp = 2, jobs = 64 ;
+    auto world = make_shared<const hittable_list>( random_scene() ) ;
+    camera cam = random_scene_camera( 16.0/9.0 ).make_camera() ;
+    render_settings settings ;
+    settings.samples_per_pixel = spp ;
+    vector<framebuffer> fbs( jobs, framebuffer( width, height ) ) ;
+
+    auto report_jobs = [&]( const string& name, double seconds ) {
+        cout << "  " << left << setw(34) << name << right << setw(10) << fixed << setprecision(1)
+             << jobs / seconds << " jobs/s\n" ;
+    } ;
+    report_jobs( "threads per job", time_seconds( [&] {
+        for ( int k = 0; k < jobs; ++k ) {
+            render_tiles( width, height, 0, spp, 0, pin_mode::none, [&] {
+                return [&, batch = ray_batch()]( const render_region& region ) mutable {
+                    render( *world, cam, k, settings.paths, region, fbs[k], batch ) ;
+                } ;
+            }, []( long long ) {} ) ;
+        }
+    } ) ) ;
+
+    render_engine engine ;
+    report_jobs( "engine, one job at a time", time_seconds( [&] {
+        for ( int k = 0; k < jobs; ++k ) {
+            settings.seed = k ;
+            engine.render( world, cam, settings, fbs[k] ) ;
+        }
+    } ) ) ;
+    report_jobs( "engine, all jobs submitted at once", time_seconds( [&] {
+        vector<shared_ptr<render_job>> submitted ;
+        for ( int k = 0; k < jobs; ++k ) {
+            settings.seed = k ;
+            submitted.push_back( engine.submit( world, cam, settings, fbs[k] ) ) ;
+        }
+        for ( auto& job : submitted )
+            job->wait() ;
+    } ) ) ;
+
+    framebuffer big( 640, 360 ) ;
+    settings.samples_per_pixel = 64 ;
+    chrono::steady_clock::time_point asked ;
+    auto job = engine.submit( world, cam, settings, big, [&]( long long done, long long ) {
+        if ( done == 1 )
+            asked = chrono::steady_clock::now() ;
+        return done < 1 ;
+    } ) ;
+    job->wait() ;
+    double ms = chrono::duration<double>( chrono::steady_clock::now() - asked ).count() * 1000 ;
+    cout << "  cancelled after " << job->tiles_done() << " of " << job->tiles_total() << " tiles, stopped in "
+         << setprecision(1) << ms << " ms\n" ;
+}
+
+
+// geometry: rendering a 400k sphere grid with its spheres in memory, and out
+//      of core (see geometry_cache.h) with budgets of all of the chunks the
+//      camera's rays reach down to a tenth of them. The cache is emptied
+//      between runs so each one starts cold.
+void bench_geometry() {
+    cout << "geometry\n" ;
+    const int width = 320, height = 180, spp = 4 ;
+    const string path = "benchmark-geometry.bin" ;
+    camera cam = random_scene_camera( 16.0/9.0 ).make_camera() ;
+    render_settings settings ;
+    settings.samples_per_pixel = spp ;
+    render_engine engine ;
+    output_encoder encoder ;
+    vector<unsigned char> reference( 3 * width * height ), rgb( 3 * width * height ) ;
+
+    scene_params params ;
+    params.extent = 316 ;
+    scene_stats stats ;
+    auto world = make_shared<const hittable_list>( random_scene( params, &stats ) ) ;
+    framebuffer fb( width, height ) ;
+    double seconds = time_seconds( [&] { engine.render( world, cam, settings, fb ) ; } ) ;
+    cout << "  " << left << setw(34) << "in memory" << right << setw(10) << fixed << setprecision(2)
+         << double(width) * height * spp / seconds / 1e6 << " Msamples/s  "
+         << ( stats.bytes + stats.accel_bytes ) / 1e6 << " MB of spheres and BVH\n" ;
+    encoder.encode_image( fb, reference.data() ) ;
+    world.reset() ;
+
+    params.geometry_file = path ;
+    world = make_shared<const hittable_list>( random_scene( params, &stats ) ) ;
+    cout << "  wrote " << stats.spheres << " spheres in " << stats.chunks << " chunks in "
+         << setprecision(0) << stats.build_seconds * 1000 << " ms\n" ;
+    geometry_cache& cache = global_geometry_cache() ;
+    size_t working_set = 0 ;
+    for ( double fraction : { 1.0, 0.5, 0.25, 0.1 } ) {
+        cache.set_budget( 0 ) ;
+        cache.set_budget( fraction == 1 ? size_t(1) << 40 : size_t(working_set * fraction) ) ;
+        auto before = cache.stats() ;
+        framebuffer out_of_core( width, height ) ;
+        seconds = time_seconds( [&] { engine.render( world, cam, settings, out_of_core ) ; } ) ;
+        auto after = cache.stats() ;
+        encoder.encode_image( out_of_core, rgb.data() ) ;
+        if ( fraction == 1 )
+            working_set = after.bytes ;
+        uint64_t hits = after.hits - before.hits, misses = after.misses - before.misses ;
+        cout << "  " << left << setw(34) << "out of core, " + to_string( int(fraction * 100) ) + "% budget"
+             << right << setw(10) << setprecision(2) << double(width) * height * spp / seconds / 1e6
+             << " Msamples/s  " << setw(6) << setprecision(1) << ( fraction == 1 ? working_set : size_t(working_set * fraction) ) / 1e6
+             << " MB, " << setprecision(2) << 100.0 * hits / max<uint64_t>( hits + misses, 1 ) << "% hits, "
+             << ( after.bytes_read - before.bytes_read ) / 1e6 << " MB read"
+             << ( rgb == reference ? "" : "  (different picture!)" ) << "\n" ;
+    }
+    cache.set_budget( size_t(1) << 30 ) ;
+    world.reset() ;
+    remove( path.c_str() ) ;
+}
+
+
+// guiding: how noisy room_scene() is at 128 samples without path guiding,
+//      with the guide trained over the first 5 or 7 passes, and with a
+//      guide trained by an earlier frame (so every sample is guided).
+//      Noise is the rms difference between two renders with different
+//      seeds, over sqrt(2); 1/(noise^2 x time) is the number that counts.
+void bench_guiding() {
+    cout << "guiding\n" ;
+    const int width = 160, height = 90, spp = 128 ;
+    auto world = make_shared<const hittable_list>( room_scene() ) ;
+    camera cam = room_scene_camera( 16.0/9.0 ).make_camera() ;
+    output_settings look ;
+    look.exposure = 4 ;
+    output_encoder encoder( look ) ;
+    render_engine engine ;
+    render_settings settings ;
+    settings.samples_per_pixel = spp ;
+
+    guide_field earlier( room_scene_bounds() ) ;
+    framebuffer scratch( width, height ) ;
+    settings.seed = 100 ;
+    engine.render_guided( world, cam, settings, scratch, earlier, 7 ) ;
+
+    for ( int passes : { -1, 5, 7, 0 } ) {
+        vector<unsigned char> rgb[2] ;
+        double seconds = 0 ;
+        for ( int k = 0; k < 2; ++k ) {
+            framebuffer fb( width, height ) ;
+            settings.seed = k + 1 ;
+            guide_field guide( room_scene_bounds() ) ;
+            seconds += time_seconds( [&] {
+                if ( passes < 0 )
+                    engine.render( world, cam, settings, fb ) ;
+                else
+                    engine.render_guided( world, cam, settings, fb, passes > 0 ? guide : earlier, passes ) ;
+            } ) ;
+            rgb[k].resize( 3 * width * height ) ;
+            encoder.encode_image( fb, rgb[k].data() ) ;
+        }
+        seconds /= 2 ;
+        double noise = compare_images( rgb[0].data(), rgb[1].data(), width, height ).rmse / sqrt( 2.0 ) ;
+        string name = passes < 0 ? "no guide" : passes > 0 ? "guide, " + to_string(passes) + " training passes"
+                                                          : "guide from an earlier frame" ;
+        cout << "  " << left << setw(34) << name << right << fixed << setprecision(2) << setw(8) << seconds
+             << " s  noise " << setw(6) << noise << "  1/(noise^2 s) " << setprecision(5) << setw(8)
+             << 1 / (noise * noise * seconds) << '\n' ;
+    }
+}
+
+// The irradiance cache preview against plain path tracing in the room,
+//      where nearly all the light is indirect: how far each is from a
+//      reference picture, and how long it took (the cache's time includes
+//      filling it).
+void bench_irradiance() {
+    cout << "irradiance\n" ;
+    const int width = 160, height = 90 ;
+    auto world = make_shared<const hittable_list>( room_scene() ) ;
+    camera cam = room_scene_camera( 16.0/9.0 ).make_camera() ;
+    output_settings look ;
+    look.exposure = 4 ;
+    output_encoder encoder( look ) ;
+    render_engine engine ;
+
+    auto picture = [&]( int spp, const irradiance_cache* cache, vector<unsigned char>& rgb ) {
+        framebuffer fb( width, height ) ;
+        render_settings settings ;
+        settings.seed = 1 ;
+        settings.samples_per_pixel = spp ;
+        settings.irradiance = cache ;
+        engine.render( world, cam, settings, fb ) ;
+        rgb.resize( 3 * width * height ) ;
+        encoder.encode_image( fb, rgb.data() ) ;
+    } ;
+    vector<unsigned char> reference ;
+    picture( 256, nullptr, reference ) ;
+
+    for ( int spp : { 16, 64, 4 } ) {
+        bool cached = spp == 4 ;
+        vector<unsigned char> rgb ;
+        size_t records = 0 ;
+        double seconds = time_seconds( [&] {
+            if ( !cached ) {
+                picture( spp, nullptr, rgb ) ;
+                return ;
+            }
+            irradiance_cache cache ;
+            cache.fill( *world, cam, width, height, 1 ) ;
+            picture( spp, &cache, rgb ) ;
+            records = cache.size() ;
+        } ) ;
+        double error = compare_images( reference.data(), rgb.data(), width, height ).rmse ;
+        string name = cached ? "irradiance cache, " + to_string(records) + " records"
+                             : "path tracing, " + to_string(spp) + " spp" ;
+        cout << "  " << left << setw(34) << name << right << fixed << setprecision(2) << setw(8) << seconds
+             << " s  rms error " << setw(6) << error << '\n' ;
+    }
+}
+
+
+// budget: the book's scene in a fixed time, against a 512 sample reference:
+//      render_budgeted(), and plain rendering with as many samples per
+//      pixel as fit in the same time. Also how far past the deadline the
+//      budgeted render finished.
+void bench_budget() {
+    cout << "budget\n" ;
+    const int width = 200, height = 112 ;
+    scene_params params ;
+    params.seed = 5 ;
+    auto world = make_shared<const hittable_list>( random_scene( params ) ) ;
+    camera cam = random_scene_camera( 16.0/9.0 ).make_camera() ;
+    output_encoder encoder ;
+    render_engine engine ;
+    render_settings settings ;
+    settings.seed = 5 ;
+
+    auto encode = [&]( const framebuffer& fb ) {
+        vector<unsigned char> rgb( 3 * width * height ) ;
+        encoder.encode_image( fb, rgb.data() ) ;
+        return rgb ;
+    } ;
+    auto uniform = [&]( int spp ) {
+        framebuffer fb( width, height ) ;
+        settings.samples_per_pixel = spp ;
+        engine.render( world, cam, settings, fb ) ;
+        return encode( fb ) ;
+    } ;
+    vector<unsigned char> reference = uniform( 512 ) ;
+    double one_sample = time_seconds( [&] { uniform( 4 ) ; } ) / 4 ;
+
+    for ( double seconds : { 0.25, 0.5, 1.0, 2.0 } ) {
+        int spp = max( 1, static_cast<int>( seconds / one_sample ) ) ;
+        vector<unsigned char> plain ;
+        double plain_seconds = time_seconds( [&] { plain = uniform( spp ) ; } ) ;
+
+        framebuffer fb( width, height ) ;
+        budget_report report = engine.render_budgeted( world, cam, settings, fb, seconds ) ;
+        vector<unsigned char> budgeted = encode( fb ) ;
+
+        cout << "  " << fixed << setprecision(2) << seconds << " s: " << setw(3) << spp << " spp in "
+             << plain_seconds << " s, rms error " << setw(5)
+             << compare_images( reference.data(), plain.data(), width, height ).rmse
+             << "   budgeted " << setw(5) << double(report.samples) / ( width * height ) << " spp in "
+             << report.seconds << " s, rms error " << setw(5)
+             << compare_images( reference.data(), budgeted.data(), width, height ).rmse
+             << ", " << setprecision(1) << ( report.seconds - seconds ) * 1000 << " ms late\n" ;
+    }
+}
+
+
+// isa: each copy of the vectorized loops (see cpu_dispatch.h) this CPU can
+//      run: rays against 64 spheres, camera rays, and framebuffer pixels
+//      turned into bytes. Every copy has to give exactly the same answers.
+void bench_isa() {
+    cout << "isa\n" ;
+    sphere_collection spheres ;
+    for ( int k = 0; k < 64; ++k )
+        spheres.add( point3( random_double(-8, 8), random_double(0, 2), random_double(-8, 8) ),
+                     random_double(0.2, 1), material( lambertian( color(0.5, 0.5, 0.5) ) ) ) ;
+    vector<ray> rays( 200000 ) ;
+    for ( auto& r : rays )
+        r = ray( point3( 0, 2, 12 ) + random_in_unit_sphere(), point3( random_double(-8, 8), 1, random_double(-8, 8) ) ) ;
+
+    camera cam = random_scene_camera( 16.0/9.0 ).make_camera() ;
+    const int width = 1920, height = 1080 ;
+    ray_batch batch ;
+    batch.resize( 256 ) ;
+    framebuffer fb( width, height ) ;
+    for ( int j = 0; j < height; ++j )
+        for ( int i = 0; i < width; ++i )
+            fb.add_sample( i, j, 3 * color::random() ) ;
+    output_settings look ;
+    look.tone = tone_mapper::aces ;
+    output_encoder encoder( look ) ;
+    vector<unsigned char> rgb( 3 * width * height ) ;
+
+    cpu_isa chosen = current_isa() ;
+    double expected_hits = 0, expected_rays = 0 ;
+    vector<unsigned char> expected_rgb ;
+    for ( cpu_isa isa : { cpu_isa::generic, cpu_isa::sse4, cpu_isa::avx2, cpu_isa::avx512 } ) {
+        if ( !use_isa( isa ) )
+            continue ;
+        hit_record rec ;
+        double hits = 0 ;
+        double sphere_seconds = time_seconds( [&] {
+            for ( auto& r : rays )
+                if ( spheres.hit( r, 0.001, infinity, rec ) )
+                    hits += rec.t ;
+        } ) ;
+
+        double ray_sum = 0 ;
+        const int tiles = 4000 ;
+        double camera_seconds = time_seconds( [&] {
+            for ( int k = 0; k < tiles; ++k ) {
+                ray_span span = batch.span() ;
+                cam.generate_rays( tile{ 0, 0, 16, 16 }, width, height, 1, k, span ) ;
+                ray_sum += span.dx[k % 256] + span.oy[k % 256] ;
+            }
+        } ) ;
+
+        double encode_seconds = time_seconds( [&] { encoder.encode_image( fb, rgb.data(), 1 ) ; } ) ;
+
+        if ( isa == cpu_isa::generic ) {
+            expected_hits = hits ;
+            expected_rays = ray_sum ;
+            expected_rgb = rgb ;
+        }
+        bool same = hits == expected_hits && ray_sum == expected_rays && rgb == expected_rgb ;
+        cout << "  " << left << setw(10) << isa_name( isa ) << right << fixed << setprecision(2)
+             << "spheres" << setw(7) << rays.size() / sphere_seconds / 1e6 << " Mrays/s   "
+             << "camera" << setw(7) << tiles * 256.0 / camera_seconds / 1e6 << " Mrays/s   "
+             << "encode" << setw(7) << double(width) * height / encode_seconds / 1e6 << " Mpixels/s"
+             << ( same ? "" : "  DIFFERENT from generic" ) << '\n' ;
+    }
+    use_isa( chosen ) ;
+}
+
+
+int main( int argc, char* argv[] ) {
+    seed_random( 1 ) ;
+
+    vector<pair<string, function<void()>>> benchmarks = {
+        { "scatter", bench_scatter },
+        { "wavefront", bench_wavefront },
+        { "scene", bench_scene },
+        { "bvh", bench_bvh },
+        { "leaves", bench_leaves },
+        { "threads", bench_threads },
+        { "glass", bench_glass },
+        { "volume", bench_volume },
+        { "primitives", bench_primitives },
+        { "engine", bench_engine },
+        { "geometry", bench_geometry },
+        { "guiding", bench_guiding },
+        { "irradiance", bench_irradiance },
+        { "budget", bench_budget },
+        { "isa", bench_isa },
+    } ;
+
+    string only = argc > 1 ? argv[1] : "" ;
+    bool ran = false ;
+    for ( auto& b : benchmarks ) {
+        if ( only.empty() || only == b.first ) {
+            b.second() ;
+            ran = true ;
+        }
+    }
+    if ( !ran ) {
+        cerr << "Unknown benchmark " << only << '\n' ;
+        return 1 ;
+    }
+    return failures > 0 ? 1 : 0 ;
+}
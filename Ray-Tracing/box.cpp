@@ -0,0 +1,67 @@
+// box.cpp
+// The ray test for a box (see box.h).
+
+# include "box.h"
+
+using namespace std ;
+
+
+bool box::hit( const ray& r, double t_min, double t_max, hit_record& rec ) const {
+    const point3 origin = r.origin();
+    const vec3 d = r.direction();
+
+    // The slab test, keeping track of which axis the ray crossed last going
+    //      in and first coming out.
+    double t_in = -infinity, t_out = infinity;
+    int in_axis = 0, out_axis = 0;
+    for ( int a = 0; a < 3; a++ ) {
+        auto inv = 1 / d[a];
+        auto t0 = (box_min[a] - origin[a]) * inv;
+        auto t1 = (box_max[a] - origin[a]) * inv;
+        if ( inv < 0 )
+            std::swap( t0, t1 );
+        if ( t0 > t_in ) {
+            t_in = t0;
+            in_axis = a;
+        }
+        if ( t1 < t_out ) {
+            t_out = t1;
+            out_axis = a;
+        }
+    }
+    if ( t_out < t_in )
+        return false;
+
+    // The way in, if it's in range; otherwise the ray starts inside (glass,
+    //      say) and we want the way out.
+    double t;
+    int axis;
+    double side;    // which way the face we hit points along "axis"
+    if ( t_in >= t_min && t_in <= t_max ) {
+        t = t_in;
+        axis = in_axis;
+        side = d[axis] < 0 ? 1 : -1;
+    } else if ( t_out >= t_min && t_out <= t_max ) {
+        t = t_out;
+        axis = out_axis;
+        side = d[axis] < 0 ? -1 : 1;
+    } else {
+        return false;
+    }
+
+    rec.t = t;
+    rec.p = r.at( t );
+    rec.p[axis] = side > 0 ? box_max[axis] : box_min[axis];    // exactly on the face
+    vec3 outward_normal( 0, 0, 0 );
+    outward_normal[axis] = side;
+    rec.set_face_normal( r, outward_normal );
+
+    // Texture coordinates run 0 to 1 across the face, along its other two axes in x, y, z order.
+    int ua = axis == 0 ? 1 : 0;
+    int va = axis == 2 ? 1 : 2;
+    rec.u = (rec.p[ua] - box_min[ua]) / (box_max[ua] - box_min[ua]);
+    rec.v = (rec.p[va] - box_min[va]) / (box_max[va] - box_min[va]);
+    rec.uv_length = box_max[ua] - box_min[ua];
+    rec.mat_ptr = mat_ptr.get();
+    return true;
+}
@@ -0,0 +1,36 @@
+// box.h
+// A solid box lined up with the axes, from corner p0 to corner p1. The book
+//      builds a box out of six rectangles in a hittable_list, which means six
+//      virtual calls and six tests per ray. A box is really just the "slab"
+//      test from aabb.h, so here it's one object: find where the ray goes in
+//      and comes out, remember which face each was on, and that face's
+//      normal is the answer.
+
+# ifndef BOX_H
+# define BOX_H
+
+# include "rtweekend.h"
+
+# include "hittable.h"
+
+class box : public hittable {
+    public:
+        box() {}
+        box( const point3& p0, const point3& p1, shared_ptr<material> m )
+            : box_min(p0), box_max(p1), mat_ptr(m) {}
+
+        virtual bool hit( const ray& r, double t_min, double t_max, hit_record& rec ) const override;
+
+        virtual bool bounding_box( double time0, double time1, aabb& output_box ) const override {
+            output_box = aabb( box_min, box_max );
+            return true;
+        }
+
+    public:
+        point3 box_min;
+        point3 box_max;
+        shared_ptr<material> mat_ptr;
+};
+
+
+# endif
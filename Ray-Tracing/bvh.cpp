@@ -0,0 +1,309 @@
+// bvh.cpp
+// Building a BVH, both ways, and walking it (see bvh.h).
+
+# include "bvh.h"
+
+using namespace std ;
+
+
+bvh::bvh( const hittable_list& list, bvh_builder builder, int threads ) {
+    if ( threads <= 0 )
+        threads = default_thread_count();
+    // Enough levels of tasks to keep every thread busy, plus a little slack.
+    while ( (1 << spawn_depth) < 2 * threads )
+        ++spawn_depth;
+
+    // Gather every part of every object, with its box and center.
+    std::vector<build_ref> refs;
+    aabb box;
+    for ( const auto& object : list.objects ) {
+        if ( !object->bounding_box(0, 0, box) ) {
+            unbounded.push_back( object );
+            continue;
+        }
+        uint32_t id = static_cast<uint32_t>( objects.size() );
+        objects.push_back( object );
+        size_t first = refs.size();
+        refs.resize( first + object->parts() );
+        parallel_for( 0, static_cast<long long>(object->parts()), [&]( long long part ) {
+            build_ref& ref = refs[first + part];
+            object->part_bounding_box( part, ref.box );
+            ref.centroid = ref.box.centroid();
+            ref.prim = primitive{ id, static_cast<uint32_t>(part) };
+        }, threads );
+    }
+    if ( refs.empty() )
+        return;
+
+    // A tree over n primitives never needs more than 2n-1 nodes.
+    nodes.resize( 2 * refs.size() );
+    node_total = 1;
+    if ( builder == bvh_builder::sah ) {
+        build_sah( 0, refs.data(), 0, refs.size(), 0 );
+    } else {
+        aabb centroids;
+        for ( const auto& ref : refs )
+            centroids.expand( ref.centroid );
+        vec3 extent = centroids.max() - centroids.min();
+        parallel_for( 0, static_cast<long long>(refs.size()), [&]( long long k ) {
+            uint32_t code = 0;
+            for ( int a = 0; a < 3; ++a ) {
+                double f = extent[a] > 0 ? (refs[k].centroid[a] - centroids.min()[a]) / extent[a] : 0.5;
+                uint32_t v = static_cast<uint32_t>( clamp(f * 1024, 0.0, 1023.0) );
+                // Spread v's 10 bits out so that there are two empty bits after each one.
+                v = (v | (v << 16)) & 0x030000FF;
+                v = (v | (v <<  8)) & 0x0300F00F;
+                v = (v | (v <<  4)) & 0x030C30C3;
+                v = (v | (v <<  2)) & 0x09249249;
+                code |= v << (2 - a);
+            }
+            refs[k].code = code;
+        }, threads );
+        radix_sort( refs );
+        build_lbvh( 0, refs.data(), 0, refs.size(), 0 );
+    }
+
+    nodes.resize( node_total );
+    nodes.shrink_to_fit();
+    prims.resize( refs.size() );
+    for ( size_t k = 0; k < refs.size(); ++k )
+        prims[k] = refs[k].prim;
+}
+
+void bvh::make_leaf( uint32_t index, const build_ref* refs, size_t begin, size_t end, const aabb& box ) {
+    nodes[index] = node{ box, static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin) };
+}
+
+void bvh::build_sah( uint32_t index, build_ref* refs, size_t begin, size_t end, int depth ) {
+    aabb box, centroids;
+    for ( size_t k = begin; k < end; ++k ) {
+        box.expand( refs[k].box );
+        centroids.expand( refs[k].centroid );
+    }
+
+    size_t count = end - begin;
+    int axis = centroids.longest_axis();
+    double lo = centroids.min()[axis];
+    double width = centroids.max()[axis] - lo;
+    // (The depth limit keeps the tree shallower than hit()'s stack.)
+    if ( count <= max_leaf || depth >= max_depth ) {
+        make_leaf( index, refs, begin, end, box );
+        return;
+    }
+    // Primitives whose centroids all coincide- copies of one sphere, say-
+    //      can't be split by position, so they're halved by count, as
+    //      build_lbvh does, to keep leaves small.
+    if ( width <= 0 ) {
+        build_sah_children( index, refs, begin, begin + count / 2, end, box, depth );
+        return;
+    }
+
+    // Drop every primitive into one of the bins along the axis.
+    struct bin {
+        aabb box;
+        size_t count = 0;
+    } b[bins];
+    auto bin_of = [&]( const build_ref& ref ) {
+        return std::min( bins - 1, static_cast<int>( bins * (ref.centroid[axis] - lo) / width ) );
+    };
+    for ( size_t k = begin; k < end; ++k ) {
+        bin& into = b[ bin_of(refs[k]) ];
+        into.box.expand( refs[k].box );
+        ++into.count;
+    }
+
+    // Cost of splitting after each bin: sweep from the right to get the right
+    //      sides, then from the left.
+    double right_cost[bins];
+    aabb right;
+    size_t right_count = 0;
+    for ( int i = bins - 1; i > 0; --i ) {
+        right.expand( b[i].box );
+        right_count += b[i].count;
+        right_cost[i] = right.half_area() * right_count;
+    }
+    int best = -1;
+    double best_cost = infinity;
+    aabb left;
+    size_t left_count = 0;
+    for ( int i = 0; i < bins - 1; ++i ) {
+        left.expand( b[i].box );
+        left_count += b[i].count;
+        double cost = left.half_area() * left_count + right_cost[i + 1];
+        if ( left_count > 0 && left_count < count && cost < best_cost ) {
+            best_cost = cost;
+            best = i;
+        }
+    }
+
+    // Stop if testing everything here is cheaper than any split (a node
+    //      test costs about as much as a primitive test).
+    double leaf_cost = box.half_area() * count;
+    double split_cost = box.half_area() + best_cost;
+    if ( best < 0 || (count <= leaf_limit && leaf_cost <= split_cost) ) {
+        make_leaf( index, refs, begin, end, box );
+        return;
+    }
+
+    build_ref* middle = std::partition( refs + begin, refs + end, [&]( const build_ref& ref ) {
+        return bin_of( ref ) <= best;
+    } );
+    build_sah_children( index, refs, begin, middle - refs, end, box, depth );
+}
+
+void bvh::build_sah_children( uint32_t index, build_ref* refs, size_t begin, size_t mid, size_t end,
+                              const aabb& box, int depth ) {
+    size_t count = end - begin;
+    uint32_t child = allocate_pair();
+    nodes[index] = node{ box, child, 0 };
+    if ( spawn(count, depth) ) {
+        auto left_task = std::async( std::launch::async, [this, child, refs, begin, mid, depth] {
+            build_sah( child, refs, begin, mid, depth + 1 );
+        } );
+        build_sah( child + 1, refs, mid, end, depth + 1 );
+        left_task.get();
+    } else {
+        build_sah( child, refs, begin, mid, depth + 1 );
+        build_sah( child + 1, refs, mid, end, depth + 1 );
+    }
+}
+
+aabb bvh::build_lbvh( uint32_t index, build_ref* refs, size_t begin, size_t end, int depth ) {
+    size_t count = end - begin;
+    uint32_t first = refs[begin].code, last = refs[end - 1].code;
+    if ( count <= max_leaf || depth >= max_depth ) {
+        aabb box;
+        for ( size_t k = begin; k < end; ++k )
+            box.expand( refs[k].box );
+        make_leaf( index, refs, begin, end, box );
+        return box;
+    }
+
+    // The codes are sorted, so everything before the first code with the
+    //      highest differing bit set goes left. Find that spot by bisection.
+    //      Primitives packed closer than the codes can tell apart all share
+    //      one code; those are halved by count instead, so leaves stay as
+    //      small as the SAH builder's.
+    size_t mid = begin + count / 2;
+    if ( first != last ) {
+        int bit = 31 - __builtin_clz( first ^ last );
+        uint32_t mask = ~0u << bit;
+        uint32_t split_prefix = (last & mask);
+        mid = std::lower_bound( refs + begin, refs + end, split_prefix,
+                                []( const build_ref& ref, uint32_t prefix ) { return ref.code < prefix; } ) - refs;
+    }
+
+    uint32_t child = allocate_pair();
+    aabb left, right;
+    if ( spawn(count, depth) ) {
+        auto left_task = std::async( std::launch::async, [this, child, refs, begin, mid, depth] {
+            return build_lbvh( child, refs, begin, mid, depth + 1 );
+        } );
+        right = build_lbvh( child + 1, refs, mid, end, depth + 1 );
+        left = left_task.get();
+    } else {
+        left = build_lbvh( child, refs, begin, mid, depth + 1 );
+        right = build_lbvh( child + 1, refs, mid, end, depth + 1 );
+    }
+    aabb box = surrounding_box( left, right );
+    nodes[index] = node{ box, child, 0 };
+    return box;
+}
+
+// Sorts by Morton code, 8 bits at a time, least significant first. Each
+//      pass counts how many codes fall in each of the 256 buckets, then
+//      copies every entry straight to its place.
+void bvh::radix_sort( std::vector<build_ref>& refs ) {
+    std::vector<build_ref> scratch( refs.size() );
+    for ( int shift = 0; shift < 32; shift += 8 ) {
+        size_t offset[257] = {};
+        for ( const auto& ref : refs )
+            ++offset[ ((ref.code >> shift) & 255) + 1 ];
+        for ( int d = 0; d < 256; ++d )
+            offset[d + 1] += offset[d];
+        for ( const auto& ref : refs )
+            scratch[ offset[(ref.code >> shift) & 255]++ ] = ref;
+        refs.swap( scratch );
+    }
+}
+
+bool bvh::hit( const ray& r, double t_min, double t_max, hit_record& rec ) const {
+    bool hit_anything = false;
+    for ( const auto& object : unbounded ) {
+        if ( object->hit(r, t_min, t_max, rec) ) {
+            hit_anything = true;
+            t_max = rec.t;
+        }
+    }
+    if ( nodes.empty() )
+        return hit_anything;
+
+    const point3 origin = r.origin();
+    const vec3 d = r.direction();
+    const vec3 inv_dir( 1/d.x(), 1/d.y(), 1/d.z() );
+
+    // Walk the tree with our own stack instead of recursion. Of two children
+    //      the nearer one is visited first, so that closer hits shrink t_max
+    //      and let us skip more of the farther one.
+    uint32_t stack[64];
+    int top = 0;
+    double t_enter;
+    if ( !nodes[0].box.hit(origin, inv_dir, t_min, t_max, t_enter) )
+        return hit_anything;
+    stack[top++] = 0;
+
+    while ( top > 0 ) {
+        const node& n = nodes[ stack[--top] ];
+        if ( n.count > 0 ) {
+            for ( uint32_t k = n.first; k < n.first + n.count; ++k ) {
+                const primitive& p = prims[k];
+                if ( objects[p.object]->hit_part(p.part, r, t_min, t_max, rec) ) {
+                    hit_anything = true;
+                    t_max = rec.t;
+                }
+            }
+            continue;
+        }
+
+        double t_left, t_right;
+        bool hit_left = nodes[n.first].box.hit( origin, inv_dir, t_min, t_max, t_left );
+        bool hit_right = nodes[n.first + 1].box.hit( origin, inv_dir, t_min, t_max, t_right );
+        if ( hit_left && hit_right ) {
+            // Push the far one first so the near one comes off the stack first.
+            bool left_first = t_left <= t_right;
+            stack[top++] = left_first ? n.first + 1 : n.first;
+            stack[top++] = left_first ? n.first : n.first + 1;
+        } else if ( hit_left ) {
+            stack[top++] = n.first;
+        } else if ( hit_right ) {
+            stack[top++] = n.first + 1;
+        }
+    }
+    return hit_anything;
+}
+
+bool bvh::bounding_box( double time0, double time1, aabb& output_box ) const {
+    if ( nodes.empty() || !unbounded.empty() )
+        return false;
+    output_box = nodes[0].box;
+    return true;
+}
+
+size_t bvh::largest_leaf() const {
+    size_t largest = 0;
+    for ( const auto& n : nodes )
+        largest = std::max<size_t>( largest, n.count );
+    return largest;
+}
+
+double bvh::sah_cost() const {
+    if ( nodes.empty() )
+        return 0;
+    double root = nodes[0].box.half_area();
+    double cost = 0;
+    for ( const auto& n : nodes ) {
+        double p = root > 0 ? n.box.half_area() / root : 1;
+        cost += p * (n.count > 0 ? n.count : 1);
+    }
+    return cost;
+}
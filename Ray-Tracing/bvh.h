@@ -0,0 +1,116 @@
+// bvh.h
+// A bounding volume hierarchy (BVH): a tree of boxes. The root box holds
+//      everything, its two children each hold about half of it, and so on
+//      down to leaves holding a handful of primitives. A ray that misses a
+//      box skips everything inside it, so instead of testing every sphere,
+//      a ray only tests the few in the boxes it actually passes through.
+//
+// There are two ways to build the tree:
+//      sah  - "surface area heuristic". At every node we try 16 evenly
+//             spaced places to split the primitives ("bins") and keep the one
+//             where (area of each side) x (primitives on that side) adds up
+//             smallest, since a ray is about as likely to hit a box as its
+//             area is large. Gives fast trees; slower to build.
+//      lbvh - "linear BVH". Every primitive gets a 30 bit Morton code that
+//             interleaves the bits of its x, y, and z, so sorting by the code
+//             puts nearby primitives next to each other. The tree then just
+//             splits wherever the highest bit of the code changes. Very fast
+//             to build, but the trees are a bit slower to trace.
+// Both split their work between threads: once a node is split, the two
+//      halves don't share anything, so big ones are built as separate tasks.
+//
+// The tree is stored in one array. A node's two children always sit next to
+//      each other, so a node only needs to remember where its first child is.
+
+# ifndef BVH_H
+# define BVH_H
+
+# include "rtweekend.h"
+
+# include "aabb.h"
+# include "hittable.h"
+# include "hittable_list.h"
+# include "parallel.h"
+
+# include <algorithm>
+# include <atomic>
+# include <future>
+# include <vector>
+
+enum class bvh_builder { sah, lbvh };
+
+class bvh : public hittable {
+    public:
+        // Builds a tree over every part of every object in the list (see
+        //      hittable::parts). Objects without a bounding box can't go in a
+        //      tree, so they're kept aside and tested on every ray.
+        bvh( const hittable_list& list, bvh_builder builder = bvh_builder::sah, int threads = 0 );
+
+        // No leaf holds more than this. Both builders split anything over
+        //      max_leaf, except that SAH keeps up to this many together when
+        //      testing them all is cheaper than another split.
+        static const int leaf_limit = 16;
+
+        virtual bool hit( const ray& r, double t_min, double t_max, hit_record& rec ) const override;
+        virtual bool bounding_box( double time0, double time1, aabb& output_box ) const override;
+
+        size_t node_count() const { return node_total; }
+        size_t memory_bytes() const {
+            return nodes.capacity() * sizeof(node) + prims.capacity() * sizeof(primitive);
+        }
+
+        // The tree's expected cost per ray, in units of one primitive test:
+        //      every node is paid for as often as a ray would hit its box.
+        double sah_cost() const;
+
+        // The most primitives in any one leaf (at most leaf_limit).
+        size_t largest_leaf() const;
+
+    private:
+        struct node {
+            aabb box;
+            uint32_t first;   // leaf: first primitive; inside: first child
+            uint32_t count;   // leaf: how many primitives; inside: 0
+        };
+
+        struct primitive {
+            uint32_t object;  // which object in "objects"
+            uint32_t part;    // which part of that object
+        };
+
+        // What the builders work on: one entry per primitive.
+        struct build_ref {
+            aabb box;
+            point3 centroid;
+            primitive prim;
+            uint32_t code;    // Morton code, for lbvh
+        };
+
+        uint32_t allocate_pair() { return node_total.fetch_add( 2 ); }
+        bool spawn( size_t count, int depth ) const {
+            return count > 50000 && depth < spawn_depth;
+        }
+
+        void build_sah( uint32_t index, build_ref* refs, size_t begin, size_t end, int depth );
+        // Makes "index" a node over [begin,mid) and [mid,end), and builds both.
+        void build_sah_children( uint32_t index, build_ref* refs, size_t begin, size_t mid, size_t end,
+                                 const aabb& box, int depth );
+        aabb build_lbvh( uint32_t index, build_ref* refs, size_t begin, size_t end, int depth );
+        void make_leaf( uint32_t index, const build_ref* refs, size_t begin, size_t end, const aabb& box );
+        static void radix_sort( std::vector<build_ref>& refs );
+
+    private:
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<shared_ptr<hittable>> unbounded;
+        std::vector<primitive> prims;
+        std::vector<node> nodes;
+        std::atomic<uint32_t> node_total{ 0 };
+        int spawn_depth = 0;
+
+        static const int max_leaf = 4;
+        static const int max_depth = 60;
+        static const int bins = 16;
+};
+
+
+# endif
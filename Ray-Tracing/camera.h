@@ -5,6 +5,57 @@
 
 #include "rtweekend.h"
 
+#include "cpu_dispatch.h"
+
+#include <vector>
+
+
+// A rectangle of pixels [x0,x1) x [y0,y1).
+struct tile {
+    int x0, y0, x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int size() const { return width() * height(); }
+};
+
+// Where camera::generate_rays puts its rays: one array per component
+//      ("structure of arrays") instead of an array of ray objects, so that
+//      a loop over many rays can work on several of them at once. "rng"
+//      holds each ray's random number generator state, so tracing the ray
+//      can pick up the sample's random sequence right where the camera
+//      left off.
+struct ray_span {
+    double *ox, *oy, *oz;
+    double *dx, *dy, *dz;
+    double *time;
+    uint64_t *rng;
+    size_t size;
+
+    ray get(size_t k) const {
+        return ray(point3(ox[k], oy[k], oz[k]), vec3(dx[k], dy[k], dz[k]), time[k]);
+    }
+};
+
+// Owns the arrays behind a ray_span.
+class ray_batch {
+    public:
+        void resize(size_t n) {
+            for (auto a : { &ox, &oy, &oz, &dx, &dy, &dz, &time })
+                a->resize(n);
+            rng.resize(n);
+        }
+
+        ray_span span() {
+            return ray_span{ ox.data(), oy.data(), oz.data(), dx.data(), dy.data(), dz.data(),
+                             time.data(), rng.data(), rng.size() };
+        }
+
+    private:
+        std::vector<double> ox, oy, oz, dx, dy, dz, time;
+        std::vector<uint64_t> rng;
+};
+
 
 class camera {
     public:
@@ -38,16 +89,90 @@ class camera {
             lens_radius = aperture / 2;
             time0 = _time0;
             time1 = _time1;
+
+            // These never change, so work them out once instead of once per ray.
+            to_corner = lower_left_corner - origin;
+            lens_u = lens_radius * u;
+            lens_v = lens_radius * v;
         }
 
+        // A pinhole camera (no aperture) doesn't need a random point on the
+        //      lens, and a camera with no shutter interval doesn't need a
+        //      random time, so neither one spends random numbers on them.
         ray get_ray(double s, double t) const {
-            vec3 rd = lens_radius * random_in_unit_disk();
-            vec3 offset = u * rd.x() + v * rd.y();
-            return ray(
-                origin + offset,
-                lower_left_corner + s*horizontal + t*vertical - origin - offset,
-                random_double(time0, time1)
-            );
+            vec3 offset(0,0,0);
+            if (lens_radius > 0) {
+                vec3 rd = random_in_unit_disk();
+                offset = lens_u * rd.x() + lens_v * rd.y();
+            }
+            double time = time1 > time0 ? random_double(time0, time1) : time0;
+            return ray(origin + offset, to_corner + s*horizontal + t*vertical - offset, time);
+        }
+
+        // About how wide a pixel of an image_height pixel tall picture is
+        //      in the middle of the picture, in radians. Times a distance,
+        //      it's how much of something that far away one pixel covers.
+        double pixel_angle(int image_height) const {
+            return vertical.length() / (to_corner + 0.5*horizontal + 0.5*vertical).length() / (image_height - 1);
+        }
+
+        // Fills "out" with one ray per pixel of "area" (row by row, bottom row
+        //      first) for sample number "sample" of an image_width x
+        //      image_height picture. Each pixel is seeded exactly like
+        //      render() seeds it, so a ray here is the same ray get_ray would
+        //      have given for that sample.
+        void generate_rays(const tile& area, int image_width, int image_height,
+                           uint64_t seed, int sample, ray_span out) const {
+            bool thin_lens = lens_radius > 0;
+            bool motion_blur = time1 > time0;
+            if (thin_lens && motion_blur)
+                generate_rays<true, true>(area, image_width, image_height, seed, sample, out);
+            else if (thin_lens)
+                generate_rays<true, false>(area, image_width, image_height, seed, sample, out);
+            else if (motion_blur)
+                generate_rays<false, true>(area, image_width, image_height, seed, sample, out);
+            else
+                generate_rays<false, false>(area, image_width, image_height, seed, sample, out);
+        }
+
+    private:
+        // The batch version is split in two loops. The first one does all the
+        //      random number generation, which has to go pixel by pixel. The
+        //      second one is plain arithmetic on arrays with no branches, which
+        //      the compiler can turn into vector instructions (it lives in
+        //      cpu_dispatch.cpp). Which kind of camera we are is decided once
+        //      per batch, by the template arguments, instead of once per ray.
+        template <bool thin_lens, bool motion_blur>
+        void generate_rays(const tile& area, int image_width, int image_height,
+                           uint64_t seed, int sample, ray_span out) const {
+            const size_t n = area.size();
+            const int w = area.width();
+
+            // Random numbers for each ray, parked in the output arrays we
+            //      haven't filled in yet.
+            double* jitter_x = out.dx;
+            double* jitter_y = out.dy;
+            double* lens_x = out.ox;
+            double* lens_y = out.oy;
+            for (size_t k = 0; k < n; ++k) {
+                int i = area.x0 + static_cast<int>(k) % w;
+                int j = area.y0 + static_cast<int>(k) / w;
+                seed_sample(seed, static_cast<uint64_t>(j) * image_width + i, sample);
+                jitter_x[k] = i + random_double();
+                jitter_y[k] = j + random_double();
+                if (thin_lens) {
+                    double u1 = random_double();
+                    double u2 = random_double();
+                    concentric_disk(u1, u2, lens_x[k], lens_y[k]);
+                }
+                out.time[k] = motion_blur ? random_double(time0, time1) : time0;
+                out.rng[k] = random_state();
+            }
+
+            // The arithmetic runs in whichever copy suits this CPU (see cpu_dispatch.h).
+            ray_frame frame{ origin, to_corner, horizontal, vertical, lens_u, lens_v,
+                             1.0 / (image_width - 1), 1.0 / (image_height - 1) };
+            kernels().camera_rays(frame, thin_lens, n, out.dx, out.dy, out.dz, out.ox, out.oy, out.oz);
         }
 
     private:
@@ -58,6 +183,25 @@ class camera {
         vec3 u, v, w;
         double lens_radius;
         double time0, time1;  // shutter open/close times
+
+        vec3 to_corner;       // lower_left_corner - origin
+        vec3 lens_u, lens_v;  // u and v scaled by the lens radius
+};
+
+// Everything needed to build a camera, kept so it can be rebuilt when
+//      something moves it (the preview server) or handed around by value.
+struct camera_settings {
+    point3 lookfrom;
+    point3 lookat;
+    vec3 vup;
+    double vfov;
+    double aspect_ratio;
+    double aperture;
+    double focus_dist;
+
+    camera make_camera() const {
+        return camera( lookfrom, lookat, vup, vfov, aspect_ratio, aperture, focus_dist );
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
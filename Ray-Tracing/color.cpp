@@ -0,0 +1,72 @@
+// color.cpp
+// Turning framebuffer colors into 8 bit pixels and writing them out.
+
+# include "color.h"
+
+# include "cpu_dispatch.h"
+
+using namespace std ;
+
+
+output_encoder::output_encoder( const output_settings& s ) : settings(s), lut(lut_size) {
+    for ( int k = 0; k < lut_size; ++k ) {
+        double x = static_cast<double>(k) / (lut_size - 1);
+        if ( settings.curve == transfer_curve::gamma2 ) {
+            // The book's version: gamma-correct for gamma=2.0 and scale by 256.
+            lut[k] = static_cast<unsigned char>( 256 * clamp(sqrt(x), 0.0, 0.999) );
+        } else {
+            double v = x <= 0.0031308 ? 12.92 * x : 1.055 * pow(x, 1/2.4) - 0.055;
+            lut[k] = static_cast<unsigned char>( 255 * v + 0.5 );
+        }
+    }
+}
+
+// One row of pixels, i in [x0,x1), through the kernel in cpu_dispatch.h.
+void output_encoder::encode_row( const framebuffer& fb, int x0, int x1, int j, unsigned char* rgb ) const {
+    static thread_local std::vector<color> sum;
+    static thread_local std::vector<uint32_t> samples;
+    size_t n = static_cast<size_t>( x1 - x0 );
+    sum.resize( n );
+    samples.resize( n );
+    for ( int i = x0; i < x1; ++i ) {
+        sum[i - x0] = fb.sum[ fb.index(i, j) ];
+        samples[i - x0] = fb.samples[ fb.index(i, j) ];
+    }
+    kernels().encode_pixels( sum.data(), samples.data(), n, settings.exposure, settings.tone,
+                             lut.data(), lut_size, rgb );
+}
+
+void output_encoder::encode_area( const framebuffer& fb, int x0, int y0, int x1, int y1,
+                                  unsigned char* rgb ) const {
+    for ( int j = y1 - 1; j >= y0; --j, rgb += 3 * (x1 - x0) )
+        encode_row( fb, x0, x1, j, rgb );
+}
+
+void output_encoder::encode_image( const framebuffer& fb, unsigned char* rgb, int threads ) const {
+    parallel_for( 0, fb.height, [&]( long long row ) {
+        int j = fb.height - 1 - static_cast<int>(row);
+        encode_row( fb, 0, fb.width, j, rgb + 3 * row * fb.width );
+    }, threads );
+}
+
+void write_ppm( ostream &out, const unsigned char* rgb, int width, int height, bool binary ) {
+    out << (binary ? "P6\n" : "P3\n") << width << ' ' << height << "\n255\n";
+    size_t n = static_cast<size_t>(width) * height;
+    if ( binary ) {
+        out.write( reinterpret_cast<const char*>(rgb), 3 * n );
+        return;
+    }
+
+    std::string text;
+    text.reserve( 12 * n );
+    for ( size_t p = 0; p < n; ++p ) {
+        for ( int k = 0; k < 3; ++k ) {
+            int v = rgb[3*p + k];
+            if ( v >= 100 ) text += static_cast<char>( '0' + v / 100 );
+            if ( v >= 10 )  text += static_cast<char>( '0' + v / 10 % 10 );
+            text += static_cast<char>( '0' + v % 10 );
+            text += k < 2 ? ' ' : '\n';
+        }
+    }
+    out.write( text.data(), text.size() );
+}
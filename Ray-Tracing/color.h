@@ -1,32 +1,94 @@
 // color.h
-// This file sends the calculated color to a specified output stream.
+// This file turns the linear colors we render into 8 bit pixels and sends
+//      them to an output stream.
+//
+// Getting from the framebuffer to a pixel takes three steps:
+//      1. Average the samples. This is still "linear" light, and can be
+//         brighter than 1.0.
+//      2. Tone map: squeeze values above 1.0 back down into [0,1]. "none"
+//         just clips them, "reinhard" is x/(1+x), and "aces" is Krzysztof
+//         Narkowicz's curve fitted to the ACES film look.
+//      3. Encode: apply the sRGB transfer curve (or the book's gamma 2.0)
+//         and round to [0,255]. Instead of calling pow() for every channel
+//         of every pixel, we precompute the answer for 16384 evenly spaced
+//         inputs once and look it up.
+// The whole image is converted on several threads at once.
 
 # ifndef COLOR_H
 # define COLOR_H
 
-# include "vec3.h"
+# include "rtweekend.h"
+
+# include "framebuffer.h"
+# include "parallel.h"
+
 # include <iostream>
+# include <string>
+# include <vector>
 
 using namespace std ;
 
-// Sends colors to the output stream after identifying the rgb values required at a 
-//      given location and gamma correcting. 
-void write_color( ostream &out, color pixel_color, int samples_per_pixel ) {
-    auto r = pixel_color.x() ;
-    auto g = pixel_color.y() ;
-    auto b = pixel_color.z() ;
+enum class tone_mapper { none, reinhard, aces };
+enum class transfer_curve { srgb, gamma2 };
+
+struct output_settings {
+    tone_mapper tone = tone_mapper::none;
+    transfer_curve curve = transfer_curve::srgb;
+    double exposure = 1.0;     // multiplies the linear color before tone mapping
+};
+
+class output_encoder {
+    public:
+        // Constructor- builds the lookup table for the chosen curve.
+        explicit output_encoder( const output_settings& s = output_settings() );
+
+        // Converts one linear color to 8 bit rgb values.
+        void encode( const color& linear, unsigned char rgb[3] ) const {
+            for ( int k = 0; k < 3; ++k )
+                rgb[k] = lut[ static_cast<int>( tone(linear[k]) * (lut_size - 1) + 0.5 ) ];
+        }
+
+        // Converts the whole framebuffer into rgb triples, top row first (the
+        //      order image files want), splitting the rows between threads.
+        void encode_image( const framebuffer& fb, unsigned char* rgb, int threads = 0 ) const;
+
+        // The same for just the block [x0,x1) x [y0,y1), on this thread.
+        void encode_area( const framebuffer& fb, int x0, int y0, int x1, int y1, unsigned char* rgb ) const;
+
+    private:
+        // encode() for pixels [x0,x1) of row j, using the fastest copy of the
+        //      loop this CPU can run (see cpu_dispatch.h).
+        void encode_row( const framebuffer& fb, int x0, int x1, int j, unsigned char* rgb ) const;
+
+        // Applies exposure and the tone mapper. Always returns a value in [0,1].
+        double tone( double x ) const {
+            x *= settings.exposure;
+            if ( !(x > 0) )     // also catches NaN
+                return 0;
+            switch ( settings.tone ) {
+                case tone_mapper::reinhard:
+                    x = x / (1 + x);
+                    break;
+                case tone_mapper::aces:
+                    x = (x*(2.51*x + 0.03)) / (x*(2.43*x + 0.59) + 0.14);
+                    break;
+                case tone_mapper::none:
+                    break;
+            }
+            return x < 1 ? x : 1;
+        }
+
+    private:
+        static const int lut_size = 16384;
+        output_settings settings;
+        std::vector<unsigned char> lut;
+};
 
-    // Divide the color by the number of samples and gamma-correct for gamma=2.0.
-    auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
 
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(256 * clamp(r, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(g, 0.0, 0.999)) << ' '
-        << static_cast<int>(256 * clamp(b, 0.0, 0.999)) << '\n';
-}
+// Writes rgb triples (top row first) as a .ppm. The plain "P3" format is
+//      text, so we format the numbers ourselves into one big buffer rather
+//      than pushing every number through the stream on its own.
+void write_ppm( ostream &out, const unsigned char* rgb, int width, int height, bool binary = false );
 
 
-# endif
\ No newline at end of file
+# endif
@@ -0,0 +1,39 @@
+// constant_medium.h
+// Fog or smoke of the same thickness everywhere, filling some shape (the
+//      "boundary"). A ray going through it can hit a particle anywhere
+//      along the way: the thicker the fog and the longer the way through,
+//      the likelier. Since the density never changes, where that happens can
+//      be picked exactly from an exponential distribution, with one random
+//      number and no stepping along the ray.
+//
+// The boundary has to be closed and convex (a sphere, a box), so a ray
+//      goes in at most once and comes out at most once.
+
+# ifndef CONSTANT_MEDIUM_H
+# define CONSTANT_MEDIUM_H
+
+# include "rtweekend.h"
+
+# include "hittable.h"
+# include "material.h"
+
+class constant_medium : public hittable {
+    public:
+        constant_medium( shared_ptr<hittable> b, double density, const color& albedo )
+            : boundary(b), neg_inv_density(-1/density), phase_function(isotropic(albedo))
+        {}
+
+        virtual bool hit( const ray& r, double t_min, double t_max, hit_record& rec ) const override;
+
+        virtual bool bounding_box( double time0, double time1, aabb& output_box ) const override {
+            return boundary->bounding_box( time0, time1, output_box );
+        }
+
+    public:
+        shared_ptr<hittable> boundary;
+        double neg_inv_density;
+        material phase_function;
+};
+
+
+# endif
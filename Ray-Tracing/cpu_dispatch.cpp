@@ -0,0 +1,228 @@
+// cpu_dispatch.cpp
+// The kernels, compiled once per instruction set, and picking which ones
+//      run (see cpu_dispatch.h).
+//
+// Each kernel is written once, as an always_inline function. A thin wrapper
+//      per instruction set, marked with GCC's target attribute, inlines it,
+//      so the same loop comes out as SSE2, SSE4.2, AVX2 or AVX-512 code.
+
+# include "cpu_dispatch.h"
+
+using namespace std ;
+
+
+// Testing a ray against spheres. Most spheres miss, so the part that
+//      tells a miss from a hit- the discriminant- goes into a small array
+//      first, in a loop with no branches that the compiler can vectorize; a
+//      second pass works out roots only for the spheres the ray does meet,
+//      and keeps the nearest. Ties go to the later sphere, as they do one at
+//      a time (hit_sphere accepts a root equal to t_max).
+static inline __attribute__((always_inline))
+long long closest_sphere_body( const double* cx, const double* cy, const double* cz, const double* radius,
+                               size_t n, const ray& r, double t_min, double t_max ) {
+    const int block = 64;
+    const double ox = r.origin().x(), oy = r.origin().y(), oz = r.origin().z();
+    const double dx = r.direction().x(), dy = r.direction().y(), dz = r.direction().z();
+    const double a = dx*dx + dy*dy + dz*dz;
+
+    long long best = -1;
+    double half_b[block], discriminant[block];
+    for ( size_t start = 0; start < n; start += block ) {
+        size_t m = min<size_t>( block, n - start );
+        for ( size_t k = 0; k < m; ++k ) {
+            size_t i = start + k;
+            double ocx = ox - cx[i], ocy = oy - cy[i], ocz = oz - cz[i];
+            half_b[k] = ocx*dx + ocy*dy + ocz*dz;
+            double c = (ocx*ocx + ocy*ocy + ocz*ocz) - radius[i]*radius[i];
+            discriminant[k] = half_b[k]*half_b[k] - a*c;
+        }
+        for ( size_t k = 0; k < m; ++k ) {
+            if ( discriminant[k] < 0 )
+                continue;
+            double sqrtd = sqrt( discriminant[k] );
+            double root = (-half_b[k] - sqrtd) / a;
+            if ( root < t_min || t_max < root ) {
+                root = (-half_b[k] + sqrtd) / a;
+                if ( root < t_min || t_max < root )
+                    continue;
+            }
+            t_max = root;
+            best = static_cast<long long>( start + k );
+        }
+    }
+    return best;
+}
+
+// The second loop of camera::generate_rays: plain arithmetic on arrays. The
+//      arrays are read and written in place, but never overlap each other.
+template <bool thin_lens>
+static inline __attribute__((always_inline))
+void camera_rays_body( const ray_frame& f, size_t n, double* __restrict dx, double* __restrict dy,
+                       double* __restrict dz, double* __restrict ox, double* __restrict oy,
+                       double* __restrict oz ) {
+    const double cx = f.to_corner[0], cy = f.to_corner[1], cz = f.to_corner[2];
+    const double hx = f.horizontal[0], hy = f.horizontal[1], hz = f.horizontal[2];
+    const double vx = f.vertical[0], vy = f.vertical[1], vz = f.vertical[2];
+    const double ux = f.lens_u[0], uy = f.lens_u[1], uz = f.lens_u[2];
+    const double wx = f.lens_v[0], wy = f.lens_v[1], wz = f.lens_v[2];
+    const double px = f.origin[0], py = f.origin[1], pz = f.origin[2];
+    for ( size_t k = 0; k < n; ++k ) {
+        double s = dx[k] * f.su;
+        double t = dy[k] * f.sv;
+        double off_x = 0, off_y = 0, off_z = 0;
+        if ( thin_lens ) {
+            double lx = ox[k], ly = oy[k];
+            off_x = ux * lx + wx * ly;
+            off_y = uy * lx + wy * ly;
+            off_z = uz * lx + wz * ly;
+        }
+        dx[k] = cx + s*hx + t*vx - off_x;
+        dy[k] = cy + s*hy + t*vy - off_y;
+        dz[k] = cz + s*hz + t*vz - off_z;
+        ox[k] = px + off_x;
+        oy[k] = py + off_y;
+        oz[k] = pz + off_z;
+    }
+}
+
+// output_encoder::encode for n pixels: the tone mapping goes into a block
+//      of lookup table indices, then the bytes are looked up.
+template <tone_mapper tone>
+static inline __attribute__((always_inline))
+void encode_pixels_body( const color* sum, const uint32_t* samples, size_t n, double exposure,
+                         const unsigned char* lut, int lut_size, unsigned char* rgb ) {
+    const int block = 64;
+    int index[3 * block];
+    for ( size_t start = 0; start < n; start += block ) {
+        size_t m = min<size_t>( block, n - start );
+        for ( size_t k = 0; k < m; ++k ) {
+            uint32_t count = samples[start + k];
+            double scale = 1 / static_cast<double>( count );
+            for ( int c = 0; c < 3; ++c ) {
+                double x = count == 0 ? 0.0 : scale * sum[start + k][c];
+                x *= exposure;
+                double y = x;
+                if ( tone == tone_mapper::reinhard )
+                    y = x / (1 + x);
+                else if ( tone == tone_mapper::aces )
+                    y = (x*(2.51*x + 0.03)) / (x*(2.43*x + 0.59) + 0.14);
+                // As in output_encoder::tone: 0 for anything not above 0 (or
+                //      NaN), which is mapped anyway and thrown away here.
+                y = x > 0 ? y : 0;
+                y = y < 1 ? y : 1;
+                index[3*k + c] = static_cast<int>( y * (lut_size - 1) + 0.5 );
+            }
+        }
+        for ( size_t k = 0; k < 3*m; ++k )
+            rgb[3*start + k] = lut[ index[k] ];
+    }
+}
+
+
+// One wrapper of each kernel per instruction set, and its table.
+# define RT_KERNELS( name, attributes )                                                                     \
+    attributes static long long closest_sphere_##name( const double* cx, const double* cy, const double* cz,  \
+                                                      const double* radius, size_t n, const ray& r,           \
+                                                      double t_min, double t_max ) {                          \
+        return closest_sphere_body( cx, cy, cz, radius, n, r, t_min, t_max );                                \
+    }                                                                                                         \
+    attributes static void camera_rays_##name( const ray_frame& f, bool thin_lens, size_t n, double* dx,     \
+                                              double* dy, double* dz, double* ox, double* oy, double* oz ) {  \
+        if ( thin_lens )                                                                                      \
+            camera_rays_body<true>( f, n, dx, dy, dz, ox, oy, oz );                                           \
+        else                                                                                                  \
+            camera_rays_body<false>( f, n, dx, dy, dz, ox, oy, oz );                                          \
+    }                                                                                                         \
+    attributes static void encode_pixels_##name( const color* sum, const uint32_t* samples, size_t n,        \
+                                                double exposure, tone_mapper tone, const unsigned char* lut, \
+                                                int lut_size, unsigned char* rgb ) {                          \
+        switch ( tone ) {                                                                                     \
+            case tone_mapper::none:                                                                           \
+                encode_pixels_body<tone_mapper::none>( sum, samples, n, exposure, lut, lut_size, rgb );       \
+                break;                                                                                        \
+            case tone_mapper::reinhard:                                                                       \
+                encode_pixels_body<tone_mapper::reinhard>( sum, samples, n, exposure, lut, lut_size, rgb );   \
+                break;                                                                                        \
+            case tone_mapper::aces:                                                                           \
+                encode_pixels_body<tone_mapper::aces>( sum, samples, n, exposure, lut, lut_size, rgb );       \
+                break;                                                                                        \
+        }                                                                                                     \
+    }                                                                                                         \
+    static const cpu_kernels name##_kernels = { closest_sphere_##name, camera_rays_##name, encode_pixels_##name };
+
+RT_KERNELS( generic, )
+
+# if defined(__x86_64__) || defined(__i386__)
+RT_KERNELS( sse4, __attribute__((target("sse4.2"))) )
+RT_KERNELS( avx2, __attribute__((target("avx2"))) )
+RT_KERNELS( avx512, __attribute__((target("avx512f"))) )
+# endif
+
+
+static const cpu_kernels& table( cpu_isa isa ) {
+# if defined(__x86_64__) || defined(__i386__)
+    switch ( isa ) {
+        case cpu_isa::sse4:   return sse4_kernels;
+        case cpu_isa::avx2:   return avx2_kernels;
+        case cpu_isa::avx512: return avx512_kernels;
+        case cpu_isa::generic: break;
+    }
+# endif
+    return generic_kernels;
+}
+
+cpu_isa best_isa() {
+# if defined(__x86_64__) || defined(__i386__)
+    // GCC's checks also make sure the operating system saves the wider
+    //      registers, without which the CPU's support is no use.
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx512f") )
+        return cpu_isa::avx512;
+    if ( __builtin_cpu_supports("avx2") )
+        return cpu_isa::avx2;
+    if ( __builtin_cpu_supports("sse4.2") )
+        return cpu_isa::sse4;
+# endif
+    return cpu_isa::generic;
+}
+
+// The kernels in use, and which instruction set they're for.
+static std::pair<cpu_isa, const cpu_kernels*>& active() {
+    static std::pair<cpu_isa, const cpu_kernels*> current( best_isa(), &table(best_isa()) );
+    return current;
+}
+
+cpu_isa current_isa() {
+    return active().first;
+}
+
+bool use_isa( cpu_isa isa ) {
+    if ( isa > best_isa() )
+        return false;
+    active() = { isa, &table(isa) };
+    return true;
+}
+
+const cpu_kernels& kernels() {
+    return *active().second;
+}
+
+const char* isa_name( cpu_isa isa ) {
+    switch ( isa ) {
+        case cpu_isa::sse4:   return "sse4";
+        case cpu_isa::avx2:   return "avx2";
+        case cpu_isa::avx512: return "avx512";
+        case cpu_isa::generic: break;
+    }
+    return "generic";
+}
+
+bool parse_isa( const std::string& name, cpu_isa& isa ) {
+    for ( cpu_isa k : { cpu_isa::generic, cpu_isa::sse4, cpu_isa::avx2, cpu_isa::avx512 } ) {
+        if ( name == isa_name(k) ) {
+            isa = k;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,76 @@
+// cpu_dispatch.h
+// One binary for every kind of x86 machine. The loops that work on many
+//      values at once- testing a ray against a whole array of spheres,
+//      turning camera jitter into rays, and turning framebuffer sums into
+//      8 bit pixels- are compiled several times over, once for each
+//      instruction set (plain x86-64, SSE4.2, AVX2 and AVX-512), so the
+//      compiler can use wider vector registers in each copy. At startup we
+//      ask the CPU (cpuid) what it can do and use the best copy it runs.
+//
+// This only matters for a build that isn't tuned for one machine (the
+//      makefile's, or CMake's with -DRT_NATIVE=OFF): -march=native already
+//      makes every copy as wide as the build machine allows.
+//
+// Every copy does exactly the same arithmetic in the same order (and we
+//      never let the compiler fuse a*b+c into one instruction), so pictures
+//      come out bit for bit the same whichever one runs. use_isa() picks a
+//      copy by hand, to test or benchmark each one on a single machine.
+
+# ifndef CPU_DISPATCH_H
+# define CPU_DISPATCH_H
+
+# include "rtweekend.h"
+
+# include "color.h"
+
+# include <string>
+
+enum class cpu_isa { generic, sse4, avx2, avx512 };
+
+// The best instruction set this CPU (and operating system) supports.
+cpu_isa best_isa();
+
+// The one the kernels use: best_isa() unless use_isa() said otherwise.
+cpu_isa current_isa();
+
+// Switches the kernels to "isa". False (and nothing changes) if the CPU
+//      can't run it. Call it before rendering starts.
+bool use_isa( cpu_isa isa );
+
+const char* isa_name( cpu_isa isa );
+bool parse_isa( const std::string& name, cpu_isa& isa );
+
+
+// Everything generate_rays needs to turn pixel positions into rays.
+struct ray_frame {
+    point3 origin;
+    vec3 to_corner;             // lower left corner - origin
+    vec3 horizontal, vertical;
+    vec3 lens_u, lens_v;        // the camera's u and v, scaled by the lens radius
+    double su, sv;              // 1/(width-1), 1/(height-1)
+};
+
+// The kernels, as one table per instruction set.
+struct cpu_kernels {
+    // The sphere (of n, stored as arrays) whose nearest root in [t_min,
+    //      t_max] is closest, exactly as testing them one at a time with
+    //      hit_sphere() and shrinking t_max would find it; -1 if none.
+    long long (*closest_sphere)( const double* cx, const double* cy, const double* cz, const double* radius,
+                                 size_t n, const ray& r, double t_min, double t_max );
+
+    // On the way in, dx and dy hold each ray's pixel position (with its
+    //      jitter) and, for a thin lens, ox and oy its point on the unit
+    //      disk. On the way out, all six hold the rays.
+    void (*camera_rays)( const ray_frame& frame, bool thin_lens, size_t n,
+                         double* dx, double* dy, double* dz, double* ox, double* oy, double* oz );
+
+    // Averages n pixels' sums, applies exposure and a tone mapper, and looks
+    //      each channel up in "lut" (see output_encoder).
+    void (*encode_pixels)( const color* sum, const uint32_t* samples, size_t n, double exposure, tone_mapper tone,
+                           const unsigned char* lut, int lut_size, unsigned char* rgb );
+};
+
+const cpu_kernels& kernels();
+
+
+# endif
@@ -0,0 +1,89 @@
+// distributed.cpp
+// Splitting a frame between worker processes and merging what they render (see distributed.h).
+
+# include "distributed.h"
+
+using namespace std ;
+
+
+std::vector<render_region> assigned_regions( const work_assignment& work,
+                                             int width, int height, int samples_per_pixel ) {
+    std::vector<render_region> regions;
+
+    if ( work.split == split_mode::samples ) {
+        int s0 = static_cast<int>( static_cast<long long>(samples_per_pixel) * work.index / work.count );
+        int s1 = static_cast<int>( static_cast<long long>(samples_per_pixel) * (work.index + 1) / work.count );
+        if ( s0 < s1 )
+            regions.push_back( render_region{ 0, 0, width, height, s0, s1 } );
+        return regions;
+    }
+
+    int strip = 0;
+    for ( int y = 0; y < height; y += tile_rows, ++strip ) {
+        if ( strip % work.count == work.index )
+            regions.push_back( render_region{ 0, y, width, min(y + tile_rows, height), 0, samples_per_pixel } );
+    }
+    return regions;
+}
+
+bool run_coordinator( const std::string& exe, const std::vector<std::string>& args,
+                      int workers, split_mode split, framebuffer& result ) {
+    char dir_template[] = "/tmp/raytracer-XXXXXX";
+    if ( mkdtemp(dir_template) == nullptr ) {
+        cerr << "Couldn't create a directory for worker output\n";
+        return false;
+    }
+    std::string dir = dir_template;
+
+    std::vector<pid_t> pids;
+    std::vector<std::string> paths;
+    for ( int k = 0; k < workers; ++k ) {
+        std::string path = dir + "/worker" + to_string(k) + ".acc";
+        std::vector<std::string> worker_args = args;
+        worker_args.insert( worker_args.end(), {
+            "--worker", to_string(k), "--of", to_string(workers),
+            "--split", split == split_mode::tiles ? "tiles" : "samples",
+            "--accum", path
+        } );
+
+        pid_t pid = fork();
+        if ( pid == 0 ) {
+            std::vector<char*> argv;
+            argv.push_back( const_cast<char*>(exe.c_str()) );
+            for ( auto& a : worker_args )
+                argv.push_back( const_cast<char*>(a.c_str()) );
+            argv.push_back( nullptr );
+            execv( exe.c_str(), argv.data() );
+            _exit( 127 );
+        }
+        if ( pid < 0 ) {
+            cerr << "Couldn't start worker " << k << '\n';
+            break;
+        }
+        pids.push_back( pid );
+        paths.push_back( path );
+    }
+
+    // Wait for every worker we started, even if one of them already failed.
+    bool ok = static_cast<int>(pids.size()) == workers;
+    for ( size_t k = 0; k < pids.size(); ++k ) {
+        int status = 0;
+        waitpid( pids[k], &status, 0 );
+        if ( !WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+            cerr << "Worker " << k << " failed\n";
+            ok = false;
+        }
+    }
+
+    for ( auto& path : paths ) {
+        framebuffer part;
+        if ( ok && !(part.load(path) && result.merge(part)) ) {
+            cerr << "Couldn't merge " << path << '\n';
+            ok = false;
+        }
+        unlink( path.c_str() );
+    }
+    rmdir( dir.c_str() );
+
+    return ok;
+}
@@ -0,0 +1,50 @@
+// distributed.h
+// One process isn't always enough for a big frame, so this file lets a
+//      "coordinator" split the frame between several "worker" processes.
+//      Each worker renders its share of the same scene into its own
+//      framebuffer and saves it to a file. The coordinator waits for all of
+//      them, loads their files, and merges them into the final picture.
+//
+// A frame can be split two ways:
+//      tiles   - each worker takes every Nth strip of rows, with all samples.
+//      samples - each worker takes the whole picture, with a slice of the samples.
+// Either way the merged image is identical to a single-process render with
+//      the same seed, since every sample is seeded by its pixel and number.
+
+# ifndef DISTRIBUTED_H
+# define DISTRIBUTED_H
+
+# include "framebuffer.h"
+# include "render.h"
+
+# include <iostream>
+# include <string>
+# include <vector>
+
+# include <sys/wait.h>
+# include <unistd.h>
+
+enum class split_mode { tiles, samples };
+
+// Height of one strip of rows when splitting by tiles.
+const int tile_rows = 16;
+
+// Which share of the frame a worker owns: worker "index" out of "count".
+struct work_assignment {
+    int index;
+    int count;
+    split_mode split;
+};
+
+// Lists the regions of the image a worker is responsible for.
+std::vector<render_region> assigned_regions( const work_assignment& work,
+                                             int width, int height, int samples_per_pixel );
+
+// Starts "workers" copies of the program at "exe" with "args" plus the worker
+//      flags, waits for them, and merges what they rendered into "result".
+//      Returns false if any worker failed or its output couldn't be read.
+bool run_coordinator( const std::string& exe, const std::vector<std::string>& args,
+                      int workers, split_mode split, framebuffer& result );
+
+
+# endif
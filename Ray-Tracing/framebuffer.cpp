@@ -0,0 +1,38 @@
+// framebuffer.cpp
+// Saving and loading framebuffers, so that separate processes can add theirs up.
+
+# include "framebuffer.h"
+
+using namespace std ;
+
+
+bool framebuffer::save( const std::string& path ) const {
+    std::ofstream out( path, std::ios::binary );
+    if ( !out )
+        return false;
+
+    int32_t dims[2] = { width, height };
+    out.write( magic, strlen(magic) );
+    out.write( reinterpret_cast<const char*>(dims), sizeof(dims) );
+    out.write( reinterpret_cast<const char*>(sum.data()), sum.size() * sizeof(color) );
+    out.write( reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(uint32_t) );
+    return static_cast<bool>(out);
+}
+
+bool framebuffer::load( const std::string& path ) {
+    std::ifstream in( path, std::ios::binary );
+    if ( !in )
+        return false;
+
+    char header[8] = {};
+    int32_t dims[2];
+    in.read( header, strlen(magic) );
+    in.read( reinterpret_cast<char*>(dims), sizeof(dims) );
+    if ( !in || strcmp(header, magic) != 0 || dims[0] < 0 || dims[1] < 0 )
+        return false;
+
+    *this = framebuffer( dims[0], dims[1] );
+    in.read( reinterpret_cast<char*>(sum.data()), sum.size() * sizeof(color) );
+    in.read( reinterpret_cast<char*>(samples.data()), samples.size() * sizeof(uint32_t) );
+    return static_cast<bool>(in);
+}
@@ -0,0 +1,112 @@
+// framebuffer.h
+// A framebuffer holds the image while it's being rendered. Instead of turning
+//      every pixel into text the moment it's finished, we keep a running sum
+//      of all the samples that landed in a pixel along with how many there
+//      were. Two framebuffers of the same scene can then be added together
+//      (say, from two different processes) and the average still comes out
+//      right, because each pixel is divided by its own sample count at the end.
+//
+// The pixels aren't stored row by row. The picture is cut into 16x16 tiles,
+//      each tile's pixels sit together in one block of memory, and inside a
+//      block they're in Morton ("Z") order- the bits of x and y interleaved-
+//      so pixels that are close on screen are close in memory too. A render
+//      thread working on one tile writes one contiguous block, and since a
+//      block's size is a multiple of a cache line, it never shares a cache
+//      line with a tile another thread is writing.
+
+# ifndef FRAMEBUFFER_H
+# define FRAMEBUFFER_H
+
+# include "rtweekend.h"
+
+# include "parallel.h"
+
+# include <cstring>
+# include <fstream>
+# include <string>
+# include <vector>
+
+class framebuffer {
+    public:
+        // Constructor
+        framebuffer() : width(0), height(0), origin_x(0), origin_y(0), tiles_x(0), tiles_y(0) {}
+        framebuffer( int w, int h ) : framebuffer( w, h, 0, 0, w, h ) {}
+
+        // A framebuffer for just the block [x0,x1) x [y0,y1) of a w x h
+        //      picture, for when the whole picture won't fit in memory.
+        //      Pixels are still addressed by their place in the whole
+        //      picture, so render() can't tell the difference.
+        framebuffer( int w, int h, int x0, int y0, int x1, int y1 )
+            : width(w), height(h), origin_x(x0), origin_y(y0),
+              tiles_x( (x1 - x0 + tile_size - 1) / tile_size ),
+              tiles_y( (y1 - y0 + tile_size - 1) / tile_size ),
+              sum( tile_count() * tile_pixels ), samples( tile_count() * tile_pixels, 0 )
+        {}
+
+        // Tiles are numbered row by row, starting from the bottom (j = 0),
+        //      and the edge tiles are padded out to the full 16x16.
+        static const int tile_size = 16;
+        static const int tile_pixels = tile_size * tile_size;
+        int tile_count() const { return tiles_x * tiles_y; }
+
+        // Where pixel (i, j) is stored: its tile's block, then its place in the Z curve.
+        int index( int i, int j ) const {
+            i -= origin_x;
+            j -= origin_y;
+            int tile = (j / tile_size) * tiles_x + i / tile_size;
+            return tile * tile_pixels + morton( i % tile_size, j % tile_size );
+        }
+
+        // Adds one sample's color to a pixel
+        void add_sample( int i, int j, const color& c ) {
+            sum[index(i, j)] += c;
+            samples[index(i, j)] += 1;
+        }
+
+        // Adds another framebuffer of the same size into this one. Pixels
+        //      that weren't rendered over there have zero samples, so they
+        //      don't change anything over here.
+        bool merge( const framebuffer& other ) {
+            if ( other.width != width || other.height != height || other.origin_x != origin_x
+                 || other.origin_y != origin_y || other.sum.size() != sum.size() )
+                return false;
+            for ( size_t k = 0; k < sum.size(); ++k ) {
+                sum[k] += other.sum[k];
+                samples[k] += other.samples[k];
+            }
+            return true;
+        }
+
+        // The average color of a pixel, or black if nothing has landed there.
+        color average( int i, int j ) const {
+            auto n = samples[index(i, j)];
+            return n == 0 ? color(0,0,0) : sum[index(i, j)] / n;
+        }
+
+        // Saves and loads the raw sums and counts so another process can pick them up.
+        bool save( const std::string& path ) const;
+        bool load( const std::string& path );
+
+    public:
+        int width;
+        int height;
+        int origin_x;
+        int origin_y;
+        int tiles_x;
+        int tiles_y;
+        std::vector<color, cache_aligned_allocator<color>> sum;
+        std::vector<uint32_t, cache_aligned_allocator<uint32_t>> samples;
+
+    private:
+        // Interleaves the 4 bits of x and y: y3 x3 y2 x2 y1 x1 y0 x0.
+        static int morton( int x, int y ) {
+            auto spread = []( int v ) { return (v & 1) | (v & 2) << 1 | (v & 4) << 2 | (v & 8) << 3; };
+            return spread( x ) | spread( y ) << 1;
+        }
+
+        // (Bumped from RTACC1 when the pixels went from rows to tiles.)
+        static constexpr const char* magic = "RTACC2\n";
+};
+
+
+# endif
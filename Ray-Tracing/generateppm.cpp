@@ -2,149 +2,541 @@
 # include "rtweekend.h"
 
 # include "color.h"
+# include "cpu_dispatch.h"
 # include "sphere.h"
 # include "camera.h"
 # include "material.h"
 # include "hittable_list.h"
+# include "framebuffer.h"
+# include "golden.h"
+# include "irradiance_cache.h"
+# include "mapped_ppm.h"
+# include "render.h"
+# include "distributed.h"
+# include "preview.h"
+# include "render_engine.h"
+# include "scenes.h"
+# include "wavefront.h"
 
+# include <chrono>
+# include <cstring>
+# include <ctime>
 # include <fstream>
 # include <iostream>
+# include <string>
+# include <vector>
 
 using namespace std ;
 
-// Calculates the color of a given ray based on the originally defined color, 
-//      whether the object was hit, and where it is along the ray. 
-color ray_color( const ray& r, const hittable& world, int depth ) {
-    hit_record rec;
+// Command line options. With no options we render the whole picture in this
+//      process with a new seed every run, just like before.
+//      --seed N         use a fixed seed, so the same picture comes out every time
+//      --width N        image width in pixels (the height follows from 16:9)
+//      --spp N          samples per pixel
+//      --budget S       render for S seconds of wall-clock time instead of --spp,
+//                       giving the noisier tiles more samples; the picture is
+//                       whatever is done at the deadline (see render_engine.h)
+//      --workers N      split the frame between N worker processes and merge them
+//      --split MODE     how to split it: "tiles" (default) or "samples"
+//      --worker K --of N --accum FILE
+//                       render worker K's share of N and save it to FILE
+//                       (the coordinator passes these to the workers it starts)
+//      --serve PORT     keep rendering progressively and serve the picture on
+//                       http://127.0.0.1:PORT/ (see preview.h), with the recursive
+//                       integrator; --guide and --pin apply
+//      --threads N      render threads (default: one per core)
+//      --pin P          pin render threads to cores: "none" (default), "compact"
+//                       (fill one socket first) or "spread" (round robin over sockets)
+//      --isa I          which copy of the vectorized loops to run: "auto" (default,
+//                       the best this CPU can), "generic", "sse4", "avx2" or "avx512"
+//                       (see cpu_dispatch.h). The picture is the same with any of them.
+//      --integrator I   "recursive" (default) follows one ray at a time,
+//                       "wavefront" runs one bounce for many rays at a time,
+//                       "irradiance" is a quick, slightly blurry preview that
+//                       blends cached irradiance (see irradiance_cache.h)
+//      --irradiance-error A
+//                       how far irradiance records reach (default 0.3; smaller is
+//                       slower and more accurate)
+//      --irradiance-rays N
+//                       paths per irradiance record (default 256)
+//      --sort S         how wavefront groups its hits before shading: "none",
+//                       "material" (default) or "octant" (material, then direction)
+//      --queue N        paths wavefront traces together (default 4096)
+//      --tonemap T      "none" (default), "reinhard" or "aces"
+//      --curve C        output encoding: "srgb" (default) or "gamma2" (the book's)
+//      --exposure E     multiplies the linear colors before tone mapping
+//      --scene S        "spheres" (default, the book's) or "room" (a room lit
+//                       through a hole in the ceiling; the sphere options don't apply)
+//      --grid N         small spheres cover -N..N in x and z (default 11)
+//      --density D      small spheres per unit of floor area (default 1)
+//      --mix D,M        fraction of diffuse and metal spheres (default 0.8,0.15)
+//      --accel A        "sah" (default) or "lbvh" builds a BVH over the world, "none" doesn't
+//      --stream FILE    write the picture straight into FILE (binary .ppm) tile by
+//                       tile, without ever holding all of it, for huge pictures
+//      --golden FILE    compare the picture, and how fast it rendered, with the
+//                       golden ones in FILE and FILE.perf, and exit with an error
+//                       if they've drifted (see golden.h); records them if FILE
+//                       doesn't exist yet. Use with a fixed --seed.
+//      --tolerance T    largest allowed rms difference from the golden picture,
+//                       in 8 bit levels (default 1)
+//      --max-slowdown F largest allowed drop in speed, as a fraction (default 0.5)
+//      --repeat N       render the picture N times and report the fastest, so
+//                       one slow run on a busy machine doesn't fail --golden
+//      --fog D          fill the scene with a thin haze of density D
+//      --smoke D        put a cloud of smoke of density D over the big spheres
+//      --roulette N     start Russian roulette after N bounces; 0 turns it off (default 3)
+//      --glass-absorb R,G,B
+//                       how much of each color the small glass spheres absorb per unit
+//                       of distance inside them (default 0,0,0: clear)
+//      --texture FILE   wrap the picture in FILE (a .ppm, or a tile file) around the big
+//                       diffuse sphere, read through the tile cache (see texture_cache.h)
+//      --texture-cache-mb N
+//                       memory for image texture tiles (default 256)
+//      --geometry-file FILE
+//                       keep the small spheres in FILE and read them in only as rays
+//                       reach them (see geometry_cache.h); FILE is written if it
+//                       doesn't hold this scene yet
+//      --geometry-chunk N
+//                       ... in chunks of NxN grid cells (default 32)
+//      --geometry-cache-mb N
+//                       memory for those chunks (default 1024)
+//      --guide N        path guiding: the first N passes (of 1, 2, 4... samples)
+//                       learn where light comes from, and diffuse bounces aim
+//                       there (see guiding.h). For one process, recursive only.
+struct options {
+    uint64_t seed = static_cast<uint64_t>( time(NULL) ) ;
+    int image_width = 1200 ;
+    int samples_per_pixel = 10 ;
+    double budget = 0 ;
+    int workers = 1 ;
+    split_mode split = split_mode::tiles ;
+    int worker = -1 ;
+    int worker_count = 0 ;
+    string accum_path ;
+    int serve_port = 0 ;
+    int roulette = 3 ;
+    string stream_path ;
+    string golden_path ;
+    golden_limits limits ;
+    int repeat = 1 ;
+    int threads = 0 ;
+    pin_mode pin = pin_mode::none ;
+    cpu_isa isa = best_isa() ;
+    output_settings output ;
+    bool wavefront = false ;
+    wavefront_sort sort = wavefront_sort::material ;
+    int queue = wavefront_integrator::default_queue ;
+    scene_params scene ;
+    bool room = false ;
+    int guide_passes = 0 ;
+    bool irradiance = false ;
+    irradiance_settings irradiance_options ;
+};
 
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
-
-    if (world.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth-1);
-        return color(0,0,0);
-    }
-
-    // Creates a linear blend between two colors
-    vec3 unit_direction = unit_vector( r.direction() );
-    auto t = 0.5*( unit_direction.y() + 1.0 );
-    return ( 1.0 - t  ) * color( 1.0, 1.0, 1.0 ) + t * color( 0.5, 0.7, 1.0 );
-}
+bool parse_options( int argc, char* argv[], options& opts ) {
+    for ( int k = 1; k < argc; ++k ) {
+        string arg = argv[k] ;
+        if ( k + 1 >= argc ) {
+            cerr << "Missing value for " << arg << '\n' ;
+            return false ;
+        }
+        string value = argv[++k] ;
 
-// Adds a world plane to our scene
-hittable_list random_scene() {
-    hittable_list world;
-
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
+        if ( arg == "--seed" )
+            opts.seed = stoull( value ) ;
+        else if ( arg == "--width" )
+            opts.image_width = stoi( value ) ;
+        else if ( arg == "--spp" )
+            opts.samples_per_pixel = stoi( value ) ;
+        else if ( arg == "--budget" && stod( value ) > 0 )
+            opts.budget = stod( value ) ;
+        else if ( arg == "--workers" )
+            opts.workers = stoi( value ) ;
+        else if ( arg == "--split" && ( value == "tiles" || value == "samples" ) )
+            opts.split = value == "tiles" ? split_mode::tiles : split_mode::samples ;
+        else if ( arg == "--worker" )
+            opts.worker = stoi( value ) ;
+        else if ( arg == "--of" )
+            opts.worker_count = stoi( value ) ;
+        else if ( arg == "--accum" )
+            opts.accum_path = value ;
+        else if ( arg == "--serve" )
+            opts.serve_port = stoi( value ) ;
+        else if ( arg == "--threads" )
+            opts.threads = stoi( value ) ;
+        else if ( arg == "--isa" && value == "auto" )
+            opts.isa = best_isa() ;
+        else if ( arg == "--isa" && parse_isa( value, opts.isa ) )
+            ;
+        else if ( arg == "--tonemap" && ( value == "none" || value == "reinhard" || value == "aces" ) )
+            opts.output.tone = value == "none" ? tone_mapper::none
+                             : value == "reinhard" ? tone_mapper::reinhard : tone_mapper::aces ;
+        else if ( arg == "--curve" && ( value == "srgb" || value == "gamma2" ) )
+            opts.output.curve = value == "srgb" ? transfer_curve::srgb : transfer_curve::gamma2 ;
+        else if ( arg == "--exposure" )
+            opts.output.exposure = stod( value ) ;
+        else if ( arg == "--integrator" && ( value == "recursive" || value == "wavefront" || value == "irradiance" ) ) {
+            opts.wavefront = value == "wavefront" ;
+            opts.irradiance = value == "irradiance" ;
+        }
+        else if ( arg == "--irradiance-error" && stod( value ) > 0 )
+            opts.irradiance_options.error = stod( value ) ;
+        else if ( arg == "--irradiance-rays" && stoi( value ) > 0 )
+            opts.irradiance_options.rays = stoi( value ) ;
+        else if ( arg == "--sort" && ( value == "none" || value == "material" || value == "octant" ) )
+            opts.sort = value == "none" ? wavefront_sort::none
+                      : value == "material" ? wavefront_sort::material : wavefront_sort::material_octant ;
+        else if ( arg == "--queue" && stoi( value ) > 0 )
+            opts.queue = stoi( value ) ;
+        else if ( arg == "--grid" )
+            opts.scene.extent = stoi( value ) ;
+        else if ( arg == "--density" )
+            opts.scene.density = stod( value ) ;
+        else if ( arg == "--mix" && sscanf( value.c_str(), "%lf,%lf", &opts.scene.diffuse, &opts.scene.metal ) == 2 )
+            ;
+        else if ( arg == "--golden" )
+            opts.golden_path = value ;
+        else if ( arg == "--tolerance" && stod( value ) >= 0 ) {
+            opts.limits.tolerance = stod( value ) ;
+            opts.limits.tile_tolerance = 8 * opts.limits.tolerance ;
+        }
+        else if ( arg == "--max-slowdown" && stod( value ) >= 0 )
+            opts.limits.max_slowdown = stod( value ) ;
+        else if ( arg == "--repeat" && stoi( value ) > 0 )
+            opts.repeat = stoi( value ) ;
+        else if ( arg == "--fog" && stod( value ) >= 0 )
+            opts.scene.fog = stod( value ) ;
+        else if ( arg == "--smoke" && stod( value ) >= 0 )
+            opts.scene.smoke = stod( value ) ;
+        else if ( arg == "--roulette" && stoi( value ) >= 0 )
+            opts.roulette = stoi( value ) ;
+        else if ( arg == "--glass-absorb" && sscanf( value.c_str(), "%lf,%lf,%lf", &opts.scene.glass_absorption[0],
+                                                     &opts.scene.glass_absorption[1], &opts.scene.glass_absorption[2] ) == 3 )
+            ;
+        else if ( arg == "--stream" )
+            opts.stream_path = value ;
+        else if ( arg == "--pin" && ( value == "none" || value == "compact" || value == "spread" ) )
+            opts.pin = value == "none" ? pin_mode::none
+                     : value == "compact" ? pin_mode::compact : pin_mode::spread ;
+        else if ( arg == "--accel" && ( value == "none" || value == "sah" || value == "lbvh" ) )
+            opts.scene.accel = value == "none" ? scene_accel::none
+                             : value == "sah" ? scene_accel::sah : scene_accel::lbvh ;
+        else if ( arg == "--texture" )
+            opts.scene.texture = value ;
+        else if ( arg == "--texture-cache-mb" )
+            global_texture_cache().set_budget( stoull( value ) << 20 ) ;
+        else if ( arg == "--scene" && ( value == "spheres" || value == "room" ) )
+            opts.room = value == "room" ;
+        else if ( arg == "--guide" && stoi( value ) >= 0 )
+            opts.guide_passes = stoi( value ) ;
+        else if ( arg == "--geometry-file" )
+            opts.scene.geometry_file = value ;
+        else if ( arg == "--geometry-chunk" && stoi( value ) > 0 )
+            opts.scene.geometry_chunk = stoi( value ) ;
+        else if ( arg == "--geometry-cache-mb" )
+            global_geometry_cache().set_budget( stoull( value ) << 20 ) ;
+        else {
+            cerr << "Unknown option " << arg << ' ' << value << '\n' ;
+            return false ;
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    return world;
+    bool worker_ok = opts.worker < 0
+        || ( opts.worker < opts.worker_count && !opts.accum_path.empty() ) ;
+    if ( opts.scene.extent < 1 || !( opts.scene.density > 0 ) ) {
+        cerr << "Bad scene settings\n" ;
+        return false ;
+    }
+    if ( opts.image_width < 4 || opts.samples_per_pixel < 1 ) {
+        cerr << "Bad image settings\n" ;
+        return false ;
+    }
+    if ( !use_isa( opts.isa ) ) {
+        cerr << "This CPU can't run " << isa_name( opts.isa ) << " code\n" ;
+        return false ;
+    }
+    if ( opts.workers < 1 || !worker_ok ) {
+        cerr << "Bad worker settings\n" ;
+        return false ;
+    }
+    if ( opts.guide_passes > 0 && ( opts.wavefront || opts.workers > 1 || opts.worker >= 0
+                                    || !opts.stream_path.empty() ) ) {
+        cerr << "--guide only works with the recursive integrator in one process\n" ;
+        return false ;
+    }
+    if ( opts.budget > 0 && ( opts.guide_passes > 0 || opts.workers > 1 || opts.worker >= 0 || opts.serve_port > 0
+                              || !opts.stream_path.empty() ) ) {
+        cerr << "--budget only works in one process, without --guide, --serve or --stream\n" ;
+        return false ;
+    }
+    if ( opts.irradiance && ( opts.guide_passes > 0 || opts.serve_port > 0 ) ) {
+        cerr << "--integrator irradiance doesn't work with --guide or --serve\n" ;
+        return false ;
+    }
+    // The preview samples pixels on ever finer grids, not in the regions
+    //      wavefront renders; it would make the same picture anyway.
+    if ( opts.wavefront && opts.serve_port > 0 ) {
+        cerr << "--integrator wavefront doesn't work with --serve\n" ;
+        return false ;
+    }
+    // A guide keeps learning and a budget keeps changing the picture, so
+    //      only a plain render comes out the same every time.
+    if ( opts.repeat > 1 && ( opts.guide_passes > 0 || opts.budget > 0 || opts.worker >= 0 || opts.serve_port > 0
+                              || !opts.stream_path.empty() ) ) {
+        cerr << "--repeat doesn't work with --guide, --budget, --serve or --stream\n" ;
+        return false ;
+    }
+    return true ;
 }
 
 
-int main() {
-    srand( time(NULL) ) ;
+int main( int argc, char* argv[] ) {
+    options opts ;
+    try {
+        if ( !parse_options( argc, argv, opts ) )
+            return 1 ;
+    } catch ( const exception& ) {
+        cerr << "Bad number on the command line\n" ;
+        return 1 ;
+    }
 
-    // Creates a .ppm and a .txt file to write the image data to
-    ofstream myPPM ;
-    ofstream textPPM ;
-    myPPM.open( "example.ppm" ) ;
-    textPPM.open( "example.txt" ) ;
+    // Everything random, including the scene, comes from this one seed, so
+    //      every worker builds exactly the same world.
+    seed_random( opts.seed ) ;
 
     // Generates the size of the image
     const auto aspect_ratio = ( 16.0 / 9.0 ) ;
-    const int image_width = 1200 ;
+    const int image_width = opts.image_width ;
     const int image_height = static_cast<int>( image_width / aspect_ratio ) ;
-    const int samples_per_pixel = 10 ;
-    const int max_depth = 50 ;
+    const int samples_per_pixel = opts.samples_per_pixel ;
 
     // World
-    auto world = random_scene();
+    opts.scene.seed = opts.seed ;
+    opts.scene.threads = opts.threads ;
+    scene_stats stats ;
+    auto world = make_shared<const hittable_list>( opts.room ? room_scene( opts.scene.accel )
+                                                             : random_scene( opts.scene, &stats ) ) ;
+    if ( !opts.scene.geometry_file.empty() && stats.chunks == 0 ) {
+        cerr << "Couldn't write " << opts.scene.geometry_file << '\n' ;
+        return 1 ;
+    }
+    if ( opts.worker < 0 )
+        cout << "Using the " << isa_name( current_isa() ) << " kernels" << endl ;
+    if ( opts.worker < 0 && !opts.room ) {
+        if ( stats.chunks > 0 )
+            cout << "Opened " << stats.spheres << " spheres in " << stats.chunks << " chunks in "
+                 << stats.build_seconds * 1000 << " ms" << endl ;
+        else
+            cout << "Built " << stats.spheres << " spheres in " << stats.build_seconds * 1000 << " ms ("
+                 << static_cast<double>(stats.bytes) / max<size_t>( stats.spheres, 1 ) << " bytes each)" << endl ;
+        if ( opts.scene.accel != scene_accel::none )
+            cout << "Built a BVH with " << stats.accel_nodes << " nodes in " << stats.accel_seconds * 1000
+                 << " ms" << endl ;
+    }
 
     // Places the camera in the world 
-    point3 lookfrom( 13, 2, 3 );
-    point3 lookat( 0, 0, 0 );
-    vec3 vup( 0, 1, 0 );
-    auto dist_to_focus = 10.0;
-    auto aperture = 0.1;
+    camera_settings cam_settings = opts.room ? room_scene_camera( aspect_ratio ) : random_scene_camera( aspect_ratio ) ;
+    camera cam = cam_settings.make_camera() ;
+    path_settings paths( 50, opts.roulette ) ;
+    paths.pixel_angle = cam.pixel_angle( image_height ) ;
 
-    camera cam( lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus );
+    // Path guiding: the guide learns over the whole scene (see guiding.h).
+    unique_ptr<guide_field> guide ;
+    if ( opts.guide_passes > 0 )
+        guide.reset( new guide_field( opts.room ? room_scene_bounds() : random_scene_bounds( opts.scene ) ) ) ;
 
-    // Renders the image to .txt and .ppm
-    
-    // Standard .ppm header
-    myPPM   << "P3\n" << image_width << ' ' << image_height << "\n255\n" ;
-    textPPM << "P3\n" << image_width << ' ' << image_height << "\n255\n" ;
-
-    // Progress indicator- tells us how many pixels have been written and how many are left 
-    for ( int j = image_height - 1; j >= 0; --j ) {
-        cout << "\rScanlines remaining: " << j << ' ' << flush ;
-        for ( int i = 0; i < image_width; ++i ) {
-            color pixel_color( 0,0,0 ) ;
-            for ( int s = 0; s < samples_per_pixel; ++s ) {
-                
-                // U and V describe the coordinate endpoints for rays, x and y respectively.
-                // This section colors the background and gets darker the farther it goes from
-                //      the camera. 
-                auto u = ( i + random_double() ) / ( image_width  - 1 ) ;
-                auto v = ( j + random_double() ) / ( image_height - 1 ) ;
-                ray r = cam.get_ray( u, v ) ;
-                pixel_color += ray_color( r, world, max_depth ) ;
+    // Irradiance caching: the records are made for this camera before
+    //      rendering starts (every worker makes the same ones). A coordinator
+    //      renders nothing itself, so it leaves that to the workers.
+    bool coordinator = opts.workers > 1 && opts.stream_path.empty() ;
+    unique_ptr<irradiance_cache> irradiance ;
+    if ( opts.irradiance && !coordinator ) {
+        opts.irradiance_options.paths = paths ;
+        irradiance.reset( new irradiance_cache( opts.irradiance_options ) ) ;
+        auto fill_start = chrono::steady_clock::now() ;
+        irradiance->fill( *world, cam, image_width, image_height, opts.seed, opts.threads ) ;
+        double fill_seconds = chrono::duration<double>( chrono::steady_clock::now() - fill_start ).count() ;
+        if ( opts.worker < 0 )
+            cout << "Irradiance cache: " << irradiance->size() << " records in " << fill_seconds * 1000
+                 << " ms" << endl ;
+    }
+
+    // Preview: keep the world around and render progressively until told to quit.
+    if ( opts.serve_port > 0 ) {
+        int threads = opts.threads > 0 ? opts.threads : default_thread_count() ;
+        path_settings preview_paths = paths ;
+        if ( guide ) {
+            // Train first, on a picture we throw away; then every frame, from
+            //      wherever the camera moves, uses what the guide learned.
+            cout << "Training the guide..." << endl ;
+            render_engine engine( opts.threads, opts.pin ) ;
+            render_settings training ;
+            training.seed = opts.seed ;
+            training.samples_per_pixel = ( 1 << opts.guide_passes ) - 1 ;
+            training.paths = paths ;
+            framebuffer scratch( image_width, image_height ) ;
+            engine.render_guided( world, cam, training, scratch, *guide, opts.guide_passes ) ;
+            preview_paths.guide = guide.get() ;
+        }
+        preview_server server( *world, cam_settings, image_width, image_height, opts.seed, preview_paths,
+                               opts.output ) ;
+        return server.run( opts.serve_port, threads, opts.pin ) ? 0 : 1 ;
+    }
+
+    // Makes something that renders one region into "target". Every render
+    //      thread makes its own, so each has its own scratch space.
+    auto make_renderer = [&]( framebuffer& target ) {
+        return [&, wavefront = wavefront_integrator( *world, paths, opts.sort, opts.queue ), batch = ray_batch()]
+               ( const render_region& region ) mutable {
+            if ( irradiance )
+                render_irradiance( *world, cam, opts.seed, *irradiance, region, target, batch ) ;
+            else if ( opts.wavefront )
+                wavefront.render( cam, opts.seed, region, target ) ;
+            else
+                render( *world, cam, opts.seed, paths, region, target, batch ) ;
+        } ;
+    } ;
+    auto show_progress = [&]( long long left ) {
+        cout << "\rTiles remaining: " << left << ' ' << flush ;
+    } ;
+
+    // Streaming: each thread renders a tile into its own tile sized
+    //      framebuffer, encodes it, and drops it into the mapped file.
+    if ( !opts.stream_path.empty() ) {
+        mapped_ppm out ;
+        if ( !out.open( opts.stream_path, image_width, image_height ) ) {
+            cerr << "Couldn't create " << opts.stream_path << '\n' ;
+            return 1 ;
+        }
+        output_encoder encoder( opts.output ) ;
+        render_tiles( image_width, image_height, 0, samples_per_pixel, opts.threads, opts.pin, [&] {
+            auto tile_fb = make_shared<framebuffer>() ;
+            return [&, tile_fb, render_part = make_renderer( *tile_fb ), rgb = vector<unsigned char>()]
+                   ( const render_region& r ) mutable {
+                *tile_fb = framebuffer( image_width, image_height, r.x0, r.y0, r.x1, r.y1 ) ;
+                render_part( r ) ;
+                rgb.resize( 3 * ( r.x1 - r.x0 ) * ( r.y1 - r.y0 ) ) ;
+                encoder.encode_area( *tile_fb, r.x0, r.y0, r.x1, r.y1, rgb.data() ) ;
+                out.write_tile( r.x0, r.y0, r.x1, r.y1, rgb.data() ) ;
+            } ;
+        }, show_progress ) ;
+        if ( !out.close() ) {
+            cerr << "Couldn't write " << opts.stream_path << '\n' ;
+            return 1 ;
+        }
+        cout << "\nDone.\n" ;
+        return 0 ;
+    }
+
+    framebuffer fb( image_width, image_height ) ;
+
+    // Worker: render our share, hand it back through the file, and stop.
+    if ( opts.worker >= 0 ) {
+        work_assignment work{ opts.worker, opts.worker_count, opts.split } ;
+        auto render_part = make_renderer( fb ) ;
+        for ( auto& region : assigned_regions( work, image_width, image_height, samples_per_pixel ) )
+            render_part( region ) ;
+        if ( global_geometry_cache().stats().read_errors > 0 || global_texture_cache().stats().read_errors > 0 )
+            return 1 ;
+        return fb.save( opts.accum_path ) ? 0 : 1 ;
+    }
+
+    double samples = static_cast<double>( image_width ) * image_height * samples_per_pixel ;
+    double render_seconds = 0 ;
+    for ( int run = 0; run < opts.repeat; ++run ) {
+        if ( run > 0 )
+            fb = framebuffer( image_width, image_height ) ;
+        auto render_start = chrono::steady_clock::now() ;
+        if ( opts.workers > 1 ) {
+            // Coordinator: the workers get all of our options, plus our seed, or
+            //      they'd each pick their own.
+            cout << "Rendering with " << opts.workers << " workers..." << endl ;
+            vector<string> args = { "--seed", to_string(opts.seed) } ;
+            for ( int k = 1; k + 1 < argc; k += 2 ) {
+                string arg = argv[k] ;
+                if ( arg != "--seed" && arg != "--workers" && arg != "--split" && arg != "--repeat" )
+                    args.insert( args.end(), { arg, argv[k + 1] } ) ;
+            }
+            if ( !run_coordinator( "/proc/self/exe", args, opts.workers, opts.split, fb ) )
+                return 1 ;
+        }
+        else {
+            render_engine engine( opts.threads, opts.pin ) ;
+            render_settings settings ;
+            settings.seed = opts.seed ;
+            settings.samples_per_pixel = samples_per_pixel ;
+            settings.paths = paths ;
+            settings.wavefront = opts.wavefront ;
+            settings.sort = opts.sort ;
+            settings.queue = opts.queue ;
+            settings.irradiance = irradiance.get() ;
+
+            // Progress indicator- tells us how many tiles are left
+            show_progress( fb.tile_count() ) ;
+            auto progress = [&]( long long done, long long total ) {
+                show_progress( total - done ) ;
+                return true ;
+            } ;
+            if ( guide )
+                engine.render_guided( world, cam, settings, fb, *guide, opts.guide_passes, progress ) ;
+            else if ( opts.budget > 0 ) {
+                budget_report report = engine.render_budgeted( world, cam, settings, fb, opts.budget, progress ) ;
+                samples = static_cast<double>( report.samples ) ;
+                cout << "\nBudget: " << report.passes << " passes, " << samples / ( image_width * image_height )
+                     << " samples per pixel (" << report.min_samples << " to " << report.max_samples << ")" ;
             }
-            
-            // Writes the colors to the .ppm and .txt file
-            write_color( myPPM, pixel_color, samples_per_pixel ) ;
-            write_color( textPPM, pixel_color, samples_per_pixel ) ;
+            else
+                engine.render( world, cam, settings, fb, progress ) ;
         }
+        double seconds = chrono::duration<double>( chrono::steady_clock::now() - render_start ).count() ;
+        if ( run == 0 || seconds < render_seconds )
+            render_seconds = seconds ;
+    }
+    double samples_per_second = samples / render_seconds ;
+    cout << "\nRendered in " << render_seconds << " s (" << samples_per_second / 1e6 << " Msamples/s)" << endl ;
+    if ( guide )
+        cout << "Guide: " << guide->regions() << " regions after " << guide->passes() << " passes" << endl ;
+    if ( irradiance )
+        cout << "Irradiance cache: " << irradiance->misses() << " samples found no record" << endl ;
+    if ( stats.chunks > 0 && opts.workers == 1 ) {
+        auto geometry = global_geometry_cache().stats() ;
+        cout << "Geometry cache: " << geometry.hits << " hits, " << geometry.misses << " misses, "
+             << geometry.evictions << " evictions, " << ( geometry.bytes_read >> 20 ) << " MB read" << endl ;
+    }
+    if ( !opts.scene.texture.empty() && opts.workers == 1 ) {
+        auto textures = global_texture_cache().stats() ;
+        cout << "Texture cache: " << textures.hits << " hits, " << textures.misses << " misses, "
+             << textures.evictions << " evictions" << endl ;
+    }
+    // Spheres or tiles we couldn't read are missing from the picture, so it's no good.
+    if ( global_geometry_cache().stats().read_errors > 0 ) {
+        cerr << "Couldn't read all of " << opts.scene.geometry_file << '\n' ;
+        return 1 ;
+    }
+    if ( global_texture_cache().stats().read_errors > 0 ) {
+        cerr << "Couldn't read all of " << opts.scene.texture << '\n' ;
+        return 1 ;
     }
 
-    // Closes the .txt and .ppm 
+    // Converts the linear framebuffer into 8 bit pixels
+    vector<unsigned char> pixels( 3 * image_width * image_height ) ;
+    output_encoder( opts.output ).encode_image( fb, pixels.data(), opts.threads ) ;
+
+    // Writes the image to a .ppm and a .txt file
+    ofstream myPPM( "example.ppm" ) ;
+    ofstream textPPM( "example.txt" ) ;
+    write_ppm( myPPM, pixels.data(), image_width, image_height ) ;
+    write_ppm( textPPM, pixels.data(), image_width, image_height ) ;
     textPPM.close() ;
     myPPM.close() ;
 
+    if ( !opts.golden_path.empty()
+         && !check_golden( opts.golden_path, pixels.data(), image_width, image_height, samples_per_second,
+                           opts.limits, cout ) )
+        return 1 ;
+
     // Status update!!
-    cout << "\nDone.\n";
+    cout << "Done.\n";
     
     return 0 ;
 }
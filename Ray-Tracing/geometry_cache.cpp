@@ -0,0 +1,212 @@
+// geometry_cache.cpp
+// Writing and reading geometry files, the chunk cache, and geometry proxies (see geometry_cache.h).
+
+# include "geometry_cache.h"
+
+using namespace std ;
+
+
+bool geometry_file::open( const std::string& file_path ) {
+    static std::atomic<uint32_t> next_id{ 1 };
+
+    fd = ::open( file_path.c_str(), O_RDONLY );
+    char header[8] = {};
+    uint64_t fields[3];
+    struct stat info;
+    if ( fd < 0 || fstat(fd, &info) != 0 || pread(fd, header, 8, 0) != 8 || memcmp(header, magic, 8) != 0
+         || pread(fd, fields, sizeof(fields), 8) != sizeof(fields) )
+        return false;
+
+    // The table: a box (six doubles), an offset and a count per chunk. It
+    //      ends the file, so a damaged header that claims more chunks than
+    //      would fit is caught before we make room for them.
+    const uint64_t file_bytes = static_cast<uint64_t>( info.st_size );
+    if ( fields[2] < header_bytes || fields[2] > file_bytes
+         || fields[1] > (file_bytes - fields[2]) / (8 * sizeof(double)) )
+        return false;
+    key = fields[0];
+    std::vector<double> table( 8 * fields[1] );
+    ssize_t table_bytes = static_cast<ssize_t>( table.size() * sizeof(double) );
+    if ( pread(fd, table.data(), table_bytes, static_cast<off_t>(fields[2])) != table_bytes )
+        return false;
+    chunks.resize( fields[1] );
+    for ( size_t i = 0; i < chunks.size(); ++i ) {
+        const double* t = &table[8 * i];
+        chunks[i].bounds = aabb( point3(t[0], t[1], t[2]), point3(t[3], t[4], t[5]) );
+        memcpy( &chunks[i].offset, &t[6], 8 );
+        memcpy( &chunks[i].count, &t[7], 8 );
+        // Every chunk's spheres lie between the header and the table.
+        if ( chunks[i].offset < header_bytes || chunks[i].offset > fields[2]
+             || chunks[i].count > (fields[2] - chunks[i].offset) / sizeof(sphere_record) )
+            return false;
+    }
+    path = file_path;
+    id = next_id++;
+    return true;
+}
+
+bool geometry_file::read_chunk( size_t i, sphere_collection& spheres ) const {
+    std::vector<sphere_record> records( chunks[i].count );
+    ssize_t bytes = static_cast<ssize_t>( records.size() * sizeof(sphere_record) );
+    if ( pread(fd, records.data(), bytes, static_cast<off_t>(chunks[i].offset)) != bytes )
+        return false;
+
+    spheres.resize( records.size() );
+    for ( size_t k = 0; k < records.size(); ++k ) {
+        const sphere_record& s = records[k];
+        color albedo( s.albedo[0], s.albedo[1], s.albedo[2] );
+        material m = s.kind == 0 ? material( lambertian(albedo) )
+                   : s.kind == 1 ? material( metal(albedo, s.param) )
+                   : material( dielectric(s.param, color(s.absorption[0], s.absorption[1], s.absorption[2])) );
+        spheres.set( k, point3(s.center[0], s.center[1], s.center[2]), s.radius, m );
+    }
+    return true;
+}
+
+size_t geometry_file::sphere_count() const {
+    size_t n = 0;
+    for ( const auto& c : chunks )
+        n += c.count;
+    return n;
+}
+
+
+bool geometry_writer::open( const std::string& file_path, uint64_t file_key ) {
+    path = file_path;
+    key = file_key;
+    at = geometry_file::header_bytes;
+    table.clear();
+    out.open( path + ".tmp", std::ios::binary | std::ios::trunc );
+
+    // The header is written again by finish(), once the table's place is known.
+    char header[geometry_file::header_bytes] = {};
+    out.write( header, sizeof(header) );
+    return static_cast<bool>( out );
+}
+
+bool geometry_writer::add_chunk( const sphere_collection& spheres ) {
+    std::vector<geometry_file::sphere_record> records( spheres.size() );
+    aabb bounds, box;
+    for ( size_t k = 0; k < spheres.size(); ++k ) {
+        geometry_file::sphere_record& s = records[k];
+        point3 center = spheres.center( k );
+        for ( int a = 0; a < 3; ++a )
+            s.center[a] = center[a];
+        s.radius = spheres.radius[k];
+
+        const auto& bsdf = spheres.materials[k].bsdf;
+        if ( auto m = std::get_if<lambertian>(&bsdf); m && !m->tex ) {
+            s.kind = 0;
+            for ( int a = 0; a < 3; ++a )
+                s.albedo[a] = m->albedo[a];
+        } else if ( auto m = std::get_if<metal>(&bsdf); m && !m->tex ) {
+            s.kind = 1;
+            for ( int a = 0; a < 3; ++a )
+                s.albedo[a] = m->albedo[a];
+            s.param = m->fuzz;
+        } else if ( auto m = std::get_if<dielectric>(&bsdf) ) {
+            s.kind = 2;
+            s.param = m->ir;
+            for ( int a = 0; a < 3; ++a )
+                s.absorption[a] = m->absorption[a];
+        } else {
+            return false;
+        }
+        spheres.part_bounding_box( k, box );
+        bounds.expand( box );
+    }
+
+    out.write( reinterpret_cast<const char*>(records.data()), records.size() * sizeof(records[0]) );
+    table.push_back( geometry_file::chunk{ bounds, at, records.size() } );
+    at += records.size() * sizeof(records[0]);
+    return static_cast<bool>( out );
+}
+
+bool geometry_writer::finish() {
+    for ( const auto& c : table ) {
+        double t[8] = { c.bounds.min().x(), c.bounds.min().y(), c.bounds.min().z(),
+                        c.bounds.max().x(), c.bounds.max().y(), c.bounds.max().z() };
+        memcpy( &t[6], &c.offset, 8 );
+        memcpy( &t[7], &c.count, 8 );
+        out.write( reinterpret_cast<const char*>(t), sizeof(t) );
+    }
+    uint64_t fields[3] = { key, table.size(), at };
+    out.seekp( 0 );
+    out.write( geometry_file::magic, strlen(geometry_file::magic) + 1 );
+    out.write( reinterpret_cast<const char*>(fields), sizeof(fields) );
+    out.close();
+    return !out.fail() && rename( (path + ".tmp").c_str(), path.c_str() ) == 0;
+}
+
+
+geometry_cache::geometry_ptr geometry_cache::get( const geometry_file& file, size_t chunk ) {
+    uint64_t key = make_key( file.id, chunk );
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        auto found = index.find( key );
+        if ( found != index.end() ) {
+            lru.splice( lru.begin(), lru, found->second );
+            ++counters.hits;
+            return found->second->geometry;
+        }
+        ++counters.misses;
+    }
+
+    // Read and build without holding the lock, as texture_cache does. The
+    //      BVH is built on this thread alone: the other threads are busy
+    //      rendering, and a chunk is small.
+    auto spheres = make_shared<sphere_collection>();
+    if ( !file.read_chunk(chunk, *spheres) ) {
+        std::cerr << "Couldn't read chunk " << chunk << " of " << file.path << '\n';
+        std::lock_guard<std::mutex> guard( lock );
+        ++counters.read_errors;
+        return nullptr;
+    }
+    auto tree = make_shared<bvh>( hittable_list(spheres), bvh_builder::sah, 1 );
+    size_t bytes = spheres->memory_bytes() + tree->memory_bytes();
+
+    std::lock_guard<std::mutex> guard( lock );
+    counters.bytes_read += file.chunk_bytes( chunk );
+    auto found = index.find( key );
+    if ( found != index.end() )
+        return found->second->geometry;
+    lru.push_front( entry{ key, tree, bytes } );
+    index[key] = lru.begin();
+    counters.bytes += bytes;
+    evict();
+    return tree;
+}
+
+geometry_cache& global_geometry_cache() {
+    static geometry_cache cache( size_t(1) << 30 );
+    return cache;
+}
+
+
+bool geometry_proxy::hit( const ray& r, double t_min, double t_max, hit_record& rec ) const {
+    // Don't load anything for a ray that misses the box.
+    if ( !file->chunks[chunk].bounds.hit(r, t_min, t_max) )
+        return false;
+
+    // A chunk this thread's path has already hit is used as it is (see
+    //      geometry_cache.h); anything else goes through the cache, and is
+    //      pinned if the ray hits it.
+    auto& pins = pinned_geometry();
+    if ( !pins.empty() ) {
+        auto pinned = pins.find( key );
+        if ( pinned != pins.end() )
+            return pinned->second->hit( r, t_min, t_max, rec );
+    }
+    auto geometry = cache.get( *file, chunk );
+    if ( !geometry || !geometry->hit(r, t_min, t_max, rec) )
+        return false;
+    pins.emplace( key, std::move(geometry) );
+    return true;
+}
+
+hittable_list geometry_proxies( shared_ptr<const geometry_file> file, geometry_cache& cache ) {
+    hittable_list proxies;
+    for ( size_t c = 0; c < file->chunks.size(); ++c )
+        proxies.add( make_shared<geometry_proxy>( file, c, cache ) );
+    return proxies;
+}
@@ -0,0 +1,240 @@
+// geometry_cache.h
+// Scenes with more spheres than we have memory for. Like image textures (see
+//      texture_cache.h), the geometry lives on disk and only the parts rays
+//      actually reach are in memory:
+//
+//      - The spheres are written once, chunk by chunk, into a "geometry
+//        file": a chunk is the spheres of one patch of the scene, and the
+//        file ends with a table of every chunk's bounding box and where its
+//        spheres are.
+//      - A geometry_proxy stands in for one chunk. All it holds is the
+//        chunk's box, so a BVH can be built over the proxies of millions of
+//        spheres straight from the table. The first ray that enters the box
+//        has the chunk read in: its spheres, plus a little BVH of their own.
+//      - The geometry_cache keeps loaded chunks up to a budget of bytes and
+//        throws out the least recently used one when it's over ("LRU"). A
+//        chunk that's thrown out is just read again when a ray next needs it.
+//
+// So a scene several times bigger than the budget still renders: slower, as
+//      chunks go back and forth, but it finishes.
+//
+// A hit_record points at the material of the sphere that was hit, and that
+//      material lives in the chunk. So a render thread holds on to ("pins")
+//      every chunk its current path has hit until the path is done- otherwise
+//      another thread could throw the chunk out between the hit and the
+//      shading. Pinning also means a path sees the same copy of a chunk
+//      from bounce to bounce, which nested glass (see medium_stack in
+//      material.h) relies on, since it tells glass spheres apart by address.
+//      The renderers call release_geometry() when a path (or, for the
+//      wavefront integrator, a batch of paths) is finished. A pinned chunk
+//      the cache has already thrown out isn't counted any more, so memory
+//      can go over the budget by the few chunks each thread is using.
+
+# ifndef GEOMETRY_CACHE_H
+# define GEOMETRY_CACHE_H
+
+# include "rtweekend.h"
+
+# include "aabb.h"
+# include "bvh.h"
+# include "hittable.h"
+# include "hittable_list.h"
+# include "sphere_collection.h"
+
+# include <atomic>
+# include <cstdio>
+# include <cstring>
+# include <fstream>
+# include <iostream>
+# include <list>
+# include <mutex>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+
+// One geometry file on disk, opened for reading.
+class geometry_file {
+    public:
+        struct chunk {
+            aabb bounds;
+            uint64_t offset;     // where in the file its spheres start
+            uint64_t count;      // ... and how many there are
+        };
+
+        geometry_file() {}
+        ~geometry_file() { if ( fd >= 0 ) close( fd ); }
+        geometry_file( const geometry_file& ) = delete;
+        geometry_file& operator=( const geometry_file& ) = delete;
+
+        // Opens a file and reads its chunk table. "key" is whatever the
+        //      writer was given, so a caller can tell whether the file holds
+        //      the scene it wants or has to be written again. A file whose
+        //      table doesn't fit in it is refused, and can be written again too.
+        bool open( const std::string& file_path );
+
+        // Reads chunk i's spheres into "spheres".
+        bool read_chunk( size_t i, sphere_collection& spheres ) const;
+
+        size_t sphere_count() const;
+
+        // How much of the file chunk i takes up.
+        uint64_t chunk_bytes( size_t i ) const { return chunks[i].count * sizeof(sphere_record); }
+
+    public:
+        uint64_t key = 0;
+        std::vector<chunk> chunks;
+        uint32_t id = 0;     // tells chunks of different files apart in the cache
+        std::string path;
+
+    private:
+        friend class geometry_writer;
+
+        // What one sphere looks like on disk. Only plain colored materials
+        //      (what generate_spheres makes) can be written.
+        struct sphere_record {
+            double center[3];
+            double radius;
+            double albedo[3];        // lambertian and metal
+            double param;            // metal: fuzz, dielectric: index of refraction
+            double absorption[3];    // dielectric
+            int32_t kind;            // 0 lambertian, 1 metal, 2 dielectric
+            int32_t unused;
+        };
+
+        static constexpr const char* magic = "RTGEO1\n";
+        static const int header_bytes = 8 + 3*8;     // magic, key, chunk count, table offset
+        int fd = -1;
+};
+
+// Writes a geometry file one chunk at a time, so the whole scene never has to
+//      be in memory. The file only appears under its name once finish()
+//      succeeds, so a half written one is never mistaken for a good one.
+class geometry_writer {
+    public:
+        bool open( const std::string& path, uint64_t key );
+
+        // Appends a chunk. Every material has to be a plain colored
+        //      lambertian, metal or dielectric; returns false otherwise.
+        bool add_chunk( const sphere_collection& spheres );
+
+        bool finish();
+
+    private:
+        std::string path;
+        std::ofstream out;
+        uint64_t key = 0;
+        uint64_t at = 0;
+        std::vector<geometry_file::chunk> table;
+};
+
+
+class geometry_cache {
+    public:
+        using geometry_ptr = shared_ptr<const hittable>;
+
+        struct statistics {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+            size_t bytes = 0;
+            uint64_t bytes_read = 0;     // from disk, over the whole run
+            uint64_t read_errors = 0;    // chunks that couldn't be read
+        };
+
+        explicit geometry_cache( size_t budget_bytes ) : budget(budget_bytes) {}
+
+        // Returns a chunk's spheres, reading them from disk if they aren't
+        //      cached yet. Like a texture tile, the chunk stays valid for as
+        //      long as the caller holds on to it. If the chunk can't be read,
+        //      that's reported, counted in read_errors and nothing is cached:
+        //      we return nullptr, and the next ray tries again.
+        geometry_ptr get( const geometry_file& file, size_t chunk );
+
+        void set_budget( size_t bytes ) {
+            std::lock_guard<std::mutex> guard( lock );
+            budget = bytes;
+            evict();
+        }
+
+        statistics stats() {
+            std::lock_guard<std::mutex> guard( lock );
+            return counters;
+        }
+
+        static uint64_t make_key( uint32_t id, size_t chunk ) {
+            return (uint64_t(id) << 40) | uint64_t(chunk);
+        }
+
+    private:
+        struct entry {
+            uint64_t key;
+            geometry_ptr geometry;
+            size_t bytes;
+        };
+
+        // Throws out least recently used chunks until we're within budget.
+        void evict() {
+            while ( counters.bytes > budget && !lru.empty() ) {
+                counters.bytes -= lru.back().bytes;
+                index.erase( lru.back().key );
+                lru.pop_back();
+                ++counters.evictions;
+            }
+        }
+
+    private:
+        std::mutex lock;
+        size_t budget;
+        std::list<entry> lru;     // most recently used at the front
+        std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+        statistics counters;
+};
+
+// The cache shared by every geometry proxy in the program (1 GB to start with).
+geometry_cache& global_geometry_cache();
+
+
+// The chunks this thread has pinned, by cache key.
+inline std::unordered_map<uint64_t, geometry_cache::geometry_ptr>& pinned_geometry() {
+    thread_local std::unordered_map<uint64_t, geometry_cache::geometry_ptr> pins;
+    return pins;
+}
+
+// Lets go of the chunks this thread has pinned. Call it once nothing from
+//      them- hit records, or glass in a medium_stack- is in use any more.
+inline void release_geometry() {
+    auto& pins = pinned_geometry();
+    if ( !pins.empty() )
+        pins.clear();
+}
+
+
+// One chunk of a geometry file, standing in for its spheres.
+class geometry_proxy : public hittable {
+    public:
+        geometry_proxy( shared_ptr<const geometry_file> f, size_t c, geometry_cache& gc )
+            : file(f), chunk(c), cache(gc), key(geometry_cache::make_key(f->id, c)) {}
+
+        virtual bool hit( const ray& r, double t_min, double t_max, hit_record& rec ) const override;
+
+        virtual bool bounding_box( double time0, double time1, aabb& output_box ) const override {
+            output_box = file->chunks[chunk].bounds;
+            return true;
+        }
+
+    public:
+        shared_ptr<const geometry_file> file;
+        size_t chunk;
+        geometry_cache& cache;
+        uint64_t key;
+};
+
+// A proxy for every chunk in "file", ready to go in a BVH.
+hittable_list geometry_proxies( shared_ptr<const geometry_file> file, geometry_cache& cache );
+
+
+# endif
@@ -0,0 +1,82 @@
+// golden.cpp
+// Comparing renders with golden pictures (see golden.h).
+
+# include "golden.h"
+
+using namespace std ;
+
+
+image_difference compare_images( const unsigned char* a, const unsigned char* b, int width, int height ) {
+    const int tile = 16;
+    image_difference diff;
+    double total = 0;
+    for ( int ty = 0; ty < height; ty += tile ) {
+        for ( int tx = 0; tx < width; tx += tile ) {
+            double tile_total = 0;
+            int tile_values = 0;
+            for ( int y = ty; y < std::min( ty + tile, height ); ++y ) {
+                for ( int x = tx; x < std::min( tx + tile, width ); ++x ) {
+                    for ( int k = 0; k < 3; ++k ) {
+                        size_t at = 3 * ( static_cast<size_t>(y) * width + x ) + k;
+                        double d = static_cast<double>( a[at] ) - b[at];
+                        tile_total += d*d;
+                        ++tile_values;
+                    }
+                }
+            }
+            total += tile_total;
+            diff.worst_tile_rmse = std::max( diff.worst_tile_rmse, sqrt(tile_total / tile_values) );
+        }
+    }
+    diff.rmse = sqrt( total / ( 3.0 * width * height ) );
+    return diff;
+}
+
+bool check_golden( const std::string& path, const unsigned char* rgb, int width, int height,
+                   double samples_per_second, const golden_limits& limits, std::ostream& log ) {
+    const std::string perf_path = path + ".perf";
+    int gw, gh;
+    std::vector<unsigned char> golden;
+    if ( !read_ppm(path, gw, gh, golden) ) {
+        std::ofstream image( path, std::ios::binary );
+        write_ppm( image, rgb, width, height, true );
+        std::ofstream perf( perf_path );
+        perf << "samples_per_second " << samples_per_second << '\n';
+        log << "Recorded new golden picture " << path << '\n';
+        return static_cast<bool>( image ) && static_cast<bool>( perf );
+    }
+
+    if ( gw != width || gh != height ) {
+        log << "FAIL " << path << ": golden picture is " << gw << 'x' << gh << ", this one is "
+            << width << 'x' << height << '\n';
+        return false;
+    }
+    bool ok = true;
+    image_difference diff = compare_images( rgb, golden.data(), width, height );
+    log << path << ": rmse " << diff.rmse << ", worst tile " << diff.worst_tile_rmse << '\n';
+    if ( diff.rmse > limits.tolerance || diff.worst_tile_rmse > limits.tile_tolerance ) {
+        log << "FAIL " << path << ": picture differs (limits " << limits.tolerance << ", "
+            << limits.tile_tolerance << ")\n";
+        ok = false;
+    }
+
+    std::ifstream perf( perf_path );
+    std::string key;
+    double baseline = 0;
+    if ( perf >> key >> baseline && key == "samples_per_second" && baseline > 0 ) {
+        double change = samples_per_second / baseline - 1;
+        log << path << ": " << samples_per_second / 1e6 << " Msamples/s, " << (change >= 0 ? "+" : "")
+            << 100 * change << "% against the baseline\n";
+        if ( change < -limits.max_slowdown ) {
+            log << "FAIL " << path << ": more than " << 100 * limits.max_slowdown << "% slower\n";
+            ok = false;
+        } else if ( change > limits.max_slowdown ) {
+            log << path << ": much faster than the baseline; delete " << perf_path << " to record the new speed\n";
+        }
+    } else {
+        std::ofstream out( perf_path );
+        out << "samples_per_second " << samples_per_second << '\n';
+        log << "Recorded new speed baseline " << perf_path << '\n';
+    }
+    return ok;
+}
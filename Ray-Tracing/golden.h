@@ -0,0 +1,51 @@
+// golden.h
+// Regression checks against "golden" pictures. With a fixed seed a render
+//      comes out exactly the same every time, so we can keep a picture (and
+//      how fast it rendered) from a version we trust and compare every later
+//      render with it. An optimization that shouldn't change the picture
+//      should leave it the same or very nearly- a different order of
+//      additions can move a pixel by a level here and there- and shouldn't
+//      make it slower.
+//
+// The picture is compared two ways: the root mean square difference over the
+//      whole picture (in 8 bit levels), and the same for the worst 16x16
+//      tile, since a broken object that covers a small part of the picture
+//      hardly moves the overall number.
+
+# ifndef GOLDEN_H
+# define GOLDEN_H
+
+# include "rtweekend.h"
+
+# include "color.h"
+# include "texture_cache.h"
+
+# include <fstream>
+# include <iostream>
+# include <string>
+# include <vector>
+
+struct image_difference {
+    double rmse = 0;
+    double worst_tile_rmse = 0;
+};
+
+// Both pictures are rgb triples of the same size.
+image_difference compare_images( const unsigned char* a, const unsigned char* b, int width, int height );
+
+// How close a render has to be to its golden picture.
+struct golden_limits {
+    double tolerance = 1.0;        // largest allowed rmse, in 8 bit levels
+    double tile_tolerance = 8.0;   // largest allowed rmse in any one tile
+    double max_slowdown = 0.5;     // fail if samples/s drops by more than this fraction
+};
+
+// Checks a render against the golden picture at "path" and the speed
+//      recorded next to it in "path.perf". If there's no golden picture yet,
+//      this render becomes it. Returns false, after saying why, if the
+//      picture or the speed has drifted past the limits.
+bool check_golden( const std::string& path, const unsigned char* rgb, int width, int height,
+                   double samples_per_second, const golden_limits& limits, std::ostream& log );
+
+
+# endif
@@ -0,0 +1,147 @@
+// grid_medium.cpp
+// Building the block grid of smoke and delta tracking through it (see grid_medium.h).
+
+# include "grid_medium.h"
+
+using namespace std ;
+
+
+grid_medium::grid_medium( const aabb& box, int resolution, const std::function<double(const point3&)>& density,
+                          double s, const color& albedo, int threads )
+    : bounds(box), sigma(s), phase_function(isotropic(albedo)) {
+    vec3 extent = box.max() - box.min();
+    double longest = fmax( extent.x(), fmax(extent.y(), extent.z()) );
+    for ( int a = 0; a < 3; ++a ) {
+        cells[a] = std::max( 1, static_cast<int>( resolution * extent[a] / longest + 0.5 ) );
+        blocks[a] = ( cells[a] + block_size - 1 ) / block_size;
+    }
+    voxel_size = vec3( extent.x() / cells[0], extent.y() / cells[1], extent.z() / cells[2] );
+    block_extent = block_size * voxel_size;
+
+    // Fill in every block on its own (in parallel), then keep only the ones with something in them.
+    size_t block_total = static_cast<size_t>(blocks[0]) * blocks[1] * blocks[2];
+    std::vector<std::vector<float>> filled( block_total );
+    block_majorant.assign( block_total, 0 );
+    parallel_for( 0, static_cast<long long>(block_total), [&]( long long index ) {
+        int b[3] = { static_cast<int>( index % blocks[0] ), static_cast<int>( index / blocks[0] % blocks[1] ),
+                     static_cast<int>( index / blocks[0] / blocks[1] ) };
+        std::vector<float> values( block_voxels, 0 );
+        float largest = 0;
+        for ( int z = 0; z < block_size; ++z ) {
+            for ( int y = 0; y < block_size; ++y ) {
+                for ( int x = 0; x < block_size; ++x ) {
+                    int v[3] = { b[0]*block_size + x, b[1]*block_size + y, b[2]*block_size + z };
+                    if ( v[0] >= cells[0] || v[1] >= cells[1] || v[2] >= cells[2] )
+                        continue;
+                    point3 center = box.min() + vec3( (v[0] + 0.5) * voxel_size.x(), (v[1] + 0.5) * voxel_size.y(),
+                                                      (v[2] + 0.5) * voxel_size.z() );
+                    float d = static_cast<float>( clamp(density(center), 0.0, 1.0) );
+                    values[(z * block_size + y) * block_size + x] = d;
+                    largest = std::max( largest, d );
+                }
+            }
+        }
+        block_majorant[index] = largest;
+        if ( largest > 0 )
+            filled[index].swap( values );
+    }, threads );
+
+    block_slot.assign( block_total, -1 );
+    for ( size_t index = 0; index < block_total; ++index ) {
+        if ( filled[index].empty() )
+            continue;
+        block_slot[index] = static_cast<int32_t>( voxels.size() / block_voxels );
+        voxels.insert( voxels.end(), filled[index].begin(), filled[index].end() );
+    }
+    voxels.shrink_to_fit();
+}
+
+double grid_medium::sigma_at( const point3& p ) const {
+    int v[3], b[3];
+    for ( int a = 0; a < 3; ++a ) {
+        v[a] = static_cast<int>( (p[a] - bounds.min()[a]) / voxel_size[a] );
+        v[a] = v[a] < 0 ? 0 : v[a] >= cells[a] ? cells[a] - 1 : v[a];
+        b[a] = v[a] / block_size;
+    }
+    int32_t slot = block_slot[ block_of(b) ];
+    if ( slot < 0 )
+        return 0;
+    int local = ( (v[2] % block_size) * block_size + v[1] % block_size ) * block_size + v[0] % block_size;
+    return sigma * voxels[ static_cast<size_t>(slot) * block_voxels + local ];
+}
+
+bool grid_medium::sample_collision( const ray& r, double t_min, double t_max, double& t ) const {
+    const point3 origin = r.origin();
+    const vec3 d = r.direction();
+    const vec3 inv_dir( 1/d.x(), 1/d.y(), 1/d.z() );
+    double t_enter;
+    if ( !bounds.hit(origin, inv_dir, t_min, t_max, t_enter) )
+        return false;
+    // bounds.hit only tells us where the ray goes in, so work out where it comes out.
+    double t_exit = t_max;
+    for ( int a = 0; a < 3; ++a ) {
+        double far = ( (inv_dir[a] < 0 ? bounds.min()[a] : bounds.max()[a]) - origin[a] ) * inv_dir[a];
+        t_exit = fmin( t_exit, far );
+    }
+
+    // Walk the blocks along the ray (Amanatides & Woo): which block we
+    //      start in, and at which t we cross into the next one on each axis.
+    const double length = d.length();
+    int b[3], step[3];
+    double t_next[3], t_delta[3];
+    point3 start = r.at( t_enter );
+    for ( int a = 0; a < 3; ++a ) {
+        b[a] = static_cast<int>( (start[a] - bounds.min()[a]) / block_extent[a] );
+        b[a] = b[a] < 0 ? 0 : b[a] >= blocks[a] ? blocks[a] - 1 : b[a];
+        if ( d[a] == 0 ) {
+            step[a] = 0;
+            t_next[a] = t_delta[a] = infinity;
+            continue;
+        }
+        step[a] = d[a] > 0 ? 1 : -1;
+        double edge = bounds.min()[a] + (b[a] + (step[a] > 0)) * block_extent[a];
+        t_next[a] = (edge - origin[a]) * inv_dir[a];
+        t_delta[a] = block_extent[a] * fabs( inv_dir[a] );
+    }
+
+    double t_here = t_enter;
+    while ( t_here < t_exit ) {
+        int axis = t_next[0] < t_next[1] ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+        double t_block_end = fmin( t_next[axis], t_exit );
+
+        double majorant = sigma * block_majorant[ block_of(b) ] * length;
+        if ( majorant > 0 ) {
+            double s = t_here;
+            while ( true ) {
+                s -= log( 1 - random_double() ) / majorant;
+                if ( s >= t_block_end )
+                    break;
+                // A real particle, or an imaginary one?
+                if ( random_double() * majorant < sigma_at(r.at(s)) * length ) {
+                    t = s;
+                    return true;
+                }
+            }
+        }
+
+        t_here = t_block_end;
+        b[axis] += step[axis];
+        if ( b[axis] < 0 || b[axis] >= blocks[axis] )
+            break;
+        t_next[axis] += t_delta[axis];
+    }
+    return false;
+}
+
+bool grid_medium::hit( const ray& r, double t_min, double t_max, hit_record& rec ) const {
+    double t;
+    if ( !sample_collision(r, t_min, t_max, t) )
+        return false;
+    rec.t = t;
+    rec.p = r.at( t );
+    rec.normal = vec3( 1, 0, 0 );  // arbitrary
+    rec.front_face = true;
+    rec.u = rec.v = 0;
+    rec.mat_ptr = &phase_function;
+    return true;
+}
@@ -0,0 +1,85 @@
+// grid_medium.h
+// Smoke whose thickness changes from place to place, stored as a grid of
+//      little cubes ("voxels"), each with its own density.
+//
+// Finding where a ray hits a particle: "delta tracking". Pretend the smoke
+//      is as thick everywhere as its thickest spot (the "majorant"), pick a
+//      spot the way constant_medium does, and then keep it with probability
+//      (real density there) / (majorant)- otherwise it was an imaginary
+//      particle, so carry on from there and pick again. That's exact, not an
+//      approximation, and it never steps along the ray in fixed steps.
+//
+// One majorant for the whole grid would make thin parts slow (lots of
+//      imaginary particles), so the grid is split into 8x8x8 voxel blocks,
+//      each with its own majorant, and the ray walks from block to block.
+//      Empty blocks have a majorant of zero and are crossed in one step.
+//      Empty blocks also aren't stored at all: memory only goes to blocks
+//      with some smoke in them.
+
+# ifndef GRID_MEDIUM_H
+# define GRID_MEDIUM_H
+
+# include "rtweekend.h"
+
+# include "aabb.h"
+# include "hittable.h"
+# include "material.h"
+# include "parallel.h"
+
+# include <functional>
+# include <vector>
+
+class grid_medium : public hittable {
+    public:
+        // Fills "box" with voxels, "resolution" of them along its longest
+        //      side, each with density(its center) x sigma. density() should
+        //      give values from 0 to 1; sigma is how thick 1 is, in particles
+        //      hit per unit of distance.
+        grid_medium( const aabb& box, int resolution, const std::function<double(const point3&)>& density,
+                     double sigma, const color& albedo, int threads = 0 );
+
+        virtual bool hit( const ray& r, double t_min, double t_max, hit_record& rec ) const override;
+
+        virtual bool bounding_box( double time0, double time1, aabb& output_box ) const override {
+            output_box = bounds;
+            return true;
+        }
+
+        // Delta tracking: where along r, in [t_min, t_max], it first hits a
+        //      particle. False if it gets through.
+        bool sample_collision( const ray& r, double t_min, double t_max, double& t ) const;
+
+        // The density (times sigma) of the voxel that p is in.
+        double sigma_at( const point3& p ) const;
+
+        size_t memory_bytes() const {
+            return block_slot.capacity() * sizeof(int32_t) + block_majorant.capacity() * sizeof(float)
+                 + voxels.capacity() * sizeof(float);
+        }
+        // What the same grid would take with every voxel stored.
+        size_t dense_bytes() const {
+            return static_cast<size_t>(cells[0]) * cells[1] * cells[2] * sizeof(float);
+        }
+        size_t blocks_stored() const { return voxels.size() / block_voxels; }
+
+    private:
+        static const int block_size = 8;
+        static const int block_voxels = block_size * block_size * block_size;
+
+        int block_of( const int b[3] ) const { return (b[2] * blocks[1] + b[1]) * blocks[0] + b[0]; }
+
+    private:
+        aabb bounds;
+        double sigma;
+        int cells[3];          // voxels along each axis
+        int blocks[3];         // blocks along each axis
+        vec3 voxel_size;
+        vec3 block_extent;
+        std::vector<int32_t> block_slot;      // where each block's voxels are in "voxels", or -1 if empty
+        std::vector<float> block_majorant;    // each block's largest density
+        std::vector<float> voxels;            // the non-empty blocks, one after another
+        material phase_function;
+};
+
+
+# endif
@@ -0,0 +1,262 @@
+// guiding.cpp
+// Sampling from, recording into and refining the SD-tree (see guiding.h).
+
+# include "guiding.h"
+
+using namespace std ;
+
+
+// Which quarter of "node" (u,v) falls in, going down until the quarter
+//      isn't split any further. u and v come out relative to that quarter.
+int guide_field::quadtree::leaf_quarter( double& u, double& v, uint32_t& node ) const {
+    node = 0;
+    while ( true ) {
+        int qu = u >= 0.5, qv = v >= 0.5;
+        int q = qu + 2*qv;
+        u = 2*u - qu;
+        v = 2*v - qv;
+        if ( nodes[node].child[q] == 0 )
+            return q;
+        node = nodes[node].child[q];
+    }
+}
+
+void guide_field::quadtree::sample( double& u, double& v ) const {
+    double x = 0, y = 0, size = 1;
+    uint32_t node = 0;
+    while ( true ) {
+        const double* e = nodes[node].energy;
+        double pick = random_double() * (e[0] + e[1] + e[2] + e[3]);
+        int q = 0;
+        while ( q < 3 && (pick -= e[q]) >= 0 )
+            ++q;
+        while ( q > 0 && e[q] == 0 )      // rounding can land on an empty quarter
+            --q;
+        size *= 0.5;
+        x += size * (q & 1);
+        y += size * (q >> 1);
+        if ( nodes[node].child[q] == 0 )
+            break;
+        node = nodes[node].child[q];
+    }
+    u = x + size * random_double();
+    v = y + size * random_double();
+}
+
+// Per unit area of the square.
+double guide_field::quadtree::pdf( double u, double v ) const {
+    double p = 1;
+    uint32_t node = 0;
+    while ( true ) {
+        const double* e = nodes[node].energy;
+        int qu = u >= 0.5, qv = v >= 0.5;
+        int q = qu + 2*qv;
+        p *= 4 * e[q] / (e[0] + e[1] + e[2] + e[3]);
+        if ( p == 0 || nodes[node].child[q] == 0 )
+            return p;
+        u = 2*u - qu;
+        v = 2*v - qv;
+        node = nodes[node].child[q];
+    }
+}
+
+void guide_field::leaf::start_building( quadtree shape ) {
+    building = std::move( shape );
+    recorded.reset( new std::atomic<uint64_t>[4 * building.nodes.size()]() );
+    paths = 0;
+}
+
+
+guide_field::guide_field( const aabb& bounds ) {
+    space.push_back( space_node{ bounds, 0, 0, 0 } );
+    leaves.emplace_back( new leaf() );
+
+    // Start every region's quadtree three levels deep, so the first pass
+    //      already has 64 directions to tell apart.
+    quadtree start;
+    for ( size_t n = 0; n < 1 + 4; ++n ) {
+        for ( int q = 0; q < 4; ++q ) {
+            start.nodes[n].child[q] = static_cast<uint32_t>( start.nodes.size() );
+            start.nodes.push_back( quad_node() );
+        }
+    }
+    leaves[0]->start_building( start );
+}
+
+guide_field::leaf& guide_field::find( const point3& p ) const {
+    uint32_t n = 0;
+    while ( space[n].child != 0 ) {
+        int axis = space[n].depth % 3;
+        double middle = 0.5 * (space[n].box.min()[axis] + space[n].box.max()[axis]);
+        n = space[n].child + (p[axis] >= middle);
+    }
+    return *leaves[ space[n].region ];
+}
+
+// Directions to the unit square and back: u is the height (the y of the
+//      direction, from -1 to 1), v the angle around the y axis. Equal areas
+//      of the square are equal solid angles, so a density per unit of the
+//      square is 4 pi times one per steradian.
+void guide_field::to_square( const vec3& dir, double& u, double& v ) {
+    u = clamp( 0.5 * (dir.y() + 1), 0.0, 1.0 );
+    double phi = atan2( dir.z(), dir.x() );
+    v = clamp( (phi + pi) / (2*pi), 0.0, 1.0 );
+}
+
+vec3 guide_field::from_square( double u, double v ) {
+    double y = 2*u - 1;
+    double r = sqrt( fmax(0.0, 1 - y*y) );
+    double phi = 2*pi*v - pi;
+    return vec3( r * cos(phi), y, r * sin(phi) );
+}
+
+bool guide_field::scatter( const lambertian& m, const hit_record& rec, color& attenuation, ray& scattered,
+                           double& pdf ) const {
+    color albedo = m.tex ? m.tex->value(rec.u, rec.v, rec.p, rec.texture_width()) : m.albedo;
+
+    // Untrained: exactly lambertian::scatter.
+    if ( refinements == 0 ) {
+        auto direction = rec.normal + random_unit_vector();
+        if ( direction.near_zero() )
+            direction = rec.normal;
+        scattered = ray( rec.p, direction );
+        attenuation = albedo;
+        pdf = fmax( dot(unit_vector(direction), rec.normal), 0.0 ) / pi;
+        return true;
+    }
+
+    // A region no light has reached yet has nothing to guide by, so it
+    //      samples the cosine only, just like an untrained one.
+    const quadtree& guide = find( rec.p ).guide;
+    const bool guided = guide.total() > 0;
+    vec3 direction;
+    if ( guided && random_double() < 0.5 ) {
+        double u, v;
+        guide.sample( u, v );
+        direction = from_square( u, v );
+    } else {
+        direction = rec.normal + random_unit_vector();
+        direction = direction.near_zero() ? rec.normal : unit_vector( direction );
+    }
+
+    // Below the surface a diffuse surface reflects nothing: the path ends.
+    double cosine = dot( direction, rec.normal );
+    if ( cosine <= 0 )
+        return false;
+    pdf = cosine / pi;
+    if ( guided ) {
+        double u, v;
+        to_square( direction, u, v );
+        pdf = 0.5 * guide.pdf(u, v) / (4*pi) + 0.5 * pdf;
+    }
+    scattered = ray( rec.p, direction );
+    attenuation = albedo * (cosine / pi / pdf);
+    return true;
+}
+
+void guide_field::record_path( const guide_vertex* vertices, int count, const color& light ) {
+    for ( int k = 0; k < count; ++k ) {
+        const guide_vertex& g = vertices[k];
+        double arrived = 0;
+        for ( int c = 0; c < 3; ++c )
+            if ( g.throughput[c] > 0 )
+                arrived += light[c] / g.throughput[c];
+        double estimate = fmin( arrived / 3 / g.pdf, 1e6 );
+        if ( !(estimate > 0) )
+            continue;
+
+        leaf& region = find( g.p );
+        double u, v;
+        uint32_t node;
+        to_square( unit_vector(g.direction), u, v );
+        int q = region.building.leaf_quarter( u, v, node );
+        region.recorded[4*node + q] += static_cast<uint64_t>( estimate * fixed_point + 0.5 );
+        ++region.paths;
+    }
+}
+
+// The next building tree: the finished one, with every quarter that got
+//      more than its share of the light split once more.
+guide_field::quadtree guide_field::grow( const quadtree& finished ) const {
+    quadtree next;
+    double total = finished.total();
+
+    // (old node, new node, depth) still to copy.
+    struct step { uint32_t from, to; int depth; };
+    std::vector<step> todo = { step{ 0, 0, 1 } };
+    while ( !todo.empty() ) {
+        step s = todo.back();
+        todo.pop_back();
+        for ( int q = 0; q < 4; ++q ) {
+            if ( finished.nodes[s.from].energy[q] <= split_share * total || s.depth >= max_quad_depth )
+                continue;
+            uint32_t child = static_cast<uint32_t>( next.nodes.size() );
+            next.nodes.push_back( quad_node() );
+            next.nodes[s.to].child[q] = child;
+            if ( finished.nodes[s.from].child[q] != 0 )
+                todo.push_back( step{ finished.nodes[s.from].child[q], child, s.depth + 1 } );
+        }
+    }
+    return next;
+}
+
+void guide_field::refine() {
+    ++refinements;
+
+    // 1. The light each region recorded becomes its guide. Children come
+    //      after their parents, so going backwards adds up each quarter's
+    //      light before its parent needs it. A region no light reached
+    //      keeps what it knew.
+    for ( auto& region : leaves ) {
+        quadtree& b = region->building;
+        for ( size_t n = b.nodes.size(); n-- > 0; ) {
+            for ( int q = 0; q < 4; ++q ) {
+                double e = region->recorded[4*n + q] / fixed_point;
+                if ( uint32_t c = b.nodes[n].child[q] )
+                    e = b.nodes[c].energy[0] + b.nodes[c].energy[1] + b.nodes[c].energy[2] + b.nodes[c].energy[3];
+                b.nodes[n].energy[q] = e;
+            }
+        }
+        if ( b.total() > 0 )
+            region->guide = b;
+    }
+
+    // 2. Regions that many paths went through are split in half (and the
+    //      halves again, as long as they'd still have more than their
+    //      share), each half starting with a copy of what the whole knew.
+    const double threshold = split_paths * sqrt( pow(2.0, refinements) );
+    std::vector<std::pair<uint32_t, double>> todo;
+    for ( uint32_t n = 0; n < space.size(); ++n )
+        if ( space[n].child == 0 )
+            todo.push_back( { n, double(leaves[space[n].region]->paths) } );
+    while ( !todo.empty() ) {
+        auto [n, paths] = todo.back();
+        todo.pop_back();
+        if ( paths <= threshold || space[n].depth >= max_space_depth )
+            continue;
+
+        int axis = space[n].depth % 3;
+        point3 lo = space[n].box.min(), hi = space[n].box.max();
+        double middle = 0.5 * (lo[axis] + hi[axis]);
+        point3 lo_hi = hi, hi_lo = lo;
+        lo_hi[axis] = middle;
+        hi_lo[axis] = middle;
+
+        uint32_t first = static_cast<uint32_t>( space.size() );
+        uint32_t old_region = space[n].region;
+        uint32_t new_region = static_cast<uint32_t>( leaves.size() );
+        leaves.emplace_back( new leaf() );
+        leaves[new_region]->guide = leaves[old_region]->guide;
+        leaves[new_region]->building = leaves[old_region]->building;
+        space[n].child = first;
+        space.push_back( space_node{ aabb(lo, lo_hi), space[n].depth + 1, 0, old_region } );
+        space.push_back( space_node{ aabb(hi_lo, hi), space[first].depth, 0, new_region } );
+        todo.push_back( { first, paths / 2 } );
+        todo.push_back( { first + 1, paths / 2 } );
+    }
+
+    // 3. Start building again, with each region's quadtree grown from its
+    //      guide (or, if it hasn't got one yet, the same shape as before).
+    for ( auto& region : leaves )
+        region->start_building( region->guide.total() > 0 ? grow(region->guide) : region->building );
+}
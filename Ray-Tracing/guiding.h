@@ -0,0 +1,145 @@
+// guiding.h
+// Path guiding: learning where light comes from, so diffuse bounces can
+//      aim there. lambertian::scatter picks a direction around the normal
+//      without knowing anything about the scene, which is fine under an open
+//      sky but hopeless in a room lit through a small window: almost every
+//      bounce goes somewhere dark, and the few that find the window make
+//      the noise. A guide_field remembers, for every region of the scene,
+//      how much light arrived from each direction, and a diffuse bounce
+//      picks its direction half the time from that and half the time the
+//      usual way. (This is "practical path guiding", Müller et al. 2017.)
+//
+// What it remembers is an "SD-tree":
+//      - a spatial tree: a box around the scene, split in half again and
+//        again (x, then y, then z) wherever many paths went through, and
+//      - in each of its leaves, a directional quadtree: every direction is
+//        a point of the unit square (the height of the direction, and the
+//        angle around the vertical), and the square is split into quarters,
+//        and those into quarters, wherever much light came from. Each
+//        quarter knows how much light came through it, so picking one by
+//        its share and then a point in it follows the light.
+//
+// The guide learns in passes. While a pass renders, paths add what they
+//      find to the "building" trees; refine() then makes those what
+//      sample() draws from, splits the spatial leaves that saw many paths
+//      and the quarters that saw much light, and starts building afresh.
+//      sample() and pdf() only ever look at the finished trees, and the
+//      light is added up as whole numbers, so what a pass learns doesn't
+//      depend on which thread rendered what, and pictures come out the same
+//      for any thread count. The guide belongs to the world, not to one
+//      picture: once trained it can be used (and go on learning) for any
+//      number of frames from any camera.
+//
+// Every sample stays unbiased- a direction's weight is divided by the
+//      chance of picking it either way- so a guided picture converges to
+//      the same answer, just with less noise where the light is hard to
+//      find. Only the recursive ray_color loop is guided; the wavefront
+//      integrator ignores a guide.
+
+# ifndef GUIDING_H
+# define GUIDING_H
+
+# include "rtweekend.h"
+
+# include "aabb.h"
+# include "hittable.h"
+# include "material.h"
+
+# include <atomic>
+# include <memory>
+# include <vector>
+
+// One diffuse bounce of a path, kept until the path finds light (or doesn't).
+struct guide_vertex {
+    point3 p;
+    vec3 direction;        // where the path went from here
+    color throughput;      // the path's throughput just after this bounce
+    double pdf;            // chance (per steradian) of picking that direction
+};
+
+class guide_field {
+    public:
+        // Guides paths inside "bounds". Points outside it use the nearest
+        //      region inside.
+        explicit guide_field( const aabb& bounds );
+
+        guide_field( const guide_field& ) = delete;
+        guide_field& operator=( const guide_field& ) = delete;
+
+        // A diffuse bounce off "m": half the time a direction from the
+        //      guide, half the time lambertian's own, weighted by the chance
+        //      of picking it either way. Until the first refine() it's just
+        //      lambertian's. Sets "pdf" to that chance.
+        bool scatter( const lambertian& m, const hit_record& rec, color& attenuation, ray& scattered,
+                      double& pdf ) const;
+
+        // Credits "light", found at the end of a path, to each of the path's
+        //      diffuse bounces: what arrived at bounce k is the light over
+        //      the throughput the path had just after it.
+        void record_path( const guide_vertex* vertices, int count, const color& light );
+
+        // Ends a pass: see above.
+        void refine();
+
+        int passes() const { return refinements; }
+        size_t regions() const { return leaves.size(); }
+
+        // The most diffuse bounces of one path that get recorded.
+        static const int max_vertices = 32;
+
+    private:
+        // The directional quadtree. Node 0 is the whole square; a quarter
+        //      with child 0 isn't split.
+        struct quad_node {
+            uint32_t child[4] = { 0, 0, 0, 0 };
+            double energy[4] = { 0, 0, 0, 0 };
+        };
+        struct quadtree {
+            std::vector<quad_node> nodes = std::vector<quad_node>( 1 );
+
+            double total() const { const auto& e = nodes[0].energy; return e[0] + e[1] + e[2] + e[3]; }
+            int leaf_quarter( double& u, double& v, uint32_t& node ) const;
+            void sample( double& u, double& v ) const;
+            double pdf( double u, double v ) const;
+        };
+
+        // One spatial region: the finished quadtree, and the one being built
+        //      (whose light is added up in "recorded", one counter per quarter).
+        struct leaf {
+            quadtree guide;
+            quadtree building;
+            std::unique_ptr<std::atomic<uint64_t>[]> recorded;
+            std::atomic<uint64_t> paths{ 0 };
+
+            void start_building( quadtree shape );
+        };
+
+        // The spatial tree. An inside node splits its box in half along
+        //      "axis" (its depth, mod 3); a leaf points at its region.
+        struct space_node {
+            aabb box;
+            int depth = 0;
+            uint32_t child = 0;     // inside: first of two children; leaf: 0
+            uint32_t region = 0;    // leaf: index into "leaves"
+        };
+
+        leaf& find( const point3& p ) const;
+
+        static void to_square( const vec3& dir, double& u, double& v );
+        static vec3 from_square( double u, double v );
+        quadtree grow( const quadtree& finished ) const;
+
+    private:
+        std::vector<space_node> space;
+        std::vector<std::unique_ptr<leaf>> leaves;
+        int refinements = 0;
+
+        static constexpr double fixed_point = 1024;     // light is added up in 1/1024ths
+        static constexpr double split_share = 0.01;     // split quarters with more of the light than this
+        static const int max_quad_depth = 16;
+        static const int max_space_depth = 24;
+        static const uint64_t split_paths = 60;        // split regions that see this many paths (x sqrt(2^pass))
+};
+
+
+# endif
@@ -7,6 +7,8 @@
 
 # include "rtweekend.h"
 
+# include "aabb.h"
+
 class material;
 
 struct hit_record {
@@ -22,9 +24,17 @@ struct hit_record {
     //      https://link.springer.com/content/pdf/10.1007%2F978-1-4842-4427-2_2.pdf
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
+    const material* mat_ptr;    // owned by the hittable, so no need to share it
     double t;
+    double u;       // where on the surface we are, for textures:
+    double v;       //      both run from 0 to 1 across the surface
     bool front_face;
+    double uv_length = 0;   // how far u runs from 0 to 1, in world units (0: unknown)
+    double footprint = 0;   // how wide one pixel is at p, in world units (the integrator sets this)
+
+    // How much of a texture, as a fraction of u's range, one sample here
+    //      covers. Image textures use it to pick a mip level.
+    double texture_width() const { return uv_length > 0 ? footprint / uv_length : 0; }
 
     // This determines the normal direction of a ray, considering things like material. 
     // Glass, for instance, is transparent, and therefore a ray will pass through it 
@@ -40,7 +50,28 @@ struct hit_record {
 // Establishes the conditions for if a ray hits a sphere, and then defaults it to "no".
 class hittable {
     public:
+        virtual ~hittable() = default;
+
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+
+        // Sets "output_box" to a box around everything this hittable could be
+        //      between the times time0 and time1. Returns false if there's no
+        //      such box (an infinite plane, say).
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
+
+        // Some hittables are really many separate things (a sphere_collection
+        //      is lots of spheres). They can list their parts, so that a BVH
+        //      can sort the parts one by one instead of treating the whole
+        //      thing as one big box. By default a hittable is one part.
+        virtual size_t parts() const { return 1; }
+
+        virtual bool part_bounding_box(size_t part, aabb& output_box) const {
+            return bounding_box(0, 0, output_box);
+        }
+
+        virtual bool hit_part(size_t part, const ray& r, double t_min, double t_max, hit_record& rec) const {
+            return hit(r, t_min, t_max, rec);
+        }
 };
 
 
@@ -29,28 +29,14 @@ class hittable_list : public hittable  {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        // A box around every object in the list, if they all have one
+        virtual bool bounding_box(
+            double time0, double time1, aabb& output_box) const override;
+
     // The items in the list 
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
 
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    hit_record temp_rec;
-    auto hit_anything = false;
-    auto closest_so_far = t_max;
-
-    // Checks if an item in our list of hittables was struck by a ray, and records it
-    for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
-            hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
-        }
-    }
-
-    return hit_anything;
-}
-
-
-# endif
\ No newline at end of file
+# endif
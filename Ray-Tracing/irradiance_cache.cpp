@@ -0,0 +1,308 @@
+// irradiance_cache.cpp
+// Making, storing and blending irradiance records, and rendering with them
+//      (see irradiance_cache.h).
+
+# include "irradiance_cache.h"
+
+using namespace std ;
+
+
+// The sample number the fill passes seed their pixels with, so they never
+//      share random numbers with a real sample of the same pixel.
+static const uint64_t fill_sample = ~uint64_t(0);
+
+// The coarsest fill pass looks at every 16th pixel (each way).
+static const int coarsest_stride = 16;
+
+
+irradiance_cache::irradiance_cache( const irradiance_settings& s, size_t bucket_count ) : settings(s) {
+    size_t n = 1;
+    while ( n < bucket_count )
+        n *= 2;
+    bucket_mask = n - 1;
+    buckets.reset( new std::atomic<cell_entry*>[n]() );
+}
+
+irradiance_cache::~irradiance_cache() {
+    record* r = made.load();
+    while ( r ) {
+        record* next = r->next_made;
+        delete r;
+        r = next;
+    }
+}
+
+uint64_t irradiance_cache::cell_key( int grid, int side, long long x, long long y, long long z ) {
+    return mix_bits( uint64_t(8*grid + side) ^ mix_bits( uint64_t(x) ^ mix_bits( uint64_t(y) ^ mix_bits(uint64_t(z)) ) ) );
+}
+
+// Which way a normal mostly points: +x, -x, +y, -y, +z or -z.
+static int normal_side( const vec3& n ) {
+    int a = 0;
+    for ( int b = 1; b < 3; ++b )
+        if ( fabs(n[b]) > fabs(n[a]) )
+            a = b;
+    return 2*a + (n[a] < 0);
+}
+
+// Ward's weight, less its value at the edge, so a record fades out instead
+//      of stopping dead: the further away and the more differently turned,
+//      the less a record counts. A record in front of p (between it and
+//      whatever is shading it) saw less than p does, and isn't used at all.
+double irradiance_cache::weight( const record& r, const point3& p, const vec3& normal ) const {
+    vec3 d = p - r.p;
+    double facing = dot( normal, r.normal );
+    if ( facing <= 0 || dot(d, normal + r.normal) < -0.1 * r.reach )
+        return 0;
+    double e = settings.error * d.length() / r.reach + sqrt( fmax(0.0, 1 - facing) );
+    return fmax( 0.0, 1 / fmax(e, 1e-6) - 1 / settings.error );
+}
+
+template <typename Visit>
+void irradiance_cache::find( const point3& p, const vec3& normal, double length, Visit visit ) const {
+    // Only the grids of records made about as far from the camera as p is:
+    //      one whose reach was limited for a pixel's width much bigger or
+    //      smaller than p's isn't used. Far away, a pixel covers a lot.
+    double footprint = pixel * length;
+    int first = max( ilogb(settings.min_pixels * footprint) + grid_offset - 1, 0 );
+    int last = min( ilogb(settings.max_pixels * footprint) + grid_offset + 1, grid_count - 1 );
+    int side = normal_side( normal );
+    uint64_t used = grids_used.load( std::memory_order_acquire );
+    for ( int g = first; g <= last; ++g ) {
+        if ( !(used >> g & 1) )
+            continue;
+        double size = cell_size( g );
+        uint64_t key = cell_key( g, side, static_cast<long long>( floor(p.x() / size) ),
+                                    static_cast<long long>( floor(p.y() / size) ),
+                                    static_cast<long long>( floor(p.z() / size) ) );
+        for ( const cell_entry* e = buckets[key & bucket_mask].load(std::memory_order_acquire); e; e = e->next )
+            if ( e->cell == key )
+                visit( *e->r );
+    }
+}
+
+bool irradiance_cache::covered( const point3& p, const vec3& normal, double length, uint64_t before ) const {
+    bool found = false;
+    find( p, normal, length, [&]( const record& r ) {
+        if ( !found && r.order < before && weight(r, p, normal) > 0 )
+            found = true;
+    } );
+    return found;
+}
+
+bool irradiance_cache::interpolate( const point3& p, const vec3& normal, double length, color& irradiance ) const {
+    // Records go into the table in whatever order the threads made them,
+    //      so they're put back in the order of their passes and pixels
+    //      before being added up; otherwise rounding would make the picture
+    //      depend on thread timing.
+    thread_local std::vector<std::pair<uint64_t, std::pair<double, const record*>>> near;
+    near.clear();
+    find( p, normal, length, [&]( const record& r ) {
+        double w = weight( r, p, normal );
+        if ( w > 0 )
+            near.push_back( { r.order, { w, &r } } );
+    } );
+    if ( near.empty() ) {
+        ++missed;
+        return false;
+    }
+
+    sort( near.begin(), near.end(), []( const auto& a, const auto& b ) { return a.first < b.first; } );
+    color sum( 0, 0, 0 );
+    double total = 0;
+    for ( const auto& n : near ) {
+        sum += n.second.first * n.second.second->irradiance;
+        total += n.second.first;
+    }
+    irradiance = sum / total;
+    return true;
+}
+
+color irradiance_cache::compute( const hittable& world, const point3& p, const vec3& normal, double& distance ) const {
+    color sum( 0, 0, 0 );
+    double inverse_distance = 0;
+    for ( int k = 0; k < settings.rays; ++k ) {
+        vec3 direction = normal + random_unit_vector();
+        if ( direction.near_zero() )
+            direction = normal;
+        // The hit gives the distance, and is where the path starts too.
+        ray r( p, direction );
+        release_geometry();
+        hit_record rec;
+        bool hit = world.hit( r, 0.001, infinity, rec );
+        if ( hit )
+            inverse_distance += 1 / ( rec.t * direction.length() );
+        sum += ray_color( r, hit ? &rec : nullptr, world, settings.paths );
+    }
+
+    distance = inverse_distance > 0 ? settings.rays / inverse_distance : infinity;
+    return sum / settings.rays;
+}
+
+void irradiance_cache::insert( record* r ) {
+    // The grid whose cells are between half the record's reach and all
+    //      of it, and every cell of it the record reaches into.
+    int g = clamp( ilogb(r->reach) + grid_offset, 0, grid_count - 1 );
+    double size = cell_size( g );
+    long long lo[3], hi[3];
+    for ( int a = 0; a < 3; ++a ) {
+        lo[a] = static_cast<long long>( floor( (r->p[a] - r->reach) / size ) );
+        hi[a] = static_cast<long long>( floor( (r->p[a] + r->reach) / size ) );
+    }
+
+    // Points only use records that face about the same way, so cells are
+    //      kept apart by which way the normal mostly points- otherwise a
+    //      point on a small sphere would wade through every record on the
+    //      ground below it. A record goes on every side a normal it can
+    //      still be used by could point to: turning a normal by an angle
+    //      changes each of its components by less than that angle.
+    double turn = acos( 1 - settings.error * settings.error );
+    double largest = fmax( fabs(r->normal.x()), fmax( fabs(r->normal.y()), fabs(r->normal.z()) ) );
+    for ( int side = 0; side < 6; ++side ) {
+        double along = side % 2 ? -r->normal[side / 2] : r->normal[side / 2];
+        if ( along + turn < largest - turn )
+            continue;
+        for ( long long x = lo[0]; x <= hi[0]; ++x )
+            for ( long long y = lo[1]; y <= hi[1]; ++y )
+                for ( long long z = lo[2]; z <= hi[2]; ++z )
+                    r->entries.push_back( cell_entry{ r, cell_key(g, side, x, y, z), nullptr } );
+    }
+
+    // Published once it's complete: a reader that finds an entry sees the
+    //      whole record.
+    for ( auto& e : r->entries ) {
+        std::atomic<cell_entry*>& head = buckets[e.cell & bucket_mask];
+        e.next = head.load( std::memory_order_relaxed );
+        while ( !head.compare_exchange_weak(e.next, &e, std::memory_order_release, std::memory_order_relaxed) )
+            ;
+    }
+    grids_used.fetch_or( uint64_t(1) << g, std::memory_order_release );
+    r->next_made = made.load( std::memory_order_relaxed );
+    while ( !made.compare_exchange_weak(r->next_made, r, std::memory_order_release, std::memory_order_relaxed) )
+        ;
+    ++record_count;
+}
+
+
+// Follows r through glass, metal and fog to the first diffuse surface, and
+//      returns it (with rec, the path's throughput so far and how far it
+//      went), or nullptr with the path's light in "done" if it never gets
+//      to one.
+static const lambertian* first_diffuse( const ray& r, const hittable& world, int max_depth,
+                                        hit_record& rec, color& throughput, double& length, color& done ) {
+    ray current = r;
+    throughput = color( 1, 1, 1 );
+    length = 0;
+    medium_stack media;
+    done = color( 0, 0, 0 );
+    for ( int bounce = 0; bounce < max_depth; ++bounce ) {
+        if ( !world.hit(current, 0.001, infinity, rec) ) {
+            done = throughput * sky_color( current );
+            return nullptr;
+        }
+        double distance = rec.t * current.direction().length();
+        length += distance;
+        media.absorb( distance, throughput );
+        if ( const lambertian* diffuse = std::get_if<lambertian>( &rec.mat_ptr->bsdf ) )
+            return diffuse;
+
+        ray scattered;
+        color attenuation;
+        if ( !rec.mat_ptr->scatter(current, rec, attenuation, scattered, media) )
+            return nullptr;
+        throughput = throughput * attenuation;
+        current = scattered;
+    }
+    return nullptr;
+}
+
+void irradiance_cache::fill( const hittable& world, const camera& cam, int image_width, int image_height,
+                             uint64_t seed, int threads ) {
+    // Pass 0 looks at every 16th pixel, pass 1 at the ones in between that
+    //      are on the 8 pixel grid, and so on down to every pixel. A pass
+    //      only asks whether an earlier pass's records cover a point, so
+    //      what it makes doesn't depend on which thread got there first.
+    pixel = cam.pixel_angle( image_height );
+    int pass = 0;
+    for ( int stride = coarsest_stride; stride >= 1; stride /= 2, ++pass ) {
+        const uint64_t before = uint64_t(pass) << 40;
+        long long rows = (image_height + stride - 1) / stride;
+        parallel_for( 0, rows, [&]( long long row ) {
+            int j = static_cast<int>( row ) * stride;
+            for ( int i = 0; i < image_width; i += stride ) {
+                if ( stride < coarsest_stride && i % (2*stride) == 0 && j % (2*stride) == 0 )
+                    continue;     // an earlier pass's pixel
+
+                uint64_t index = static_cast<uint64_t>( j ) * image_width + i;
+                seed_sample( seed, index, fill_sample );
+                release_geometry();
+                hit_record rec;
+                color throughput, done;
+                double length;
+                ray r = cam.get_ray( (i + 0.5) / (image_width - 1), (j + 0.5) / (image_height - 1) );
+                if ( !first_diffuse(r, world, settings.paths.max_depth, rec, throughput, length, done) )
+                    continue;
+                point3 p = rec.p;
+                vec3 normal = rec.normal;
+                if ( covered(p, normal, length, before) )
+                    continue;
+
+                double distance;
+                color irradiance = compute( world, p, normal, distance );
+                double footprint = pixel * length;
+                double reach = clamp( settings.error * distance, settings.min_pixels * footprint,
+                                      settings.max_pixels * footprint );
+                insert( new record{ p, normal, irradiance, reach, before | index, nullptr, {} } );
+            }
+        }, threads );
+    }
+    release_geometry();
+}
+
+
+color irradiance_ray_color( const ray& r, const hittable& world, const irradiance_cache& cache ) {
+    release_geometry();
+    hit_record rec;
+    color throughput, done;
+    double length;
+    const lambertian* diffuse = first_diffuse( r, world, cache.settings.paths.max_depth, rec, throughput, length,
+                                               done );
+    if ( !diffuse )
+        return done;
+
+    // The albedo first: working the irradiance out lets go of the geometry
+    //      rec points into (see geometry_cache.h).
+    rec.footprint = cache.settings.paths.pixel_angle * length;
+    color albedo = diffuse->tex ? diffuse->tex->value( rec.u, rec.v, rec.p, rec.texture_width() ) : diffuse->albedo;
+    color irradiance;
+    if ( cache.interpolate(rec.p, rec.normal, length, irradiance) )
+        return throughput * albedo * irradiance;
+
+    // No record: just path trace on from here, as ray_color would.
+    vec3 direction = rec.normal + random_unit_vector();
+    if ( direction.near_zero() )
+        direction = rec.normal;
+    return throughput * albedo * ray_color( ray(rec.p, direction), world, cache.settings.paths );
+}
+
+void render_irradiance( const hittable& world, const camera& cam, uint64_t seed, const irradiance_cache& cache,
+                        const render_region& region, framebuffer& fb, ray_batch& batch ) {
+    const int strip_rows = 16 ;
+    batch.resize( static_cast<size_t>( region.x1 - region.x0 ) * strip_rows ) ;
+
+    for ( int y = region.y0; y < region.y1; y += strip_rows ) {
+        tile area{ region.x0, y, region.x1, min( y + strip_rows, region.y1 ) } ;
+        ray_span rays = batch.span() ;
+        rays.size = area.size() ;
+
+        for ( int s = region.s0; s < region.s1; ++s ) {
+            cam.generate_rays( area, fb.width, fb.height, seed, s, rays ) ;
+            for ( size_t k = 0; k < rays.size; ++k ) {
+                int i = area.x0 + static_cast<int>(k) % area.width() ;
+                int j = area.y0 + static_cast<int>(k) / area.width() ;
+                random_state() = rays.rng[k] ;
+                fb.add_sample( i, j, irradiance_ray_color( rays.get(k), world, cache ) ) ;
+            }
+        }
+    }
+}
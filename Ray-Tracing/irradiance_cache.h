@@ -0,0 +1,146 @@
+// irradiance_cache.h
+// A quick, slightly blurry way to render previews. The light leaving a
+//      diffuse surface is its albedo times the light arriving from the whole
+//      hemisphere above it (the "irradiance"), and irradiance changes slowly
+//      from point to point: across a flat wall it barely changes at all.
+//      So instead of path tracing it again for every sample of every pixel,
+//      we work it out properly at a few scattered points ("records"), each
+//      from a few dozen paths, and for everything in between blend the
+//      nearby records (Ward's irradiance caching).
+//
+// How near is near enough depends on the surroundings: a record remembers
+//      how far away the things it saw were (the harmonic mean of the
+//      distances its paths went before hitting something), and is only used
+//      within "error" times that distance, and only by points facing about
+//      the same way. Open spaces get few records, corners and crevices many.
+//      A smaller "error" means more records: slower, and closer to the true
+//      picture. How far a record reaches is also kept between a few pixels'
+//      width and a few dozen, so a record on a small sphere under an open sky
+//      doesn't spill over onto its neighbours, and a crevice doesn't get a
+//      record for every sample.
+//
+// The records are kept in a hash table of grid cells, with grids of several
+//      sizes (like the levels of an octree): a record goes into every cell it
+//      reaches on the grid whose cells are about as big as its reach, so a
+//      lookup looks at one cell per grid. Threads add records without taking
+//      any lock- each bucket is a linked list whose head is swapped in with a
+//      compare-and-swap- and read them without locks too.
+//
+// Pictures don't depend on thread timing. Records are made before rendering,
+//      in passes over a grid of pixels from coarse to fine (every 16th pixel,
+//      then every 8th, ...): a pixel makes a record if no record from an
+//      earlier pass covers it. Rendering then only reads the finished cache,
+//      and adds up nearby records in the order they were made, not the order
+//      they went into the table. A sample that lands where no record reaches
+//      (past a glass sphere, say) is just path traced on from there.
+
+# ifndef IRRADIANCE_CACHE_H
+# define IRRADIANCE_CACHE_H
+
+# include "rtweekend.h"
+
+# include "camera.h"
+# include "framebuffer.h"
+# include "hittable.h"
+# include "material.h"
+# include "render.h"
+
+# include <atomic>
+# include <memory>
+# include <vector>
+
+struct irradiance_settings {
+    double error = 0.3;          // how far records reach, as a fraction of what they saw
+    int rays = 256;              // paths per record
+    double min_pixels = 2;       // records reach at least this many pixels' width...
+    double max_pixels = 32;      // ... and at most this many
+    path_settings paths;         // how the records' paths are followed
+};
+
+class irradiance_cache {
+    public:
+        explicit irradiance_cache( const irradiance_settings& s = irradiance_settings(),
+                                   size_t buckets = size_t(1) << 20 );
+        ~irradiance_cache();
+
+        irradiance_cache( const irradiance_cache& ) = delete;
+        irradiance_cache& operator=( const irradiance_cache& ) = delete;
+
+        // Makes the records for a view of "world": see above.
+        void fill( const hittable& world, const camera& cam, int image_width, int image_height, uint64_t seed,
+                   int threads = 0 );
+
+        // The irradiance (over pi, so albedo times it is the light leaving a
+        //      diffuse surface) at p, "length" away from the camera along
+        //      the path that got there, blended from the records that reach
+        //      it. False (and counted as a miss) if none do.
+        bool interpolate( const point3& p, const vec3& normal, double length, color& irradiance ) const;
+
+        // Works the irradiance out from scratch, with the current random
+        //      sequence, and the harmonic mean distance of what it saw
+        //      (infinity if it saw nothing).
+        color compute( const hittable& world, const point3& p, const vec3& normal, double& distance ) const;
+
+        size_t size() const { return record_count; }
+        // How many render samples found no record and were path traced.
+        size_t misses() const { return missed; }
+
+    public:
+        irradiance_settings settings;
+
+    private:
+        struct record;
+        struct cell_entry {
+            const record* r;
+            uint64_t cell;           // buckets are shared; this tells the cells apart
+            cell_entry* next;
+        };
+        struct record {
+            point3 p;
+            vec3 normal;
+            color irradiance;
+            double reach;
+            uint64_t order;          // (pass, pixel): the order records are added up in
+            record* next_made;       // every record, to free them
+            std::vector<cell_entry> entries;
+        };
+
+        // The weight of record r at (p, normal), or 0 if it doesn't reach.
+        double weight( const record& r, const point3& p, const vec3& normal ) const;
+
+        // Calls visit(record) for every record in the cells of (p, normal).
+        template <typename Visit>
+        void find( const point3& p, const vec3& normal, double length, Visit visit ) const;
+
+        bool covered( const point3& p, const vec3& normal, double length, uint64_t before ) const;
+        void insert( record* r );
+
+        static uint64_t cell_key( int grid, int side, long long x, long long y, long long z );
+        static double cell_size( int grid ) { return ldexp( 1.0, grid - grid_offset ); }
+
+    private:
+        // Grid k has cells 2^(k - grid_offset) across; "grids_used" has bit
+        //      k set once a record has gone on grid k.
+        static const int grid_count = 64;
+        static const int grid_offset = 32;
+        std::atomic<uint64_t> grids_used{ 0 };
+        double pixel = 0;        // the camera's pixel_angle()
+
+        size_t bucket_mask;
+        std::unique_ptr<std::atomic<cell_entry*>[]> buckets;
+        std::atomic<record*> made{ nullptr };
+        std::atomic<size_t> record_count{ 0 };
+        mutable std::atomic<size_t> missed{ 0 };
+};
+
+// ray_color for previews: glass and metal (and fog) are followed as usual,
+//      and the first diffuse surface returns its albedo times the cached
+//      irradiance instead of bouncing on.
+color irradiance_ray_color( const ray& r, const hittable& world, const irradiance_cache& cache );
+
+// render() with irradiance_ray_color.
+void render_irradiance( const hittable& world, const camera& cam, uint64_t seed, const irradiance_cache& cache,
+                        const render_region& region, framebuffer& fb, ray_batch& batch );
+
+
+# endif
@@ -0,0 +1,79 @@
+// mapped_ppm.cpp
+// Creating, filling and flushing a memory mapped .ppm (see mapped_ppm.h).
+
+# include "mapped_ppm.h"
+
+using namespace std ;
+
+
+bool mapped_ppm::open( const std::string& path, int w, int h ) {
+    close();
+    width = w;
+    height = h;
+    std::string header = "P6\n" + std::to_string(w) + ' ' + std::to_string(h) + "\n255\n";
+    header_bytes = header.size();
+    bytes = header_bytes + 3 * static_cast<size_t>(w) * h;
+
+    fd = ::open( path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 )
+        return false;
+    // Reserve every block of the file now, rather than finding out the
+    //      disk is full halfway through (which, through a mapping, would
+    //      crash us instead of giving an error).
+    if ( posix_fallocate(fd, 0, bytes) != 0
+         || pwrite(fd, header.data(), header_bytes, 0) != static_cast<ssize_t>(header_bytes) ) {
+        close();
+        return false;
+    }
+    void* p = mmap( nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( p == MAP_FAILED ) {
+        close();
+        return false;
+    }
+    base = static_cast<unsigned char*>( p );
+
+    tiles_x = ( w + framebuffer::tile_size - 1 ) / framebuffer::tile_size;
+    bands = ( h + framebuffer::tile_size - 1 ) / framebuffer::tile_size;
+    band_tiles.reset( new std::atomic<int>[bands] );
+    for ( int b = 0; b < bands; ++b )
+        band_tiles[b] = 0;
+    return true;
+}
+
+void mapped_ppm::write_tile( int x0, int y0, int x1, int y1, const unsigned char* rgb ) {
+    size_t row_bytes = 3 * static_cast<size_t>( x1 - x0 );
+    for ( int j = y1 - 1; j >= y0; --j, rgb += row_bytes )
+        memcpy( pixel(x0, j), rgb, row_bytes );
+
+    int band = y0 / framebuffer::tile_size;
+    if ( band_tiles[band].fetch_add(1) + 1 == tiles_x )
+        flush_band( band );
+}
+
+// Writes a band's rows out to the file and unmaps their pages.
+//      The pages at either end may hold a row of the next band too; that's
+//      fine, since writing out a page never loses anything and a dropped
+//      page just gets read back from the file if it's touched again.
+void mapped_ppm::flush_band( int band ) {
+    int j0 = band * framebuffer::tile_size;
+    int j1 = std::min( j0 + framebuffer::tile_size, height );
+    size_t page = static_cast<size_t>( sysconf(_SC_PAGESIZE) );
+    size_t from = ( pixel(0, j1 - 1) - base ) / page * page;
+    size_t to = pixel(0, j0) - base + 3 * static_cast<size_t>(width);
+    msync( base + from, to - from, MS_SYNC );
+    madvise( base + from, to - from, MADV_DONTNEED );
+}
+
+bool mapped_ppm::close() {
+    bool ok = true;
+    if ( base ) {
+        ok = msync( base, bytes, MS_SYNC ) == 0;
+        munmap( base, bytes );
+        base = nullptr;
+    }
+    if ( fd >= 0 ) {
+        ok = ::close( fd ) == 0 && ok;
+        fd = -1;
+    }
+    return ok;
+}
@@ -0,0 +1,67 @@
+// mapped_ppm.h
+// Writes a binary .ppm ("P6") for pictures too big to keep in memory, like
+//      30000x20000 posters. The file is created at its full size up front and
+//      memory mapped, so a render thread copies each finished tile straight
+//      into its place in the file. Nothing ever holds the whole picture.
+//
+// Each band of 16 rows is flushed to disk as soon as its last tile lands,
+//      and then dropped from our memory (the data is in the file, so it's
+//      safe to let go of). That keeps memory use down to the tiles being
+//      worked on, and if the program dies halfway the bands that finished
+//      are already in the file; the rest are just black.
+
+# ifndef MAPPED_PPM_H
+# define MAPPED_PPM_H
+
+# include "rtweekend.h"
+
+# include "framebuffer.h"
+
+# include <algorithm>
+# include <atomic>
+# include <cstring>
+# include <memory>
+# include <string>
+
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+
+class mapped_ppm {
+    public:
+        mapped_ppm() {}
+        ~mapped_ppm() { close(); }
+        mapped_ppm( const mapped_ppm& ) = delete;
+        mapped_ppm& operator=( const mapped_ppm& ) = delete;
+
+        // Creates a w x h picture at "path". False if the file can't be made
+        //      (including when there's no disk space for all of it).
+        bool open( const std::string& path, int w, int h );
+
+        // Copies the 8 bit pixels of the block [x0,x1) x [y0,y1) into the
+        //      file. "rgb" is top row first, like output_encoder::encode_area
+        //      gives. Different threads can write different blocks at once.
+        void write_tile( int x0, int y0, int x1, int y1, const unsigned char* rgb );
+
+        // Flushes whatever is left and closes the file.
+        bool close();
+
+    private:
+        // Where pixel (i, j) goes. Files start with the top row, and j = 0 is the bottom one.
+        unsigned char* pixel( int i, int j ) {
+            return base + header_bytes + 3 * ( static_cast<size_t>(height - 1 - j) * width + i );
+        }
+        void flush_band( int band );
+
+    private:
+        int fd = -1;
+        unsigned char* base = nullptr;
+        size_t bytes = 0;
+        size_t header_bytes = 0;
+        int width = 0, height = 0;
+        int tiles_x = 0, bands = 0;
+        std::unique_ptr<std::atomic<int>[]> band_tiles;   // tiles finished in each band
+};
+
+
+# endif
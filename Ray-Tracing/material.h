@@ -3,25 +3,87 @@
 
 #include "rtweekend.h"
 
+#include "hittable.h"
+#include "texture.h"
 
-struct hit_record;
+#include <variant>
 
 
-class material {
+// Each material below is a plain class with a scatter() function- no virtual
+//      functions. "material" at the bottom of the file is the closed list of
+//      all of them, so the compiler knows every kind of material there is and
+//      can inline each one's scatter() right into the render loop instead of
+//      calling through a pointer on every bounce.
+
+
+class dielectric;
+
+// The glass (or water, or...) a path is inside right now, innermost last.
+//      A ray refracting into a dielectric enters it, and refracting back
+//      out leaves it. Knowing what's on the other side of a surface lets a
+//      glass marble inside a bowl of water bend light by 1.5/1.33 instead of
+//      1.5/1.0, and lets colored glass absorb light along the way.
+class medium_stack {
     public:
-        virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const = 0;
+        // The index of refraction we're in: the innermost medium's, or air's.
+        double ior() const { return size > 0 ? entries[size-1].ir : 1.0; }
+
+        // The index we'd be in after leaving "m".
+        double ior_around( const dielectric* m ) const {
+            for ( int k = size - 1; k >= 0; --k )
+                if ( entries[k].medium != m )
+                    return entries[k].ir;
+            return 1.0;
+        }
+
+        void enter( const dielectric* m, double ir, const color& absorption ) {
+            if ( size < max_size )
+                entries[size++] = entry{ m, ir, absorption };
+        }
+
+        // Media don't have to be left in the order they were entered, if
+        //      their surfaces overlap.
+        void leave( const dielectric* m ) {
+            for ( int k = size - 1; k >= 0; --k ) {
+                if ( entries[k].medium == m ) {
+                    for ( ; k + 1 < size; ++k )
+                        entries[k] = entries[k+1];
+                    --size;
+                    return;
+                }
+            }
+        }
+
+        // Beer-Lambert: after going "distance" through the innermost medium,
+        //      exp(-absorption * distance) of the light is left.
+        void absorb( double distance, color& throughput ) const {
+            if ( size == 0 )
+                return;
+            const color& a = entries[size-1].absorption;
+            if ( a.x() > 0 || a.y() > 0 || a.z() > 0 )
+                throughput = throughput * color( exp(-a.x()*distance), exp(-a.y()*distance), exp(-a.z()*distance) );
+        }
+
+    private:
+        struct entry {
+            const dielectric* medium;
+            double ir;
+            color absorption;
+        };
+        static const int max_size = 4;
+        entry entries[max_size];
+        int size = 0;
 };
 
 
-class lambertian : public material {
+class lambertian {
     public:
         lambertian(const color& a) : albedo(a) {}
+        lambertian(shared_ptr<texture> t) : tex(t) {}
 
-        virtual bool scatter(
+        bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override {
+        ) const {
             auto scatter_direction = rec.normal + random_unit_vector();
 
             // Catch degenerate scatter direction
@@ -29,71 +91,165 @@ class lambertian : public material {
                 scatter_direction = rec.normal;
 
             scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo;
+            attenuation = tex ? tex->value(rec.u, rec.v, rec.p, rec.texture_width()) : albedo;
             return true;
         }
 
     public:
+        // A plain color is kept right here; only real textures cost a
+        //      pointer (and a heap allocation and virtual call).
         color albedo;
+        shared_ptr<texture> tex;
 };
 
 
-class metal : public material {
+class metal {
     public:
         metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
+        metal(shared_ptr<texture> t, double f) : tex(t), fuzz(f < 1 ? f : 1) {}
 
-        virtual bool scatter(
+        bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override {
+        ) const {
+            // The fuzz is sized against a unit reflection, so the incoming
+            //      direction is made unit length here. Rays aren't unit length
+            //      in general- camera and diffuse rays aren't, and the media
+            //      measure distance along them as t times the length- and only
+            //      a few bounces land on metal, so this is the cheap place to do it.
             vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
             scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
-            attenuation = albedo;
+            attenuation = tex ? tex->value(rec.u, rec.v, rec.p, rec.texture_width()) : albedo;
             return (dot(scattered.direction(), rec.normal) > 0);
         }
 
     public:
         color albedo;
+        shared_ptr<texture> tex;
         double fuzz;
 };
 
 
-class dielectric : public material {
+class dielectric {
     public:
-        dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+        // "absorption" is how much of each color is absorbed per unit of
+        //      distance inside; zero (the default) is perfectly clear glass.
+        dielectric(double index_of_refraction, const color& absorb = color(0,0,0))
+            : ir(index_of_refraction), absorption(absorb) {}
 
-        virtual bool scatter(
+        // When we don't know what's around us, the other side is air.
+        bool scatter(
             const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
-        ) const override {
+        ) const {
+            medium_stack air;
+            return scatter(r_in, rec, attenuation, scattered, air);
+        }
+
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered,
+            medium_stack& media
+        ) const {
             attenuation = color(1.0, 1.0, 1.0);
-            double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
+            // Going in, light goes from whatever we're in now into this;
+            //      coming out, from this into whatever is around it.
+            double refraction_ratio = rec.front_face ? media.ior() / ir : ir / media.ior_around(this);
 
             vec3 unit_direction = unit_vector(r_in.direction());
             double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-            double sin_theta = sqrt(1.0 - cos_theta*cos_theta);
 
-            bool cannot_refract = refraction_ratio * sin_theta > 1.0;
-            vec3 direction;
-
-            if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
-                direction = reflect(unit_direction, rec.normal);
-            else
-                direction = refract(unit_direction, rec.normal, refraction_ratio);
-
-            scattered = ray(rec.p, direction);
+            // Total internal reflection: the ray can't get out, so it's
+            //      reflected for certain- no need for Schlick or a coin flip.
+            //      (Squared, to leave out a sqrt.)
+            if (refraction_ratio*refraction_ratio * (1.0 - cos_theta*cos_theta) > 1.0) {
+                scattered = ray(rec.p, reflect(unit_direction, rec.normal));
+                return true;
+            }
+
+            if (reflectance(cos_theta, refraction_ratio) > random_double()) {
+                scattered = ray(rec.p, reflect(unit_direction, rec.normal));
+            } else {
+                scattered = ray(rec.p, refract(unit_direction, rec.normal, refraction_ratio));
+                if (rec.front_face)
+                    media.enter(this, ir, absorption);
+                else
+                    media.leave(this);
+            }
             return true;
         }
 
     public:
         double ir; // Index of Refraction
+        color absorption;
 
     private:
         static double reflectance(double cosine, double ref_idx) {
-            // Use Schlick's approximation for reflectance.
+            // Use Schlick's approximation for reflectance. (1-cosine)^5 is
+            //      multiplied out by hand, since pow() is much slower.
             auto r0 = (1-ref_idx) / (1+ref_idx);
             r0 = r0*r0;
-            return r0 + (1-r0)*pow((1 - cosine),5);
+            auto x = 1 - cosine;
+            auto x2 = x*x;
+            return r0 + (1-r0)*(x2*x2*x);
+        }
+};
+
+
+// The "material" inside fog and smoke (see constant_medium.h): light that
+//      hits a particle bounces off in any direction at all, equally likely.
+class isotropic {
+    public:
+        isotropic(const color& a) : albedo(a) {}
+        isotropic(shared_ptr<texture> t) : tex(t) {}
+
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+        ) const {
+            scattered = ray(rec.p, random_unit_vector());
+            attenuation = tex ? tex->value(rec.u, rec.v, rec.p, rec.texture_width()) : albedo;
+            return true;
         }
+
+    public:
+        color albedo;
+        shared_ptr<texture> tex;
+};
+
+
+// A material is exactly one of the kinds above. Build one from any of them,
+//      e.g. make_shared<material>(lambertian(color(0.5, 0.5, 0.5))).
+//      To add a new kind of material, write its class and add it to the list.
+class material {
+    public:
+        using kinds = std::variant<lambertian, metal, dielectric, isotropic>;
+
+        template <typename kind, typename = std::enable_if_t<!std::is_same_v<std::decay_t<kind>, material>>>
+        material(kind&& m) : bsdf(std::forward<kind>(m)) {}
+
+        // Calls the right scatter() for whatever kind of material this is.
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+        ) const {
+            return std::visit([&](const auto& m) {
+                return m.scatter(r_in, rec, attenuation, scattered);
+            }, bsdf);
+        }
+
+        // The same, keeping track of the media the path is inside (only
+        //      dielectrics care).
+        bool scatter(
+            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered,
+            medium_stack& media
+        ) const {
+            return std::visit([&](const auto& m) {
+                if constexpr (std::is_same_v<std::decay_t<decltype(m)>, dielectric>)
+                    return m.scatter(r_in, rec, attenuation, scattered, media);
+                else
+                    return m.scatter(r_in, rec, attenuation, scattered);
+            }, bsdf);
+        }
+
+    public:
+        kinds bsdf;
 };
 
 
-#endif
\ No newline at end of file
+#endif
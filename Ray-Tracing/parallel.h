@@ -0,0 +1,196 @@
+// parallel.h
+// A small helper for splitting a loop between threads. parallel_for hands
+//      each thread one contiguous chunk of [begin, end) and waits until all
+//      of them are done. Nothing fancy- it's for loops where every
+//      iteration costs about the same, like converting a row of pixels.
+//
+// Also the pieces for keeping threads out of each other's way on big
+//      machines: pinning threads to cores, counters that get a cache line to
+//      themselves, and an allocator that starts arrays on a cache line.
+
+# ifndef PARALLEL_H
+# define PARALLEL_H
+
+# include <pthread.h>
+# include <sched.h>
+
+# include <algorithm>
+# include <atomic>
+# include <fstream>
+# include <new>
+# include <sstream>
+# include <string>
+# include <thread>
+# include <vector>
+
+// Two threads writing to the same 64 byte cache line slow each other down
+//      even when they write different variables ("false sharing"), because
+//      the line has to bounce between their cores on every write.
+const size_t cache_line = 64;
+
+// How many threads to use when the caller doesn't say: one per core.
+inline int default_thread_count() {
+    return std::max( 1u, std::thread::hardware_concurrency() );
+}
+
+// Calls body(i) for every i in [begin, end), using up to "threads" threads
+//      (0 means one per core). The calling thread does the first chunk itself.
+template <typename Body>
+void parallel_for( long long begin, long long end, Body body, int threads = 0 ) {
+    if ( threads <= 0 )
+        threads = default_thread_count();
+    long long n = end - begin;
+    if ( n <= 0 )
+        return;
+    threads = static_cast<int>( std::min<long long>( threads, n ) );
+
+    auto run_chunk = [&]( int t ) {
+        long long lo = begin + n * t / threads;
+        long long hi = begin + n * (t + 1) / threads;
+        for ( long long i = lo; i < hi; ++i )
+            body( i );
+    };
+
+    std::vector<std::thread> helpers;
+    for ( int t = 1; t < threads; ++t )
+        helpers.emplace_back( run_chunk, t );
+    run_chunk( 0 );
+    for ( auto& h : helpers )
+        h.join();
+}
+
+
+// A counter on a cache line of its own, for counters that every thread bumps.
+struct alignas(cache_line) padded_counter {
+    std::atomic<long long> value{ 0 };
+};
+
+// An allocator for std::vector that starts the array on a cache line, so
+//      blocks whose size is a multiple of a cache line never share one.
+template <typename T>
+struct cache_aligned_allocator {
+    using value_type = T;
+
+    cache_aligned_allocator() = default;
+    template <typename U>
+    cache_aligned_allocator( const cache_aligned_allocator<U>& ) {}
+
+    T* allocate( size_t n ) {
+        return static_cast<T*>( ::operator new( n * sizeof(T), std::align_val_t(cache_line) ) );
+    }
+    void deallocate( T* p, size_t ) {
+        ::operator delete( p, std::align_val_t(cache_line) );
+    }
+
+    template <typename U>
+    bool operator==( const cache_aligned_allocator<U>& ) const { return true; }
+    template <typename U>
+    bool operator!=( const cache_aligned_allocator<U>& ) const { return false; }
+};
+
+
+// Where render threads are allowed to run.
+//      none    - wherever the operating system likes, and it may move them
+//      compact - thread k on the k-th core, filling one NUMA node (socket)
+//                before starting on the next, so a few threads share a cache
+//      spread  - round robin over the NUMA nodes, so every socket's memory
+//                bandwidth gets used even with only a few threads
+enum class pin_mode { none, compact, spread };
+
+// Parses a Linux cpu list like "0-3,8-11".
+inline std::vector<int> parse_cpu_list( const std::string& list ) {
+    std::vector<int> cpus;
+    std::stringstream in( list );
+    std::string range;
+    while ( std::getline(in, range, ',') ) {
+        int lo, hi;
+        char dash;
+        std::stringstream r( range );
+        if ( !(r >> lo) )
+            continue;
+        if ( !(r >> dash >> hi) )
+            hi = lo;
+        for ( int c = lo; c <= hi; ++c )
+            cpus.push_back( c );
+    }
+    return cpus;
+}
+
+// The cores we may run on, in the order threads should be pinned to them.
+//      The NUMA layout comes from /sys; without it everything is one node.
+inline std::vector<int> pinning_order( pin_mode mode ) {
+    cpu_set_t allowed;
+    CPU_ZERO( &allowed );
+    sched_getaffinity( 0, sizeof(allowed), &allowed );
+
+    std::vector<std::vector<int>> nodes;
+    for ( int n = 0; ; ++n ) {
+        std::ifstream in( "/sys/devices/system/node/node" + std::to_string(n) + "/cpulist" );
+        std::string list;
+        if ( !std::getline(in, list) )
+            break;
+        std::vector<int> usable;
+        for ( int c : parse_cpu_list(list) )
+            if ( c < CPU_SETSIZE && CPU_ISSET(c, &allowed) )
+                usable.push_back( c );
+        if ( !usable.empty() )
+            nodes.push_back( usable );
+    }
+    if ( nodes.empty() ) {
+        nodes.emplace_back();
+        for ( int c = 0; c < CPU_SETSIZE; ++c )
+            if ( CPU_ISSET(c, &allowed) )
+                nodes.back().push_back( c );
+    }
+
+    std::vector<int> order;
+    if ( mode == pin_mode::spread ) {
+        for ( size_t k = 0; ; ++k ) {
+            size_t before = order.size();
+            for ( auto& node : nodes )
+                if ( k < node.size() )
+                    order.push_back( node[k] );
+            if ( order.size() == before )
+                break;
+        }
+    } else {
+        for ( auto& node : nodes )
+            order.insert( order.end(), node.begin(), node.end() );
+    }
+    return order;
+}
+
+// Keeps the calling thread on one core from now on.
+inline bool pin_current_thread( int cpu ) {
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+}
+
+// Starts "threads" threads (0 means one per core), pins them as asked, calls
+//      body(k) on thread k, and waits for all of them. Memory a thread
+//      allocates and fills in itself ends up on its own NUMA node, so
+//      per-thread scratch space should be made inside body, after pinning.
+template <typename Body>
+void run_threads( int threads, pin_mode pin, Body body ) {
+    if ( threads <= 0 )
+        threads = default_thread_count();
+    std::vector<int> cores;
+    if ( pin != pin_mode::none )
+        cores = pinning_order( pin );
+
+    std::vector<std::thread> pool;
+    for ( int t = 0; t < threads; ++t ) {
+        pool.emplace_back( [&, t] {
+            if ( !cores.empty() )
+                pin_current_thread( cores[t % cores.size()] );
+            body( t );
+        } );
+    }
+    for ( auto& th : pool )
+        th.join();
+}
+
+
+# endif
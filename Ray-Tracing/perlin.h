@@ -0,0 +1,104 @@
+// perlin.h
+// Perlin noise: smooth, random-looking values that change gradually as you
+//      move through space. Great for marble, clouds, and other things that
+//      are random but not *too* random. It works by putting a random vector
+//      at every point of an integer grid and smoothly blending between the
+//      8 corners of whichever grid cell a point lands in.
+
+# ifndef PERLIN_H
+# define PERLIN_H
+
+# include "rtweekend.h"
+
+class perlin {
+    public:
+        // Constructor- picks the random vectors and the scrambled lookup orders.
+        perlin() {
+            for ( int i = 0; i < point_count; ++i )
+                ranvec[i] = unit_vector( vec3::random(-1,1) );
+
+            perlin_generate_perm( perm_x );
+            perlin_generate_perm( perm_y );
+            perlin_generate_perm( perm_z );
+        }
+
+        // Noise value in [-1,1] at a point
+        double noise( const point3& p ) const {
+            auto u = p.x() - floor(p.x());
+            auto v = p.y() - floor(p.y());
+            auto w = p.z() - floor(p.z());
+            auto i = static_cast<int>( floor(p.x()) );
+            auto j = static_cast<int>( floor(p.y()) );
+            auto k = static_cast<int>( floor(p.z()) );
+            vec3 c[2][2][2];
+
+            for ( int di = 0; di < 2; di++ )
+                for ( int dj = 0; dj < 2; dj++ )
+                    for ( int dk = 0; dk < 2; dk++ )
+                        c[di][dj][dk] = ranvec[
+                            perm_x[(i+di) & 255] ^
+                            perm_y[(j+dj) & 255] ^
+                            perm_z[(k+dk) & 255]
+                        ];
+
+            return perlin_interp( c, u, v, w );
+        }
+
+        // Several layers of noise at doubling frequency and halving strength
+        double turb( const point3& p, int depth = 7 ) const {
+            auto accum = 0.0;
+            auto temp_p = p;
+            auto weight = 1.0;
+
+            for ( int i = 0; i < depth; i++ ) {
+                accum += weight * noise( temp_p );
+                weight *= 0.5;
+                temp_p *= 2;
+            }
+
+            return fabs( accum );
+        }
+
+    private:
+        static const int point_count = 256;
+        vec3 ranvec[point_count];
+        int perm_x[point_count];
+        int perm_y[point_count];
+        int perm_z[point_count];
+
+        static void perlin_generate_perm( int* p ) {
+            for ( int i = 0; i < point_count; i++ )
+                p[i] = i;
+
+            for ( int i = point_count-1; i > 0; i-- ) {
+                int target = random_int( 0, i );
+                int tmp = p[i];
+                p[i] = p[target];
+                p[target] = tmp;
+            }
+        }
+
+        // Blends the corner vectors, with a smooth (Hermite) curve so the
+        //      grid lines don't show.
+        static double perlin_interp( vec3 c[2][2][2], double u, double v, double w ) {
+            auto uu = u*u*(3-2*u);
+            auto vv = v*v*(3-2*v);
+            auto ww = w*w*(3-2*w);
+            auto accum = 0.0;
+
+            for ( int i = 0; i < 2; i++ )
+                for ( int j = 0; j < 2; j++ )
+                    for ( int k = 0; k < 2; k++ ) {
+                        vec3 weight_v( u-i, v-j, w-k );
+                        accum += (i*uu + (1-i)*(1-uu))
+                               * (j*vv + (1-j)*(1-vv))
+                               * (k*ww + (1-k)*(1-ww))
+                               * dot( c[i][j][k], weight_v );
+                    }
+
+            return accum;
+        }
+};
+
+
+# endif
@@ -0,0 +1,27 @@
+// plane.cpp
+// The ray test for a plane (see plane.h).
+
+# include "plane.h"
+
+using namespace std ;
+
+
+bool plane::hit( const ray& r, double t_min, double t_max, hit_record& rec ) const {
+    // A ray running parallel to the plane divides by zero, and the infinite
+    //      (or NaN) t fails the range check.
+    auto t = (offset - dot(n, r.origin())) / dot(n, r.direction());
+    if ( !(t >= t_min && t <= t_max) )
+        return false;
+
+    rec.t = t;
+    rec.p = r.at( t );
+    rec.set_face_normal( r, n );
+    // Textures repeat every unit along the plane.
+    auto u = dot( rec.p, u_axis );
+    auto v = dot( rec.p, v_axis );
+    rec.u = u - floor(u);
+    rec.v = v - floor(v);
+    rec.uv_length = 1;
+    rec.mat_ptr = mat_ptr.get();
+    return true;
+}
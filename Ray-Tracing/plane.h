@@ -0,0 +1,44 @@
+// plane.h
+// A flat surface going on forever in every direction, like the ground. The
+//      book fakes the ground with a sphere of radius 1000, which costs the
+//      full quadratic for every ray and loses precision: the numbers in it
+//      are about a million (1000 squared) while the answer we care about is
+//      a fraction of one. A plane is one dot product, one division.
+//
+// A plane has no bounding box, so a BVH keeps it to one side and tests it on
+//      every ray (see bvh.h)- which, at this price, is fine.
+
+# ifndef PLANE_H
+# define PLANE_H
+
+# include "rtweekend.h"
+
+# include "hittable.h"
+
+class plane : public hittable {
+    public:
+        plane() {}
+        // The plane through "point" facing "normal".
+        plane( const point3& point, const vec3& normal, shared_ptr<material> m )
+            : n(unit_vector(normal)), offset(dot(unit_vector(normal), point)), mat_ptr(m) {
+            // Two directions along the plane for texture coordinates.
+            vec3 helper = fabs(n.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+            u_axis = unit_vector( cross(helper, n) );
+            v_axis = cross( n, u_axis );
+        }
+
+        virtual bool hit( const ray& r, double t_min, double t_max, hit_record& rec ) const override;
+
+        virtual bool bounding_box( double time0, double time1, aabb& output_box ) const override {
+            return false;
+        }
+
+    public:
+        vec3 n;             // unit normal
+        double offset;      // the plane is every p with dot(n, p) == offset
+        vec3 u_axis, v_axis;
+        shared_ptr<material> mat_ptr;
+};
+
+
+# endif
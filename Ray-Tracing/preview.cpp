@@ -0,0 +1,277 @@
+// preview.cpp
+// The preview server's render threads, picture encoding and HTTP handling (see preview.h).
+
+# include "preview.h"
+
+using namespace std ;
+
+
+// Hands the next batch of rows to a render thread. Within the first pass we
+//      walk the strides 16, 8, 4, 2, 1; after that every pass is stride 1.
+bool preview_server::next_job( job& j, uint64_t& gen ) {
+    std::lock_guard<std::mutex> guard( lock );
+    while ( next_row >= fb.height ) {
+        next_row = 0;
+        if ( stride > 1 ) {
+            stride /= 2;
+        } else {
+            ++sample;
+            ++passes_done;
+        }
+        if ( stride == coarsest_stride/2 && sample == 0 && first_picture_ms < 0 ) {
+            first_picture_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - started ).count();
+        }
+    }
+
+    j = job{ next_row, stride, sample };
+    next_row += stride;
+    gen = generation;
+    return !quitting;
+}
+
+// Renders one batch into a scratch row and adds it to the framebuffer, unless
+//      the camera moved while we were busy, in which case it's thrown away.
+void preview_server::render_job( const job& j, uint64_t gen, const camera& c ) {
+    bool coarse_row = j.sample == 0 && j.stride < coarsest_stride && j.row % (2*j.stride) == 0;
+    int step = coarse_row ? 2*j.stride : j.stride;
+    int first = coarse_row ? j.stride : 0;
+
+    std::vector<color> row;
+    for ( int i = first; i < fb.width; i += step ) {
+        seed_sample( seed, static_cast<uint64_t>(j.row) * fb.width + i, j.sample );
+        auto u = ( i + random_double() ) / ( fb.width  - 1 );
+        auto v = ( j.row + random_double() ) / ( fb.height - 1 );
+        row.push_back( ray_color( c.get_ray(u, v), world, path ) );
+    }
+
+    std::lock_guard<std::mutex> guard( lock );
+    if ( gen != generation )
+        return;
+    size_t k = 0;
+    for ( int i = first; i < fb.width; i += step )
+        fb.add_sample( i, j.row, row[k++] );
+}
+
+void preview_server::render_loop() {
+    job j;
+    uint64_t gen;
+    while ( next_job(j, gen) ) {
+        camera c;
+        {
+            std::lock_guard<std::mutex> guard( lock );
+            c = cam;
+        }
+        render_job( j, gen, c );
+    }
+}
+
+// Moves the camera and throws away everything accumulated so far. The world
+//      stays exactly as it is.
+void preview_server::reset( const camera_settings& settings ) {
+    std::lock_guard<std::mutex> guard( lock );
+    cam_settings = settings;
+    cam = settings.make_camera();
+    fb = framebuffer( fb.width, fb.height );
+    ++generation;
+    next_row = 0;
+    stride = coarsest_stride;
+    sample = 0;
+    passes_done = 0;
+    started = std::chrono::steady_clock::now();
+    first_picture_ms = -1;
+}
+
+// The color to show for a pixel: its own average, or if it has no samples
+//      yet, the average of the nearest pixel on a coarser grid that does.
+color preview_server::display_color( int i, int j ) const {
+    for ( int s = 1; s <= coarsest_stride; s *= 2 ) {
+        int ci = i - i % s;
+        int cj = j - j % s;
+        auto n = fb.samples[fb.index(ci, cj)];
+        if ( n > 0 )
+            return fb.sum[fb.index(ci, cj)] / n;
+    }
+    return color(0,0,0);
+}
+
+// Encodes the current picture as an uncompressed 24 bit .bmp, which every
+//      browser can show without us needing an image library. Each output
+//      pixel is the average of a scale x scale block.
+std::string preview_server::frame_bmp( int scale ) {
+    std::vector<color> pixels;
+    int w, h;
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        w = fb.width / scale;
+        h = fb.height / scale;
+        pixels.resize( w*h );
+        for ( int y = 0; y < h; ++y ) {
+            for ( int x = 0; x < w; ++x ) {
+                color c(0,0,0);
+                for ( int dy = 0; dy < scale; ++dy )
+                    for ( int dx = 0; dx < scale; ++dx )
+                        c += display_color( x*scale + dx, y*scale + dy );
+                pixels[y*w + x] = c / (scale*scale);
+            }
+        }
+    }
+
+    int row_bytes = (3*w + 3) & ~3;
+    uint32_t size = 54 + row_bytes*h;
+    std::string bmp( size, '\0' );
+    auto put32 = [&]( int at, uint32_t v ) { memcpy( &bmp[at], &v, 4 ); };
+    auto put16 = [&]( int at, uint16_t v ) { memcpy( &bmp[at], &v, 2 ); };
+    bmp[0] = 'B'; bmp[1] = 'M';
+    put32( 2, size );
+    put32( 10, 54 );
+    put32( 14, 40 );
+    put32( 18, w );
+    put32( 22, h );       // positive height: rows go bottom to top, just like ours
+    put16( 26, 1 );
+    put16( 28, 24 );
+    put32( 34, row_bytes*h );
+
+    for ( int y = 0; y < h; ++y ) {
+        for ( int x = 0; x < w; ++x ) {
+            unsigned char rgb[3];
+            encoder.encode( pixels[y*w + x], rgb );
+            char* out = &bmp[54 + y*row_bytes + 3*x];
+            out[0] = rgb[2]; out[1] = rgb[1]; out[2] = rgb[0];
+        }
+    }
+    return bmp;
+}
+
+// Reads "key=x,y,z" style values out of a /camera query string.
+void preview_server::apply_camera_query( const std::string& query ) {
+    camera_settings settings;
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        settings = cam_settings;
+    }
+
+    std::stringstream params( query );
+    std::string param;
+    while ( getline(params, param, '&') ) {
+        auto eq = param.find( '=' );
+        if ( eq == std::string::npos )
+            continue;
+        std::string key = param.substr( 0, eq );
+        double v[3] = { 0, 0, 0 };
+        int n = sscanf( param.c_str() + eq + 1, "%lf,%lf,%lf", &v[0], &v[1], &v[2] );
+
+        if ( key == "from" && n == 3 )          settings.lookfrom = point3( v[0], v[1], v[2] );
+        else if ( key == "at" && n == 3 )       settings.lookat = point3( v[0], v[1], v[2] );
+        else if ( key == "fov" && n == 1 )      settings.vfov = v[0];
+        else if ( key == "aperture" && n == 1 ) settings.aperture = v[0];
+        else if ( key == "focus" && n == 1 )    settings.focus_dist = v[0];
+    }
+    reset( settings );
+}
+
+// Builds the full HTTP response for one request path.
+std::string preview_server::handle( const std::string& target ) {
+    auto q = target.find( '?' );
+    std::string path = target.substr( 0, q );
+    std::string query = q == std::string::npos ? "" : target.substr( q + 1 );
+
+    std::string type = "text/plain";
+    std::string body;
+    if ( path == "/frame" ) {
+        int scale = 1;
+        sscanf( query.c_str(), "scale=%d", &scale );
+        body = frame_bmp( clamp(scale, 1, 16) );
+        type = "image/bmp";
+    }
+    else if ( path == "/camera" ) {
+        apply_camera_query( query );
+        body = "ok\n";
+    }
+    else if ( path == "/status" ) {
+        std::lock_guard<std::mutex> guard( lock );
+        body = "passes " + to_string(passes_done)
+             + "\nfirst_picture_ms " + to_string(first_picture_ms) + "\n";
+    }
+    else if ( path == "/quit" ) {
+        quitting = true;
+        body = "bye\n";
+    }
+    else if ( path == "/" ) {
+        type = "text/html";
+        body = "<html><body style='margin:0;background:#000'>"
+               "<img id=f style='width:100%' src='/frame?scale=2'>"
+               "<script>setInterval(function(){document.getElementById('f').src="
+               "'/frame?scale=2&t='+Date.now()},250)</script></body></html>";
+    }
+    else {
+        return "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    }
+
+    return "HTTP/1.0 200 OK\r\nContent-Type: " + type
+         + "\r\nCache-Control: no-store\r\nContent-Length: " + to_string(body.size())
+         + "\r\n\r\n" + body;
+}
+
+bool preview_server::run( int port, int threads, pin_mode pin ) {
+    int listener = socket( AF_INET, SOCK_STREAM, 0 );
+    int yes = 1;
+    setsockopt( listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes) );
+
+    // Only listen on localhost- this isn't meant to be reachable from outside.
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    addr.sin_port = htons( port );
+    if ( listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+         || listen(listener, 8) < 0 ) {
+        cerr << "Couldn't listen on port " << port << '\n';
+        if ( listener >= 0 )
+            close( listener );
+        return false;
+    }
+
+    started = std::chrono::steady_clock::now();
+    std::vector<int> cores;
+    if ( pin != pin_mode::none )
+        cores = pinning_order( pin );
+    std::vector<std::thread> workers;
+    for ( int k = 0; k < threads; ++k ) {
+        workers.emplace_back( [this, &cores, k] {
+            if ( !cores.empty() )
+                pin_current_thread( cores[k % cores.size()] );
+            render_loop();
+        } );
+    }
+
+    cout << "Preview at http://127.0.0.1:" << port << "/" << endl;
+    while ( !quitting ) {
+        int client = accept( listener, nullptr, nullptr );
+        if ( client < 0 )
+            continue;
+
+        // We only need the request line, so one read is plenty.
+        char request[2048];
+        ssize_t n = read( client, request, sizeof(request) - 1 );
+        std::string response = "HTTP/1.0 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+        if ( n > 0 ) {
+            request[n] = '\0';
+            char method[16], target[1024];
+            if ( sscanf(request, "%15s %1023s", method, target) == 2 && strcmp(method, "GET") == 0 )
+                response = handle( target );
+        }
+
+        for ( size_t sent = 0; sent < response.size(); ) {
+            ssize_t k = write( client, response.data() + sent, response.size() - sent );
+            if ( k <= 0 )
+                break;
+            sent += k;
+        }
+        close( client );
+    }
+
+    close( listener );
+    for ( auto& t : workers )
+        t.join();
+    return true;
+}
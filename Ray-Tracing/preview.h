@@ -0,0 +1,103 @@
+// preview.h
+// A long-running preview mode for look-dev. Instead of rendering once and
+//      quitting, we keep the world in memory and keep adding one more sample
+//      to every pixel, over and over, while a tiny web server on localhost
+//      hands out the picture as it is so far.
+//
+// Endpoints (open http://127.0.0.1:PORT/ in a browser to watch):
+//      /                     a page that keeps reloading the frame
+//      /frame?scale=N        the current picture as a .bmp, shrunk N times
+//      /camera?from=x,y,z&at=x,y,z&fov=F&aperture=A&focus=D
+//                            moves the camera (any subset) and starts over
+//      /status               passes finished and time to the first picture
+//      /quit                 stops the server
+//
+// The first pass doesn't go in scanline order: it samples every 16th pixel,
+//      then every 8th, 4th, 2nd, and finally the rest. Pixels that don't have a
+//      sample yet borrow the color of the nearest coarse pixel that does, so
+//      a blocky version of the whole frame shows up after 1/256 of a pass.
+
+# ifndef PREVIEW_H
+# define PREVIEW_H
+
+# include "rtweekend.h"
+
+# include "camera.h"
+# include "color.h"
+# include "framebuffer.h"
+# include "hittable.h"
+# include "render.h"
+
+# include <atomic>
+# include <chrono>
+# include <cstdio>
+# include <cstring>
+# include <mutex>
+# include <sstream>
+# include <string>
+# include <thread>
+# include <vector>
+
+# include <netinet/in.h>
+# include <sys/socket.h>
+# include <unistd.h>
+
+// Spacing of the pixels sampled first.
+const int coarsest_stride = 16;
+
+class preview_server {
+    public:
+        preview_server( const hittable& w, const camera_settings& settings,
+                        int width, int height, uint64_t s, const path_settings& p,
+                        const output_settings& output = output_settings() )
+            : world(w), cam_settings(settings), cam(settings.make_camera()),
+              fb(width, height), seed(s), path(p), encoder(output)
+        {}
+
+        // Renders and serves until someone asks for /quit, on "threads"
+        //      render threads pinned as asked. Returns false if the port
+        //      couldn't be opened.
+        bool run( int port, int threads, pin_mode pin = pin_mode::none );
+
+    private:
+        // One unit of work: a stride-aligned batch of rows for one sample number.
+        struct job {
+            int row;
+            int stride;   // only pixels on this grid (and not a coarser one)
+            int sample;
+        };
+
+        void render_loop();
+        bool next_job( job& j, uint64_t& generation );
+        void render_job( const job& j, uint64_t generation, const camera& c );
+        void reset( const camera_settings& settings );
+
+        color display_color( int i, int j ) const;
+        std::string frame_bmp( int scale );
+        std::string handle( const std::string& path );
+        void apply_camera_query( const std::string& query );
+
+    private:
+        const hittable& world;
+
+        // Guards everything below it.
+        std::mutex lock;
+        camera_settings cam_settings;
+        camera cam;
+        framebuffer fb;
+        uint64_t generation = 0;     // bumped every time the camera moves
+        int next_row = 0;
+        int stride = coarsest_stride;
+        int sample = 0;
+        int passes_done = 0;
+        std::chrono::steady_clock::time_point started;
+        double first_picture_ms = -1;
+
+        uint64_t seed;
+        path_settings path;
+        output_encoder encoder;
+        std::atomic<bool> quitting{ false };
+};
+
+
+# endif
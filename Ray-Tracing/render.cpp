@@ -0,0 +1,90 @@
+// render.cpp
+// Following paths and rendering regions of the picture (see render.h).
+
+# include "render.h"
+
+using namespace std ;
+
+
+color ray_color( const ray& r, const hittable& world, const path_settings& path ) {
+    // The last path's hits are done with (see geometry_cache.h).
+    release_geometry();
+
+    hit_record rec;
+    bool hit = path.max_depth > 0 && world.hit( r, 0.001, infinity, rec );
+    return ray_color( r, hit ? &rec : nullptr, world, path );
+}
+
+color ray_color( const ray& r, const hit_record* first, const hittable& world, const path_settings& path ) {
+    ray current = r;
+    color throughput( 1, 1, 1 );
+    medium_stack media;
+    double travelled = 0;
+
+    // A training path remembers its diffuse bounces, to tell the guide
+    //      about whatever light it finds.
+    thread_local std::vector<guide_vertex> vertices;
+    if ( path.train )
+        vertices.clear();
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    for ( int bounce = 0; bounce < path.max_depth; ++bounce ) {
+        hit_record rec;
+        bool hit = bounce == 0 ? first != nullptr : world.hit( current, 0.001, infinity, rec );
+        if ( bounce == 0 && hit )
+            rec = *first;
+        if ( !hit ) {
+            color light = throughput * sky_color( current );
+            if ( path.train && !vertices.empty() )
+                path.guide->record_path( vertices.data(), static_cast<int>( vertices.size() ), light );
+            return light;
+        }
+
+        double distance = rec.t * current.direction().length();
+        travelled += distance;
+        rec.footprint = path.pixel_angle * travelled;
+        media.absorb( distance, throughput );
+        ray scattered;
+        color attenuation;
+        const lambertian* diffuse = path.guide ? std::get_if<lambertian>( &rec.mat_ptr->bsdf ) : nullptr;
+        double pdf = 0;
+        if ( diffuse ? !path.guide->scatter(*diffuse, rec, attenuation, scattered, pdf)
+                     : !rec.mat_ptr->scatter(current, rec, attenuation, scattered, media) )
+            return color(0,0,0);
+        throughput = throughput * attenuation;
+        if ( diffuse && path.train && pdf > 0 && vertices.size() < guide_field::max_vertices )
+            vertices.push_back( guide_vertex{ rec.p, scattered.direction(), throughput, pdf } );
+        current = scattered;
+        if ( !survives_roulette(throughput, bounce, path) )
+            return color(0,0,0);
+    }
+    return color(0,0,0);
+}
+
+void render( const hittable& world, const camera& cam, uint64_t seed, const path_settings& path,
+             const render_region& region, framebuffer& fb, ray_batch& batch ) {
+    const int strip_rows = 16 ;
+    batch.resize( static_cast<size_t>( region.x1 - region.x0 ) * strip_rows ) ;
+
+    for ( int y = region.y0; y < region.y1; y += strip_rows ) {
+        tile area{ region.x0, y, region.x1, min( y + strip_rows, region.y1 ) } ;
+        ray_span rays = batch.span() ;
+        rays.size = area.size() ;
+
+        for ( int s = region.s0; s < region.s1; ++s ) {
+            cam.generate_rays( area, fb.width, fb.height, seed, s, rays ) ;
+            for ( size_t k = 0; k < rays.size; ++k ) {
+                int i = area.x0 + static_cast<int>(k) % area.width() ;
+                int j = area.y0 + static_cast<int>(k) / area.width() ;
+                random_state() = rays.rng[k] ;
+                fb.add_sample( i, j, ray_color( rays.get(k), world, path ) ) ;
+            }
+        }
+    }
+}
+
+void render( const hittable& world, const camera& cam, uint64_t seed, const path_settings& path,
+             const render_region& region, framebuffer& fb ) {
+    ray_batch batch ;
+    render( world, cam, seed, path, region, fb, batch ) ;
+}
@@ -0,0 +1,189 @@
+// render.h
+// The actual rendering loop. Given a world, a camera, and a framebuffer, this
+//      file shoots rays through a block of pixels and adds what they hit into
+//      the framebuffer.
+
+# ifndef RENDER_H
+# define RENDER_H
+
+# include "rtweekend.h"
+
+# include "camera.h"
+# include "framebuffer.h"
+# include "geometry_cache.h"
+# include "guiding.h"
+# include "hittable.h"
+# include "material.h"
+# include "parallel.h"
+
+// How paths are followed. An int converts to this, so "50" still just
+//      means a depth limit of 50 (with roulette at its defaults).
+struct path_settings {
+    path_settings( int depth = 50, int roulette = 3, double below = 0.1 )
+        : max_depth(depth), roulette_after(roulette), roulette_below(below) {}
+
+    int max_depth;           // bounces before we give up on a path
+    int roulette_after;      // bounces before Russian roulette starts (0: never)
+    double roulette_below;   // ... for paths whose throughput is below this
+
+    // Path guiding for diffuse bounces (see guiding.h), if set. The guide
+    //      is the caller's and has to outlive the render. With "train" the
+    //      paths also teach it; call guide->refine() between passes.
+    guide_field* guide = nullptr;
+    bool train = false;
+
+    // The camera's pixel_angle(). Times how far a path has gone, it's how
+    //      wide a pixel is where the path hits, which picks the mip level of
+    //      image textures; 0 reads them at full resolution.
+    double pixel_angle = 0;
+};
+
+// Russian roulette. A path whose throughput has dropped low can't add much
+//      more light, so once it's below "roulette_below" we stop it with some
+//      probability, and weight the paths that carry on up by the same amount
+//      to make up for it, so on average the picture is the same. Dark paths-
+//      like ones soaking through tinted glass- end early instead of spending
+//      the whole depth budget. Bright paths are never stopped: in a sky-lit
+//      scene nearly all the light comes from them, and stopping them just
+//      trades time for noise one for one.
+inline bool survives_roulette( color& throughput, int bounce, const path_settings& path ) {
+    if ( path.roulette_after <= 0 || bounce + 1 < path.roulette_after )
+        return true;
+    double p = fmax( throughput.x(), fmax( throughput.y(), throughput.z() ) ) / path.roulette_below;
+    if ( p >= 1 )
+        return true;
+    if ( random_double() >= p )
+        return false;
+    throughput /= p;
+    return true;
+}
+
+// Creates a linear blend between two colors
+inline color sky_color( const ray& r ) {
+    vec3 unit_direction = unit_vector( r.direction() );
+    auto t = 0.5*( unit_direction.y() + 1.0 );
+    return ( 1.0 - t  ) * color( 1.0, 1.0, 1.0 ) + t * color( 0.5, 0.7, 1.0 );
+}
+
+// Calculates the color of a given ray based on the originally defined color,
+//      whether the object was hit, and where it is along the ray.
+//
+// This is a loop rather than the book's recursion: each bounce multiplies
+//      the path's "throughput" (how much of the light at the end of the
+//      path makes it back to the camera) by the surface's attenuation. The
+//      path also keeps track of which media it's inside (see material.h).
+//      With a guide, diffuse bounces go through it instead.
+color ray_color( const ray& r, const hittable& world, const path_settings& path );
+
+// The same, for a ray the caller has already tested against the world:
+//      "first" is the hit_record world.hit() gave, or nullptr for a miss.
+//      Call release_geometry() before that test, not after (see
+//      geometry_cache.h), since "first" may point into a pinned chunk.
+color ray_color( const ray& r, const hit_record* first, const hittable& world, const path_settings& path );
+
+// A block of pixels [x0,x1) x [y0,y1) and a range of sample numbers [s0,s1)
+//      to take in each of them.
+struct render_region {
+    int x0, y0, x1, y1;
+    int s0, s1;
+};
+
+// Renders one region into the framebuffer. Every sample reseeds the random
+//      number generator from (seed, pixel, sample number), so a region gives
+//      exactly the same result whether it's rendered alone or as part of the
+//      whole picture, in this process or in another one.
+//
+// The camera makes the rays for a strip of a few rows at a time, one sample
+//      number after another, and then we trace them one by one. "batch" is
+//      where the rays go; a render thread keeps its own between calls.
+void render( const hittable& world, const camera& cam, uint64_t seed, const path_settings& path,
+             const render_region& region, framebuffer& fb, ray_batch& batch );
+
+void render( const hittable& world, const camera& cam, uint64_t seed, const path_settings& path,
+             const render_region& region, framebuffer& fb );
+
+
+// Hands out the tiles of a width x height picture to render threads, in
+//      the order a framebuffer stores them, each with samples [s0, s1). The
+//      two counters every thread bumps get a cache line each.
+class tile_queue {
+    public:
+        tile_queue( int w, int h, int first_sample, int last_sample )
+            : width(w), height(h), s0(first_sample), s1(last_sample),
+              tiles_x( (w + framebuffer::tile_size - 1) / framebuffer::tile_size ),
+              tiles( static_cast<long long>(tiles_x) * ( (h + framebuffer::tile_size - 1) / framebuffer::tile_size ) )
+        {}
+
+        // Hands out "regions" instead, in order, each with its own samples.
+        explicit tile_queue( std::vector<render_region> regions )
+            : width(0), height(0), s0(0), s1(0), tiles_x(1),
+              tiles( static_cast<long long>( regions.size() ) ), list( std::move(regions) )
+        {}
+
+        long long count() const { return tiles ; }
+
+        // The next tile to render, or false once they're all handed out.
+        //      "index" is its place in the order they're handed out.
+        bool next( render_region& region, long long& index ) {
+            long long t = next_tile.value.fetch_add( 1, std::memory_order_relaxed ) ;
+            if ( t >= tiles )
+                return false ;
+            index = t ;
+            if ( !list.empty() ) {
+                region = list[t] ;
+                return true ;
+            }
+            int x0 = static_cast<int>( t % tiles_x ) * framebuffer::tile_size ;
+            int y0 = static_cast<int>( t / tiles_x ) * framebuffer::tile_size ;
+            region = render_region{ x0, y0, min( x0 + framebuffer::tile_size, width ),
+                                    min( y0 + framebuffer::tile_size, height ), s0, s1 } ;
+            return true ;
+        }
+
+        bool next( render_region& region ) {
+            long long index ;
+            return next( region, index ) ;
+        }
+
+        // Marks a tile done; returns how many are left.
+        long long finished() {
+            return tiles - 1 - done.value.fetch_add( 1, std::memory_order_relaxed ) ;
+        }
+
+    private:
+        int width, height ;
+        int s0, s1 ;
+        int tiles_x ;
+        long long tiles ;
+        std::vector<render_region> list ;
+        padded_counter next_tile ;
+        padded_counter done ;
+};
+
+// Renders samples [s0, s1) of every pixel of a width x height picture on
+//      "threads" threads (0 means one per core), pinned as asked. Every
+//      thread calls make_renderer() once, after it's been pinned, to get its
+//      own render_part(region)- so any scratch space that allocates is local
+//      to that thread- and then renders tiles until there are none left.
+//      After each of its tiles, thread 0 calls progress(tiles left).
+//
+// Each pixel still gets its samples in order from a single thread, so the
+//      picture is exactly the same for any number of threads.
+template <typename MakeRenderer, typename Progress>
+void render_tiles( int width, int height, int s0, int s1, int threads, pin_mode pin,
+                   MakeRenderer make_renderer, Progress progress ) {
+    tile_queue tiles( width, height, s0, s1 ) ;
+    run_threads( threads, pin, [&]( int t ) {
+        auto render_part = make_renderer() ;
+        render_region region ;
+        while ( tiles.next(region) ) {
+            render_part( region ) ;
+            long long left = tiles.finished() ;
+            if ( t == 0 )
+                progress( left ) ;
+        }
+    } ) ;
+}
+
+
+# endif
@@ -0,0 +1,330 @@
+// render_engine.cpp
+// The render threads and the bookkeeping of render jobs (see render_engine.h).
+
+# include "render_engine.h"
+
+# include <chrono>
+
+using namespace std ;
+
+
+bool render_job::done() const {
+    std::lock_guard<std::mutex> guard( lock );
+    return closed && rendered == handed_out;
+}
+
+void render_job::wait() const {
+    std::unique_lock<std::mutex> guard( lock );
+    finished.wait( guard, [&] { return closed && rendered == handed_out; } );
+}
+
+bool render_job::cancelled() const {
+    std::lock_guard<std::mutex> guard( lock );
+    return closed && handed_out < tiles.count();
+}
+
+long long render_job::tiles_done() const {
+    std::lock_guard<std::mutex> guard( lock );
+    return rendered;
+}
+
+bool render_job::take( render_region& region, long long& index ) {
+    std::lock_guard<std::mutex> guard( lock );
+    if ( closed || cancel_requested || !tiles.next(region, index) )
+        return false;
+    ++handed_out;
+    return true;
+}
+
+void render_job::finish_tile() {
+    std::lock_guard<std::mutex> guard( lock );
+    ++rendered;
+    if ( progress && !progress( rendered, tiles.count() ) )
+        cancel_requested = true;
+    if ( closed && rendered == handed_out )
+        finished.notify_all();
+}
+
+void render_job::close() {
+    std::lock_guard<std::mutex> guard( lock );
+    closed = true;
+    if ( rendered == handed_out )
+        finished.notify_all();
+}
+
+
+render_engine::render_engine( int threads, pin_mode pin ) {
+    if ( threads <= 0 )
+        threads = default_thread_count();
+    std::vector<int> cores;
+    if ( pin != pin_mode::none )
+        cores = pinning_order( pin );
+    for ( int t = 0; t < threads; ++t )
+        workers.emplace_back( &render_engine::work, this, cores.empty() ? -1 : cores[t % cores.size()] );
+}
+
+render_engine::~render_engine() {
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for ( auto& th : workers )
+        th.join();
+    for ( auto& job : jobs )
+        job->close();
+}
+
+shared_ptr<render_job> render_engine::submit( shared_ptr<const hittable> world, const camera& cam,
+                                              const render_settings& settings, framebuffer& fb,
+                                              render_progress progress ) {
+    std::unique_lock<std::mutex> guard( lock );
+    shared_ptr<render_job> job( new render_job( ++jobs_submitted, world, cam, settings, fb, progress ) );
+    if ( stopping ) {
+        job->close();
+        return job;
+    }
+    jobs.push_back( job );
+    guard.unlock();
+    work_ready.notify_all();
+    return job;
+}
+
+bool render_engine::render( shared_ptr<const hittable> world, const camera& cam, const render_settings& settings,
+                            framebuffer& fb, render_progress progress ) {
+    auto job = submit( world, cam, settings, fb, progress );
+    job->wait();
+    return !job->cancelled();
+}
+
+bool render_engine::render_guided( shared_ptr<const hittable> world, const camera& cam,
+                                   const render_settings& settings, framebuffer& fb, guide_field& guide,
+                                   int training_passes, render_progress progress ) {
+    render_settings pass = settings;
+    pass.paths.guide = &guide;
+    int done = 0;
+    for ( int k = 0; k <= training_passes && done < settings.samples_per_pixel; ++k ) {
+        pass.paths.train = k < training_passes;
+        pass.first_sample = settings.first_sample + done;
+        pass.samples_per_pixel = settings.samples_per_pixel - done;
+        if ( pass.paths.train )
+            pass.samples_per_pixel = std::min( pass.samples_per_pixel, 1 << k );
+        if ( !render(world, cam, pass, fb, progress) )
+            return false;
+        done += pass.samples_per_pixel;
+        if ( pass.paths.train )
+            guide.refine();
+    }
+    return true;
+}
+
+// How noisy each tile is, from two framebuffers holding different samples
+//      of the same picture. A pixel's two averages differ by about sigma
+//      times sqrt(1/nA + 1/nB), sigma being the spread of one sample, which
+//      gives sigma. The sRGB curve stretches dark colors and squashes bright
+//      ones (its slope goes about as x^-0.58), so sigma is scaled by that
+//      to count noise as it'll show in the picture. A tile's noise is the
+//      average over its pixels.
+static vector<double> tile_noise( const framebuffer& a, const framebuffer& b ) {
+    vector<double> noise( a.tile_count(), 0 );
+    for ( int t = 0; t < a.tile_count(); ++t ) {
+        double total = 0;
+        int pixels = 0;
+        for ( int k = t * framebuffer::tile_pixels; k < (t + 1) * framebuffer::tile_pixels; ++k ) {
+            double na = a.samples[k], nb = b.samples[k];
+            if ( na == 0 || nb == 0 )
+                continue;
+            color sa = a.sum[k], sb = b.sum[k];
+            double mean_a = (sa.x() + sa.y() + sa.z()) / (3 * na);
+            double mean_b = (sb.x() + sb.y() + sb.z()) / (3 * nb);
+            double mean = (na * mean_a + nb * mean_b) / (na + nb);
+            double sigma = fabs( mean_a - mean_b ) / sqrt( 1/na + 1/nb );
+            total += sigma * pow( mean + 0.005, -0.58 );
+            ++pixels;
+        }
+        noise[t] = pixels > 0 ? total / pixels : 0;
+    }
+    return noise;
+}
+
+budget_report render_engine::render_budgeted( shared_ptr<const hittable> world, const camera& cam,
+                                              const render_settings& settings, framebuffer& fb, double seconds,
+                                              render_progress progress ) {
+    using clock = chrono::steady_clock;
+    const auto start = clock::now();
+    const auto deadline = start + chrono::duration_cast<clock::duration>( chrono::duration<double>(seconds) );
+    auto time_left = [&] { return chrono::duration<double>( deadline - clock::now() ).count(); };
+
+    // The tiles, as render() would hand them out: how many pixels and
+    //      samples each has, and how long its samples took on one thread.
+    vector<render_region> tiles;
+    tile_queue layout( fb.width, fb.height, 0, 0 );
+    for ( render_region r; layout.next(r); )
+        tiles.push_back( r );
+    const size_t n = tiles.size();
+    vector<double> pixels( n );
+    for ( size_t t = 0; t < n; ++t )
+        pixels[t] = static_cast<double>( tiles[t].x1 - tiles[t].x0 ) * (tiles[t].y1 - tiles[t].y0);
+    vector<int> have( n, 0 );
+    vector<double> tile_seconds( n, 0 );
+
+    // Renders extra[t] more samples of each tile t into half (pass % 2).
+    //      False if the deadline (or "progress") stopped it. "speedup" is
+    //      how many seconds of one thread's work get done per second, as of
+    //      the last pass.
+    framebuffer halves[2] = { framebuffer( fb.width, fb.height ), framebuffer( fb.width, fb.height ) };
+    budget_report report;
+    double speedup = thread_count();
+    auto run_pass = [&]( const vector<int>& extra ) {
+        render_settings pass = settings;
+        vector<size_t> which;
+        for ( size_t t = 0; t < n; ++t ) {
+            if ( extra[t] <= 0 )
+                continue;
+            render_region r = tiles[t];
+            r.s0 = settings.first_sample + have[t];
+            r.s1 = r.s0 + extra[t];
+            pass.regions.push_back( r );
+            which.push_back( t );
+        }
+        vector<double> took( which.size(), 0 );
+        pass.region_seconds = &took;
+        auto pass_start = clock::now();
+        bool finished = render( world, cam, pass, halves[report.passes++ % 2], [&]( long long done, long long total ) {
+            return clock::now() < deadline && ( !progress || progress(done, total) );
+        } );
+        if ( !finished )
+            return false;
+        double work = 0;
+        for ( size_t k = 0; k < which.size(); ++k ) {
+            have[which[k]] += extra[which[k]];
+            tile_seconds[which[k]] += took[k];
+            work += took[k];
+        }
+        double pass_seconds = chrono::duration<double>( clock::now() - pass_start ).count();
+        speedup = max( work / max( pass_seconds, 1e-9 ), 1e-3 );
+        return true;
+    };
+
+    // One sample per pixel into each half: how long each tile takes, and
+    //      how noisy it is.
+    bool on_time = run_pass( vector<int>( n, 1 ) ) && run_pass( vector<int>( n, 1 ) );
+    double first_pass_seconds = chrono::duration<double>( clock::now() - start ).count() / 2;
+
+    // The time left is planned as however many passes at least as long as
+    //      those fit (but not too many: each redoes the noise estimate),
+    //      each taking an equal share of what's left when it starts. Passes
+    //      keep coming while there's time, in case the tile limit below
+    //      left some over.
+    const int most_passes = 8;
+    int planned = on_time ? max( 1, min( most_passes, static_cast<int>( time_left() / first_pass_seconds ) ) ) : 0;
+    for ( int k = 0; on_time && time_left() > 0; ++k ) {
+        // Seconds of one thread's work this pass can do, aiming a little
+        //      short so the last pass normally finishes.
+        double budget = 0.95 * time_left() / max( 1, planned - k ) * speedup;
+
+        // How long one sample of each tile takes, and its noise, with a
+        //      floor so no tile is forgotten for good. To make the picture's
+        //      total noise smallest for the time, tile t's share of all the
+        //      time spent (before and in this pass) should give it samples
+        //      in proportion to noise[t] / sqrt(cost[t]).
+        vector<double> noise = tile_noise( halves[0], halves[1] );
+        vector<double> cost( n );
+        double mean_noise = 0, spent = 0, scale = 0;
+        for ( size_t t = 0; t < n; ++t )
+            mean_noise += noise[t] / n;
+        for ( size_t t = 0; t < n; ++t ) {
+            cost[t] = max( tile_seconds[t] / (pixels[t] * have[t]), 1e-12 );
+            noise[t] += 0.1 * mean_noise + 1e-12;
+            spent += tile_seconds[t];
+            scale += pixels[t] * noise[t] * sqrt( cost[t] );
+        }
+        vector<int> extra( n, 0 );
+        double wanted = 0;
+        size_t noisiest = 0;
+        for ( size_t t = 0; t < n; ++t ) {
+            double target = noise[t] / sqrt( cost[t] ) * (spent + budget) / scale;
+            // A tile shouldn't take more than about 1% of the budget, so
+            //      stopping at the deadline is quick.
+            int most = max( 1, static_cast<int>( 0.01 * seconds / (pixels[t] * cost[t]) ) );
+            extra[t] = min( most, static_cast<int>( max( 0.0, target - have[t] ) ) );
+            wanted += extra[t] * pixels[t] * cost[t];
+            if ( noise[t] / sqrt( cost[t] ) > noise[noisiest] / sqrt( cost[noisiest] ) )
+                noisiest = t;
+        }
+        // Tiles that already have more than their share give nothing back,
+        //      so the rest may want more than fits.
+        if ( wanted > budget )
+            for ( int& e : extra )
+                e = static_cast<int>( e * (budget / wanted) );
+        extra[noisiest] = max( extra[noisiest], 1 );
+        on_time = run_pass( extra );
+    }
+
+    // The picture: every sample from both halves.
+    fb.merge( halves[0] );
+    fb.merge( halves[1] );
+    report.min_samples = std::numeric_limits<int>::max();
+    for ( int j = 0; j < fb.height; ++j ) {
+        for ( int i = 0; i < fb.width; ++i ) {
+            int count = static_cast<int>( fb.samples[ fb.index(i, j) ] );
+            report.samples += count;
+            report.min_samples = min( report.min_samples, count );
+            report.max_samples = max( report.max_samples, count );
+        }
+    }
+    report.seconds = chrono::duration<double>( clock::now() - start ).count();
+    return report;
+}
+
+// One render thread. It takes a tile from the job at the front of the line
+//      and sends that job to the back, so jobs running at the same time take
+//      turns instead of the first one hogging every thread.
+void render_engine::work( int cpu ) {
+    if ( cpu >= 0 )
+        pin_current_thread( cpu );
+
+    // Scratch space, allocated here so it's local to this thread and kept
+    //      from tile to tile. A wavefront integrator belongs to one world, so
+    //      it's remade when this thread moves on to another job. (Jobs are
+    //      told apart by number: a finished job's address can be reused.)
+    ray_batch batch;
+    unique_ptr<wavefront_integrator> wavefront;
+    uint64_t wavefront_job = 0;
+
+    while ( true ) {
+        shared_ptr<render_job> job;
+        render_region region;
+        long long index = 0;
+        {
+            std::unique_lock<std::mutex> guard( lock );
+            work_ready.wait( guard, [&] { return stopping || !jobs.empty(); } );
+            if ( stopping )
+                return;
+            job = jobs.front();
+            jobs.pop_front();
+            if ( !job->take(region, index) ) {
+                job->close();
+                continue;
+            }
+            jobs.push_back( job );
+        }
+
+        const render_settings& s = job->settings;
+        auto tile_start = chrono::steady_clock::now();
+        if ( s.irradiance ) {
+            render_irradiance( *job->world, job->cam, s.seed, *s.irradiance, region, job->fb, batch );
+        } else if ( s.wavefront ) {
+            if ( wavefront_job != job->id ) {
+                wavefront.reset( new wavefront_integrator( *job->world, s.paths, s.sort, s.queue ) );
+                wavefront_job = job->id;
+            }
+            wavefront->render( job->cam, s.seed, region, job->fb );
+        } else {
+            ::render( *job->world, job->cam, s.seed, s.paths, region, job->fb, batch );
+        }
+        if ( s.region_seconds )
+            (*s.region_seconds)[index] = chrono::duration<double>( chrono::steady_clock::now() - tile_start ).count();
+        job->finish_tile();
+    }
+}
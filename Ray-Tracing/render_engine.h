@@ -0,0 +1,199 @@
+// render_engine.h
+// The renderer as something another program can keep running: a
+//      render_engine owns a pool of render threads, and any number of render
+//      jobs can be handed to it. submit() returns straight away with a
+//      render_job to wait on (or cancel); the threads take tiles from all the
+//      jobs in turn, so several jobs share the pool instead of each starting
+//      its own threads. A job holds a shared_ptr to its world, so one scene
+//      built once can stay resident and be rendered by job after job.
+//
+//      render_engine engine( threads );
+//      auto job = engine.submit( world, cam, settings, fb, progress );
+//      ...
+//      job->wait();
+//
+// Every tile of every job is rendered exactly as render_tiles() would, so a
+//      picture comes out the same through the engine as through generateppm.
+
+# ifndef RENDER_ENGINE_H
+# define RENDER_ENGINE_H
+
+# include "rtweekend.h"
+
+# include "camera.h"
+# include "framebuffer.h"
+# include "guiding.h"
+# include "hittable.h"
+# include "irradiance_cache.h"
+# include "parallel.h"
+# include "render.h"
+# include "wavefront.h"
+
+# include <atomic>
+# include <condition_variable>
+# include <deque>
+# include <functional>
+# include <mutex>
+# include <thread>
+# include <vector>
+
+// How to render one job.
+struct render_settings {
+    uint64_t seed = 0;
+    int first_sample = 0;          // samples [first_sample, first_sample + samples_per_pixel)
+    int samples_per_pixel = 10;    //      of every pixel, so a later job can add more to the same picture
+    path_settings paths = 50;
+    bool wavefront = false;        // the wavefront integrator instead of ray_color
+    wavefront_sort sort = wavefront_sort::material;
+    int queue = wavefront_integrator::default_queue;    // paths the wavefront integrator traces together
+
+    // A filled irradiance cache (see irradiance_cache.h), if set: a quick
+    //      preview instead of the real thing. The cache is the caller's and
+    //      has to outlive the job.
+    const irradiance_cache* irradiance = nullptr;
+
+    // If not empty, just these regions are rendered, each with its own
+    //      samples, instead of [first_sample, ...) of every tile. Threads
+    //      render them at the same time, so no two may share a pixel.
+    std::vector<render_region> regions;
+
+    // If set, how many seconds each of "regions" took to render goes in
+    //      here, at the same place.
+    std::vector<double>* region_seconds = nullptr;
+};
+
+// What render_budgeted() did.
+struct budget_report {
+    int passes = 0;              // passes started; the last may have been cut off by the deadline
+    double seconds = 0;          // wall-clock time, from the call to the finished picture
+    uint64_t samples = 0;        // samples in the picture
+    int min_samples = 0;         // fewest samples of any pixel...
+    int max_samples = 0;         // ... and most
+};
+
+// Called after each finished tile with how many of the job's tiles are done
+//      and how many there are. Returning false cancels the job. It runs on
+//      a render thread, but never on two at once for the same job, and it
+//      shouldn't call the job's own functions (cancel() aside).
+using render_progress = std::function<bool( long long done, long long total )>;
+
+class render_job {
+    public:
+        // Stops handing out this job's tiles. Tiles already being rendered
+        //      still finish, so the framebuffer may hold part of the picture.
+        void cancel() { cancel_requested = true; }
+
+        // True once no thread is working on the job, finished or cancelled.
+        bool done() const;
+        void wait() const;
+
+        // True if the job stopped before rendering every tile.
+        bool cancelled() const;
+
+        long long tiles_done() const;
+        long long tiles_total() const { return tiles.count(); }
+
+    private:
+        friend class render_engine;
+
+        render_job( uint64_t n, shared_ptr<const hittable> w, const camera& c, const render_settings& s,
+                    framebuffer& f, render_progress p )
+            : id(n), world(w), cam(c), settings(s), fb(f), progress(p),
+              tiles( s.regions.empty() ? tile_queue( f.width, f.height, s.first_sample,
+                                                     s.first_sample + s.samples_per_pixel )
+                                       : tile_queue( s.regions ) ) {}
+
+        // The engine's side: hand out a tile (and its place in the order
+        //      they're handed out), report one finished, or stop handing
+        //      them out.
+        bool take( render_region& region, long long& index );
+        void finish_tile();
+        void close();
+
+    private:
+        uint64_t id;
+        shared_ptr<const hittable> world;
+        camera cam;
+        render_settings settings;
+        framebuffer& fb;
+        render_progress progress;
+        tile_queue tiles;
+        std::atomic<bool> cancel_requested{ false };
+
+        mutable std::mutex lock;
+        mutable std::condition_variable finished;
+        long long handed_out = 0;    // tiles given to threads
+        long long rendered = 0;      // ... and finished by them
+        bool closed = false;         // no more tiles will be handed out
+};
+
+class render_engine {
+    public:
+        // Starts "threads" render threads (0 means one per core), pinned as asked.
+        explicit render_engine( int threads = 0, pin_mode pin = pin_mode::none );
+
+        // Cancels whatever hasn't started yet, waits for the tiles in
+        //      progress, and stops the threads.
+        ~render_engine();
+
+        render_engine( const render_engine& ) = delete;
+        render_engine& operator=( const render_engine& ) = delete;
+
+        // Queues a job that renders "world" through "cam" into fb, which
+        //      must stay alive (and not be touched) until the job is done.
+        //      Returns without waiting.
+        shared_ptr<render_job> submit( shared_ptr<const hittable> world, const camera& cam,
+                                       const render_settings& settings, framebuffer& fb,
+                                       render_progress progress = nullptr );
+
+        // submit() and wait. False if the job was cancelled.
+        bool render( shared_ptr<const hittable> world, const camera& cam, const render_settings& settings,
+                     framebuffer& fb, render_progress progress = nullptr );
+
+        // render() with path guiding (see guiding.h). The first
+        //      "training_passes" passes, of 1, 2, 4... samples, teach "guide"
+        //      as they render, and it's refined after each; the samples left
+        //      over use what it learned. Every pass adds to fb, so none of
+        //      the training samples are thrown away. A guide trained by an
+        //      earlier frame can be used as it is (no training passes) or
+        //      taught some more.
+        bool render_guided( shared_ptr<const hittable> world, const camera& cam, const render_settings& settings,
+                            framebuffer& fb, guide_field& guide, int training_passes,
+                            render_progress progress = nullptr );
+
+        // render() against a wall-clock budget instead of a sample count
+        //      (settings.samples_per_pixel is ignored), for when a picture
+        //      is due in so many seconds. Two passes of one sample per pixel
+        //      measure how fast this scene renders and how noisy each tile
+        //      is; the time left is planned as a few more passes, each giving
+        //      its share of samples to the tiles in proportion to their
+        //      noise, measured again after every pass. At the deadline the
+        //      pass in progress is cancelled (only tiles already being
+        //      rendered finish, and tiles are kept short enough for that to
+        //      be quick) and fb gets everything rendered so far.
+        //
+        //      Noise is measured by rendering alternate passes into two
+        //      framebuffers: where the two disagree, the pixel is noisy. fb
+        //      must be a whole picture. How many samples each tile gets
+        //      depends on timing, so unlike everything else the picture
+        //      isn't the same from run to run.
+        budget_report render_budgeted( shared_ptr<const hittable> world, const camera& cam,
+                                       const render_settings& settings, framebuffer& fb, double seconds,
+                                       render_progress progress = nullptr );
+
+        int thread_count() const { return static_cast<int>( workers.size() ); }
+
+    private:
+        void work( int cpu );
+
+    private:
+        std::vector<std::thread> workers;
+        std::mutex lock;
+        std::condition_variable work_ready;
+        std::deque<shared_ptr<render_job>> jobs;    // jobs with tiles left to hand out
+        bool stopping = false;
+        uint64_t jobs_submitted = 0;
+};
+
+
+# endif
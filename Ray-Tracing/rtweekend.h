@@ -8,6 +8,7 @@
 
 // Libraries
 # include <cmath>
+# include <cstdint>
 # include <cstdlib>
 # include <limits>
 # include <memory>
@@ -33,9 +34,39 @@ inline double clamp(double x, double min, double max) {
     return x;
 }
 
+// Random Numbers
+// rand() shares one hidden state between everything in the program, so two
+//      processes rendering different parts of the same image can never agree
+//      on what "the next random number" is. Instead every thread keeps its own
+//      SplitMix64 state, which we can reseed for each pixel sample. That way a
+//      sample always sees the same random numbers no matter who renders it.
+inline uint64_t& random_state() {
+    thread_local uint64_t state = 0x853c49e6748fea9bULL;
+    return state;
+}
+
+// Scrambles a 64 bit value so that nearby inputs give unrelated outputs.
+inline uint64_t mix_bits(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Seeds the current thread's generator, e.g. before building the scene.
+inline void seed_random(uint64_t seed) {
+    random_state() = mix_bits(seed);
+}
+
+// Seeds the current thread's generator for one sample of one pixel.
+inline void seed_sample(uint64_t seed, uint64_t pixel, uint64_t sample) {
+    random_state() = mix_bits(seed ^ mix_bits(pixel ^ mix_bits(sample + 0x9e3779b97f4a7c15ULL)));
+}
+
 inline double random_double() {
     // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    uint64_t& state = random_state();
+    state += 0x9e3779b97f4a7c15ULL;
+    return (mix_bits(state) >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double random_double(double min, double max) {
@@ -0,0 +1,265 @@
+// scenes.cpp
+// Building the worlds declared in scenes.h.
+
+# include "scenes.h"
+
+using namespace std ;
+
+
+// The grid of cells the small spheres sit in, one sphere per cell at most.
+struct sphere_grid {
+    explicit sphere_grid( const scene_params& params )
+        : spacing( 1 / sqrt(params.density) ), radius( 0.2 * spacing ),
+          cells( static_cast<long long>( ceil(2 * params.extent / spacing) ) ), start( -params.extent ) {}
+
+    double spacing;
+    double radius;
+    long long cells;     // across and down
+    double start;
+};
+
+// Makes the sphere for cell (a,b), if it has one. Without "out" it only
+//      says whether there is one.
+static bool cell_sphere( const scene_params& params, const sphere_grid& grid, long long a, long long b,
+                         point3& center, material* out ) {
+    seed_sample( params.seed, static_cast<uint64_t>(a) * grid.cells + b, 0 );
+    auto choose_mat = random_double();
+    center = point3( grid.start + (a + 0.9*random_double()) * grid.spacing, grid.radius,
+                     grid.start + (b + 0.9*random_double()) * grid.spacing );
+    if ( params.big_spheres && (center - point3(4, 0.2, 0)).length() <= 0.9 )
+        return false;
+
+    if ( !out )
+        return true;
+    if ( choose_mat < params.diffuse ) {
+        // diffuse
+        auto albedo = color::random() * color::random();
+        *out = lambertian( albedo );
+    } else if ( choose_mat < params.diffuse + params.metal ) {
+        // metal
+        auto albedo = color::random(0.5, 1);
+        auto fuzz = random_double(0, 0.5);
+        *out = metal( albedo, fuzz );
+    } else {
+        // glass
+        *out = dielectric( 1.5, params.glass_absorption );
+    }
+    return true;
+}
+
+void generate_spheres( const scene_params& params, sphere_collection& spheres ) {
+    const sphere_grid grid( params );
+    const long long cells = grid.cells;
+
+    int threads = params.threads > 0 ? params.threads : default_thread_count();
+    long long blocks = std::min<long long>( cells, 4LL * threads );
+    std::vector<size_t> block_start( blocks + 1, 0 );
+
+    parallel_for( 0, blocks, [&]( long long block ) {
+        point3 center;
+        size_t kept = 0;
+        for ( long long a = cells * block / blocks; a < cells * (block + 1) / blocks; ++a )
+            for ( long long b = 0; b < cells; ++b )
+                kept += cell_sphere( params, grid, a, b, center, nullptr );
+        block_start[block + 1] = kept;
+    }, threads );
+    for ( long long block = 0; block < blocks; ++block )
+        block_start[block + 1] += block_start[block];
+
+    spheres.resize( block_start[blocks] );
+    parallel_for( 0, blocks, [&]( long long block ) {
+        point3 center;
+        material m = dielectric( 1.5 );
+        size_t i = block_start[block];
+        for ( long long a = cells * block / blocks; a < cells * (block + 1) / blocks; ++a )
+            for ( long long b = 0; b < cells; ++b )
+                if ( cell_sphere( params, grid, a, b, center, &m ) )
+                    spheres.set( i++, center, grid.radius, m );
+    }, threads );
+}
+
+// Everything about "params" that changes the small spheres, or how they're
+//      cut into chunks, boiled down to one number.
+static uint64_t geometry_key( const scene_params& params ) {
+    double numbers[] = { double(params.extent), params.density, params.diffuse, params.metal,
+                         params.glass_absorption[0], params.glass_absorption[1], params.glass_absorption[2],
+                         double(params.big_spheres), double(params.geometry_chunk) };
+    uint64_t key = params.seed;
+    for ( double x : numbers ) {
+        uint64_t bits;
+        memcpy( &bits, &x, 8 );
+        key = mix_bits( key ^ bits );
+    }
+    return key;
+}
+
+bool write_sphere_file( const scene_params& params, const std::string& path ) {
+    const sphere_grid grid( params );
+    const long long per_chunk = std::max( 1, params.geometry_chunk );
+    const long long across = (grid.cells + per_chunk - 1) / per_chunk;
+
+    geometry_writer out;
+    if ( !out.open(path, geometry_key(params)) )
+        return false;
+
+    // A batch of chunks at a time, one per thread, written out in order- so
+    //      the file is the same however many threads made it, and only one
+    //      batch is ever in memory.
+    int threads = params.threads > 0 ? params.threads : default_thread_count();
+    std::vector<sphere_collection> batch( threads );
+    for ( long long first = 0; first < across * across; first += threads ) {
+        long long count = std::min<long long>( threads, across * across - first );
+        parallel_for( 0, count, [&]( long long k ) {
+            sphere_collection& spheres = batch[k];
+            spheres = sphere_collection();
+            long long ca = (first + k) / across, cb = (first + k) % across;
+            point3 center;
+            material m = dielectric( 1.5 );
+            for ( long long a = ca * per_chunk; a < std::min( (ca + 1) * per_chunk, grid.cells ); ++a )
+                for ( long long b = cb * per_chunk; b < std::min( (cb + 1) * per_chunk, grid.cells ); ++b )
+                    if ( cell_sphere( params, grid, a, b, center, &m ) )
+                        spheres.add( center, grid.radius, m );
+        }, threads );
+        for ( long long k = 0; k < count; ++k )
+            if ( batch[k].size() > 0 && !out.add_chunk(batch[k]) )
+                return false;
+    }
+    return out.finish();
+}
+
+shared_ptr<const geometry_file> open_sphere_file( const scene_params& params, const std::string& path ) {
+    auto file = make_shared<geometry_file>();
+    if ( file->open(path) && file->key == geometry_key(params) )
+        return file;
+    file = make_shared<geometry_file>();
+    if ( write_sphere_file(params, path) && file->open(path) )
+        return file;
+    return nullptr;
+}
+
+hittable_list random_scene( const scene_params& params, scene_stats* stats ) {
+    hittable_list world;
+
+    auto ground_material = make_shared<material>(lambertian(color(0.5, 0.5, 0.5)));
+    world.add(make_shared<plane>(point3(0,0,0), vec3(0,1,0), ground_material));
+
+    auto start = std::chrono::steady_clock::now();
+    if ( params.geometry_file.empty() ) {
+        auto spheres = make_shared<sphere_collection>();
+        generate_spheres( params, *spheres );
+        world.add( spheres );
+        if ( stats ) {
+            stats->spheres = spheres->size();
+            stats->bytes = spheres->memory_bytes();
+        }
+    } else {
+        // Out of core: only the chunks' boxes now, the spheres when a ray needs them.
+        auto file = open_sphere_file( params, params.geometry_file );
+        if ( file ) {
+            hittable_list proxies = geometry_proxies( file, global_geometry_cache() );
+            for ( auto& proxy : proxies.objects )
+                world.add( proxy );
+            if ( stats ) {
+                stats->spheres = file->sphere_count();
+                stats->chunks = file->chunks.size();
+            }
+        }
+    }
+    if ( stats )
+        stats->build_seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    if ( params.big_spheres ) {
+        auto material1 = make_shared<material>(dielectric(1.5));
+        world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+        auto material2 = params.texture.empty() ? make_shared<material>(lambertian(color(0.4, 0.2, 0.1)))
+                       : make_shared<material>(lambertian(make_shared<image_texture>(params.texture)));
+        world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+        auto material3 = make_shared<material>(metal(color(0.7, 0.6, 0.5), 0.0));
+        world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    }
+
+    if ( params.smoke > 0 ) {
+        // Turbulence, faded out towards the edges of an ellipsoid, so the
+        //      cloud is lumpy inside and has soft edges.
+        seed_sample( params.seed, 0, 1 );
+        auto noise = make_shared<perlin>();
+        point3 center( 0, 2.4, 0 );
+        vec3 radii( 6, 1.2, 2.5 );
+        auto density = [=]( const point3& p ) {
+            vec3 q = p - center;
+            double r = vec3( q.x()/radii.x(), q.y()/radii.y(), q.z()/radii.z() ).length();
+            if ( r >= 1 )
+                return 0.0;
+            return (1 - r) * clamp( 1.6 * noise->turb(0.8 * p) - 0.2, 0.0, 1.0 );
+        };
+        world.add( make_shared<grid_medium>( aabb(center - radii, center + radii), 128, density, params.smoke,
+                                             color(0.9, 0.9, 0.9), params.threads ) );
+    }
+    if ( params.fog > 0 ) {
+        auto boundary = make_shared<sphere>( point3(0, 0, 0), 40, nullptr );
+        world.add( make_shared<constant_medium>( boundary, params.fog, color(1, 1, 1) ) );
+    }
+
+    if ( params.accel == scene_accel::none )
+        return world;
+
+    start = std::chrono::steady_clock::now();
+    auto tree = make_shared<bvh>( world, params.accel == scene_accel::sah ? bvh_builder::sah : bvh_builder::lbvh,
+                                  params.threads );
+    if ( stats ) {
+        stats->accel_seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+        stats->accel_nodes = tree->node_count();
+        stats->accel_bytes = tree->memory_bytes();
+        stats->accel_cost = tree->sah_cost();
+    }
+    return hittable_list( tree );
+}
+
+camera_settings random_scene_camera( double aspect_ratio ) {
+    point3 lookfrom( 13, 2, 3 );
+    point3 lookat( 0, 0, 0 );
+    vec3 vup( 0, 1, 0 );
+    auto dist_to_focus = 10.0;
+    auto aperture = 0.1;
+    return camera_settings{ lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus };
+}
+
+aabb random_scene_bounds( const scene_params& params ) {
+    return aabb( point3(-params.extent - 1, 0, -params.extent - 1), point3(params.extent + 1, 4, params.extent + 1) );
+}
+
+hittable_list room_scene( scene_accel accel ) {
+    hittable_list world;
+    auto white = make_shared<material>( lambertian(color(0.73, 0.73, 0.73)) );
+    auto red = make_shared<material>( lambertian(color(0.65, 0.05, 0.05)) );
+    auto green = make_shared<material>( lambertian(color(0.12, 0.45, 0.15)) );
+
+    // 10 x 6 x 10, with a 1.5 x 1.5 hole in the middle of the ceiling.
+    world.add( make_shared<xz_rect>(0, 10, 0, 10, 0, white) );
+    world.add( make_shared<xz_rect>(0, 10, 0, 4.25, 6, white) );
+    world.add( make_shared<xz_rect>(0, 10, 5.75, 10, 6, white) );
+    world.add( make_shared<xz_rect>(0, 4.25, 4.25, 5.75, 6, white) );
+    world.add( make_shared<xz_rect>(5.75, 10, 4.25, 5.75, 6, white) );
+    world.add( make_shared<yz_rect>(0, 6, 0, 10, 0, red) );
+    world.add( make_shared<yz_rect>(0, 6, 0, 10, 10, green) );
+    world.add( make_shared<xy_rect>(0, 10, 0, 6, 0, white) );
+    world.add( make_shared<xy_rect>(0, 10, 0, 6, 10, white) );
+
+    world.add( make_shared<box>(point3(1.5, 0, 1.5), point3(4, 3.5, 4), white) );
+    world.add( make_shared<sphere>(point3(7, 1.2, 3), 1.2, make_shared<material>(dielectric(1.5))) );
+    world.add( make_shared<sphere>(point3(6.5, 1, 6.5), 1, make_shared<material>(metal(color(0.8, 0.8, 0.8), 0.1))) );
+
+    if ( accel == scene_accel::none )
+        return world;
+    return hittable_list( make_shared<bvh>( world, accel == scene_accel::sah ? bvh_builder::sah : bvh_builder::lbvh ) );
+}
+
+camera_settings room_scene_camera( double aspect_ratio ) {
+    return camera_settings{ point3(5, 3, 9.9), point3(5, 2.2, 0), vec3(0, 1, 0), 75, aspect_ratio, 0, 10 };
+}
+
+aabb room_scene_bounds() {
+    return aabb( point3(0, 0, 0), point3(10, 6, 10) );
+}
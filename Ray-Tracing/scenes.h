@@ -0,0 +1,110 @@
+// scenes.h
+// The worlds we know how to build. A world built from the same settings
+//      (including the seed) always comes out the same.
+
+# ifndef SCENES_H
+# define SCENES_H
+
+# include "rtweekend.h"
+
+# include "aarect.h"
+# include "box.h"
+# include "bvh.h"
+# include "camera.h"
+# include "constant_medium.h"
+# include "geometry_cache.h"
+# include "grid_medium.h"
+# include "hittable_list.h"
+# include "material.h"
+# include "parallel.h"
+# include "perlin.h"
+# include "plane.h"
+# include "sphere.h"
+# include "sphere_collection.h"
+
+# include <chrono>
+# include <string>
+# include <vector>
+
+// How the world is organized for ray tests: a plain list that tests every
+//      object, or a BVH (see bvh.h) built one of two ways.
+enum class scene_accel { none, sah, lbvh };
+
+// Settings for random_scene(). The defaults give the book's picture: a
+//      22x22 grid of small spheres, 80% diffuse, 15% metal, 5% glass.
+struct scene_params {
+    int extent = 11;             // the grid runs from -extent to extent in x and z
+    double density = 1;          // small spheres per unit of floor area
+    double diffuse = 0.8;        // fraction of small spheres that are lambertian
+    double metal = 0.15;         // ... and metal. The rest are glass.
+    color glass_absorption = color(0,0,0);   // per unit distance, for tinted glass
+    double fog = 0;              // density of a haze over everything (0: none)
+    double smoke = 0;            // density of a cloud of smoke over the big spheres (0: none)
+    uint64_t seed = 0;
+    bool big_spheres = true;     // the three big spheres in the middle
+    std::string texture;         // if set, a picture (see texture.h) wrapped around the big diffuse one
+    scene_accel accel = scene_accel::sah;
+    int threads = 0;             // 0 means one per core
+
+    // If set, the small spheres are kept in this file and only read in as
+    //      rays reach them (see geometry_cache.h), in chunks of
+    //      geometry_chunk x geometry_chunk grid cells.
+    std::string geometry_file;
+    int geometry_chunk = 32;
+};
+
+// How long building the small spheres took and how much room they take.
+struct scene_stats {
+    size_t spheres = 0;
+    double build_seconds = 0;
+    size_t bytes = 0;            // 0 if they're out of core...
+    size_t chunks = 0;           // ... in this many chunks
+
+    // The same for the BVH, if there is one
+    double accel_seconds = 0;
+    size_t accel_nodes = 0;
+    size_t accel_bytes = 0;
+    double accel_cost = 0;       // bvh::sah_cost()
+};
+
+// Fills "spheres" with the random small spheres for "params". Each grid cell
+//      seeds its own random numbers from (seed, cell), so the result doesn't
+//      depend on how many threads share the work. The threads each take a
+//      block of rows; a first pass counts the spheres each block keeps (some
+//      are too close to the big metal sphere), so that the second pass knows
+//      where in the arrays each block starts writing.
+void generate_spheres( const scene_params& params, sphere_collection& spheres );
+
+// Writes the same spheres into a geometry file (see geometry_cache.h), one
+//      square of params.geometry_chunk x geometry_chunk cells per chunk. Only
+//      one chunk per thread is in memory at a time, so this works for more
+//      spheres than fit.
+bool write_sphere_file( const scene_params& params, const std::string& path );
+
+// Opens the geometry file at "path" if it was written for these params, or
+//      writes it (again) if not. Null if that fails.
+shared_ptr<const geometry_file> open_sphere_file( const scene_params& params, const std::string& path );
+
+// Adds a ground plane to our scene, a field of small random spheres, and the
+//      three big ones. (The book's ground is a sphere of radius 1000; a real
+//      plane is far cheaper to hit and, having no bounding box, doesn't
+//      stretch the BVH's top box out to a thousand units.)
+hittable_list random_scene( const scene_params& params = scene_params(), scene_stats* stats = nullptr );
+
+// Where the book puts the camera for random_scene(): low, off to one side,
+//      looking at the three big spheres, with a little depth of field.
+camera_settings random_scene_camera( double aspect_ratio );
+
+// A box around the part of random_scene() worth telling apart for path
+//      guiding (see guiding.h): the spheres, not the ground out to the horizon.
+aabb random_scene_bounds( const scene_params& params );
+
+// A closed room lit only by the sky through a small hole in its ceiling:
+//      white walls (one red, one green), a box, and a glass and a metal
+//      ball. Nearly all the light on the walls has bounced at least once,
+//      so it's the kind of scene path guiding is for.
+hittable_list room_scene( scene_accel accel = scene_accel::sah );
+camera_settings room_scene_camera( double aspect_ratio );
+aabb room_scene_bounds();
+
+# endif
@@ -0,0 +1,11 @@
+// sphere.cpp
+// The sphere's own ray test, which just calls hit_sphere() from sphere.h.
+
+# include "sphere.h"
+
+using namespace std ;
+
+
+bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    return hit_sphere(center, radius, mat_ptr.get(), r, t_min, t_max, rec);
+}
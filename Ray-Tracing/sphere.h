@@ -10,6 +10,23 @@
 
 # include "hittable.h"
 
+// Works out texture coordinates for a point on a sphere of radius one,
+//      centered at the origin. u is the angle around the Y axis
+//      (from X=-1), v is the angle from the bottom (Y=-1) to the top,
+//      both scaled to [0,1].
+inline void get_sphere_uv(const point3& p, double& u, double& v) {
+    auto theta = acos(-p.y());
+    auto phi = atan2(-p.z(), p.x()) + pi;
+
+    u = phi / (2*pi);
+    v = theta / pi;
+}
+
+// The ray-sphere intersection itself, shared by sphere and by
+//      sphere_collection (which stores its spheres without sphere objects).
+inline bool hit_sphere(const point3& center, double radius, const material* mat_ptr,
+                       const ray& r, double t_min, double t_max, hit_record& rec);
+
 class sphere : public hittable {
     public:
         // Constructor 
@@ -20,6 +37,12 @@ class sphere : public hittable {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            vec3 r(radius, radius, radius);
+            output_box = aabb(center - r, center + r);
+            return true;
+        }
+
     public:
         point3 center;
         double radius;
@@ -27,8 +50,9 @@ class sphere : public hittable {
 };
 
 
-bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    
+inline bool hit_sphere(const point3& center, double radius, const material* mat_ptr,
+                       const ray& r, double t_min, double t_max, hit_record& rec) {
+
     // Google "spherical trigonometry" for more information on what OC is. 
     //      Essentially, OC goes from the center of the circle to the outer edge. 
     // Uppercase A, B, and C in spherical trig refer to points on the outside of 
@@ -68,10 +92,12 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     //      information on what the normal is and how it's determined. 
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
+    get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.uv_length = 2*pi*radius;    // u goes once around
     rec.mat_ptr = mat_ptr;
 
     return true;
 }
 
 
-#endif
\ No newline at end of file
+#endif
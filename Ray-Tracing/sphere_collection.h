@@ -0,0 +1,103 @@
+// sphere_collection.h
+// Lots of spheres stored together. A hittable_list of spheres costs a heap
+//      allocation per sphere (and per material), plus a shared_ptr and a
+//      virtual call for each one. Here every sphere is just an entry in a few
+//      big arrays- centers, radii, and materials- one element per sphere, so
+//      millions of them can be created quickly (even from several threads at
+//      once) and sit next to each other in memory.
+
+# ifndef SPHERE_COLLECTION_H
+# define SPHERE_COLLECTION_H
+
+# include "rtweekend.h"
+
+# include "hittable.h"
+# include "cpu_dispatch.h"
+# include "material.h"
+# include "sphere.h"
+
+# include <vector>
+
+class sphere_collection : public hittable {
+    public:
+        sphere_collection() {}
+
+        // Makes room for n spheres. They start out as zero sized glass balls
+        //      until set() fills them in.
+        void resize( size_t n ) {
+            cx.resize( n );
+            cy.resize( n );
+            cz.resize( n );
+            radius.resize( n, 0 );
+            materials.resize( n, material(dielectric(1.0)) );
+        }
+
+        // Fills in sphere i. Different threads can set different spheres.
+        void set( size_t i, const point3& center, double r, const material& m ) {
+            cx[i] = center.x();
+            cy[i] = center.y();
+            cz[i] = center.z();
+            radius[i] = r;
+            materials[i] = m;
+        }
+
+        void add( const point3& center, double r, const material& m ) {
+            resize( size() + 1 );
+            set( size() - 1, center, r, m );
+        }
+
+        size_t size() const { return radius.size(); }
+        point3 center( size_t i ) const { return point3( cx[i], cy[i], cz[i] ); }
+
+        // Tests a single sphere.
+        bool hit_one( size_t i, const ray& r, double t_min, double t_max, hit_record& rec ) const {
+            return hit_sphere( center(i), radius[i], &materials[i], r, t_min, t_max, rec );
+        }
+
+        // Tests every sphere and keeps the closest hit. Finding which one is
+        //      closest runs over the arrays in whichever copy suits this CPU
+        //      (see cpu_dispatch.h); only that one fills in "rec".
+        virtual bool hit( const ray& r, double t_min, double t_max, hit_record& rec ) const override {
+            long long i = kernels().closest_sphere( cx.data(), cy.data(), cz.data(), radius.data(), size(),
+                                                    r, t_min, t_max );
+            return i >= 0 && hit_one( static_cast<size_t>(i), r, t_min, t_max, rec );
+        }
+
+        virtual bool bounding_box( double time0, double time1, aabb& output_box ) const override {
+            output_box = aabb();
+            aabb box;
+            for ( size_t i = 0; i < size(); ++i ) {
+                part_bounding_box( i, box );
+                output_box.expand( box );
+            }
+            return size() > 0;
+        }
+
+        // Every sphere is its own part, so a BVH can sort them individually.
+        virtual size_t parts() const override { return size(); }
+
+        virtual bool part_bounding_box( size_t i, aabb& output_box ) const override {
+            vec3 r( radius[i], radius[i], radius[i] );
+            output_box = aabb( center(i) - r, center(i) + r );
+            return true;
+        }
+
+        virtual bool hit_part( size_t i, const ray& r, double t_min, double t_max,
+                               hit_record& rec ) const override {
+            return hit_one( i, r, t_min, t_max, rec );
+        }
+
+        // Bytes of memory the spheres take up.
+        size_t memory_bytes() const {
+            return cx.capacity() * sizeof(double) * 3 + radius.capacity() * sizeof(double)
+                 + materials.capacity() * sizeof(material);
+        }
+
+    public:
+        std::vector<double> cx, cy, cz;
+        std::vector<double> radius;
+        std::vector<material> materials;
+};
+
+
+# endif
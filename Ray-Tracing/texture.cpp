@@ -0,0 +1,95 @@
+// texture.cpp
+// Reading image textures through the tile cache (see texture.h).
+
+# include "texture.h"
+
+using namespace std ;
+
+
+image_texture::image_texture( const std::string& path, double filter_width, texture_cache& c )
+    : cache(c) {
+    std::string tile_path = path;
+    bool from_ppm = path.size() > 4 && path.compare(path.size() - 4, 4, ".ppm") == 0;
+    bool converted = false;
+    if ( from_ppm ) {
+        tile_path = path + ".tiles";
+        // Converted again if the .ppm has changed since.
+        struct stat ppm_info, tile_info;
+        bool stale = stat( tile_path.c_str(), &tile_info ) != 0
+                     || ( stat(path.c_str(), &ppm_info) == 0 && ppm_info.st_mtime >= tile_info.st_mtime );
+        if ( stale ) {
+            converted = tiled_image::convert_ppm( path, tile_path );
+            if ( !converted )
+                std::cerr << "Couldn't convert texture " << path << '\n';
+        }
+    }
+    loaded = image.open( tile_path );
+    // ... or if the tile file is damaged.
+    if ( !loaded && from_ppm && !converted && tiled_image::convert_ppm(path, tile_path) )
+        loaded = image.open( tile_path );
+    if ( !loaded ) {
+        std::cerr << "Couldn't open texture " << tile_path << '\n';
+        return;
+    }
+
+    min_width = filter_width;
+
+    for ( int k = 0; k < 256; ++k ) {
+        double x = k / 255.0;
+        to_linear[k] = x <= 0.04045 ? x / 12.92 : pow( (x + 0.055) / 1.055, 2.4 );
+    }
+}
+
+// Halve until one texel is about as wide as the sample.
+int image_texture::level_for( double width ) const {
+    double texels = fmax( width, min_width ) * image.base_width;
+    int level = 0;
+    while ( level + 1 < image.levels && texels >= 2 ) {
+        texels /= 2;
+        ++level;
+    }
+    return level;
+}
+
+color image_texture::texel( int lvl, int x, int y, texture_cache::tile_ptr& tile, int& tile_key ) const {
+    const int ts = tiled_image::tile_size;
+    int key = (y / ts) * image.tiles_across(lvl) + x / ts;
+    if ( key != tile_key ) {
+        tile = cache.get( image, lvl, x / ts, y / ts );
+        tile_key = key;
+    }
+    if ( !tile )
+        return color(0,1,1);     // the same cyan as a texture that didn't load
+    const unsigned char* t = &(*tile)[ 3 * ((y % ts) * ts + x % ts) ];
+    return color( to_linear[t[0]], to_linear[t[1]], to_linear[t[2]] );
+}
+
+color image_texture::value( double u, double v, const point3& p, double width ) const {
+    // If we have no texture data, return solid cyan as a debugging aid.
+    if ( !loaded )
+        return color(0,1,1);
+
+    // Clamp input texture coordinates to [0,1] x [1,0]
+    u = clamp(u, 0.0, 1.0);
+    v = 1.0 - clamp(v, 0.0, 1.0);  // Flip V to image coordinates
+
+    // Bilinear filtering between the four nearest texels. The file stores
+    //      the top row first, like the .ppm did.
+    int level = level_for( width );
+    int w = image.width(level), h = image.height(level);
+    double x = u * w - 0.5, y = v * h - 0.5;
+    int x0 = static_cast<int>( floor(x) ), y0 = static_cast<int>( floor(y) );
+    double fx = x - x0, fy = y - y0;
+    int xa = std::max( x0, 0 ), xb = std::min( x0 + 1, w - 1 );
+    int ya = std::max( y0, 0 ), yb = std::min( y0 + 1, h - 1 );
+    xa = std::min( xa, w - 1 );
+    ya = std::min( ya, h - 1 );
+
+    // Neighbouring texels are nearly always in the same tile, so we only go
+    //      to the cache when the tile changes.
+    texture_cache::tile_ptr tile;
+    int tile_key = -1;
+    color top = (1-fx) * texel(level, xa, ya, tile, tile_key) + fx * texel(level, xb, ya, tile, tile_key);
+    color bottom = (1-fx) * texel(level, xa, yb, tile, tile_key) + fx * texel(level, xb, yb, tile, tile_key);
+    return (1-fy) * top + fy * bottom;
+}
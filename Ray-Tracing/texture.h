@@ -0,0 +1,118 @@
+// texture.h
+// A texture answers "what color is the surface here?" for a point on a
+//      hittable. Materials used to have just one color for the whole surface;
+//      now they ask a texture instead. The texture gets the surface
+//      coordinates (u,v), which run from 0 to 1 across the surface, and the
+//      hit point p itself, and can use whichever it likes.
+
+# ifndef TEXTURE_H
+# define TEXTURE_H
+
+# include "rtweekend.h"
+
+# include "perlin.h"
+# include "texture_cache.h"
+
+# include <iostream>
+# include <string>
+
+class texture {
+    public:
+        virtual ~texture() = default;
+
+        // "width" is how much of the texture, as a fraction of u's range, the
+        //      sample covers (see hit_record::texture_width); only image
+        //      textures filter, and the rest ignore it.
+        virtual color value( double u, double v, const point3& p, double width = 0 ) const = 0;
+};
+
+
+// The same color everywhere- what every material used to be.
+class solid_color : public texture {
+    public:
+        solid_color() {}
+        solid_color( color c ) : color_value(c) {}
+        solid_color( double red, double green, double blue )
+            : solid_color( color(red, green, blue) ) {}
+
+        virtual color value( double u, double v, const point3& p, double width = 0 ) const override {
+            return color_value;
+        }
+
+    private:
+        color color_value;
+};
+
+
+// A 3D checkerboard: the sign of sin(x)sin(y)sin(z) flips between the two
+//      textures every "1/frequency" units.
+class checker_texture : public texture {
+    public:
+        checker_texture() {}
+        checker_texture( shared_ptr<texture> _even, shared_ptr<texture> _odd, double f = 10 )
+            : even(_even), odd(_odd), frequency(f) {}
+        checker_texture( color c1, color c2, double f = 10 )
+            : even(make_shared<solid_color>(c1)), odd(make_shared<solid_color>(c2)), frequency(f) {}
+
+        virtual color value( double u, double v, const point3& p, double width = 0 ) const override {
+            auto sines = sin(frequency*p.x()) * sin(frequency*p.y()) * sin(frequency*p.z());
+            return sines < 0 ? odd->value(u, v, p, width) : even->value(u, v, p, width);
+        }
+
+    public:
+        shared_ptr<texture> even;
+        shared_ptr<texture> odd;
+        double frequency = 10;
+};
+
+
+// Marble-like stripes, bent by Perlin turbulence.
+class noise_texture : public texture {
+    public:
+        noise_texture() {}
+        noise_texture( double sc ) : scale(sc) {}
+
+        virtual color value( double u, double v, const point3& p, double width = 0 ) const override {
+            return color(1,1,1) * 0.5 * (1 + sin(scale*p.z() + 10*noise.turb(p)));
+        }
+
+    public:
+        perlin noise;
+        double scale = 1;
+};
+
+
+// A picture wrapped onto the surface. The picture lives in a tile file (see
+//      texture_cache.h) and only the tiles we touch are ever loaded.
+//
+// Each lookup reads the mip level where one texel is about as wide as the
+//      sample: a texture seen from far away reads a small level instead of
+//      aliasing. "filter_width" (as a fraction of the texture's width, from
+//      0 to 1) is the narrowest filter to use; 0 leaves it to the lookups.
+class image_texture : public texture {
+    public:
+        // Opens "path", which can be a tile file or a .ppm. A .ppm is
+        //      converted to "path.tiles" first, unless that already exists
+        //      and is newer than the .ppm.
+        image_texture( const std::string& path, double filter_width = 0,
+                       texture_cache& c = global_texture_cache() );
+
+        virtual color value( double u, double v, const point3& p, double width = 0 ) const override;
+
+    private:
+        // The level for a sample covering "width" of the texture.
+        int level_for( double width ) const;
+
+        // One texel of one level, decoded to linear color.
+        color texel( int level, int x, int y, texture_cache::tile_ptr& tile, int& tile_key ) const;
+
+    private:
+        tiled_image image;
+        texture_cache& cache;
+        double min_width = 0;
+        bool loaded = false;
+        double to_linear[256];
+};
+
+
+# endif
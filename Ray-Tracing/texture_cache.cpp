@@ -0,0 +1,188 @@
+// texture_cache.cpp
+// Reading .ppm files, writing and reading tile files, and the tile cache itself (see texture_cache.h).
+
+# include "texture_cache.h"
+
+using namespace std ;
+
+
+bool read_ppm( const std::string& path, int& width, int& height, std::vector<unsigned char>& rgb ) {
+    std::ifstream in( path, std::ios::binary );
+    std::string magic;
+    int maxval = 0;
+    in >> magic;
+
+    // Header numbers can have "# comments" between them.
+    auto next_number = [&]( int& v ) {
+        in >> std::ws;
+        while ( in.peek() == '#' ) {
+            std::string comment;
+            getline( in, comment );
+            in >> std::ws;
+        }
+        return static_cast<bool>( in >> v );
+    };
+    if ( !in || (magic != "P3" && magic != "P6") || !next_number(width) || !next_number(height)
+         || !next_number(maxval) || width <= 0 || height <= 0 || maxval != 255 )
+        return false;
+
+    rgb.resize( 3 * static_cast<size_t>(width) * height );
+    if ( magic == "P6" ) {
+        in.get();
+        in.read( reinterpret_cast<char*>(rgb.data()), rgb.size() );
+    } else {
+        for ( auto& c : rgb ) {
+            int v;
+            in >> v;
+            c = static_cast<unsigned char>( v );
+        }
+    }
+    return static_cast<bool>( in );
+}
+
+bool tiled_image::convert_ppm( const std::string& ppm_path, const std::string& tile_path ) {
+    int w, h;
+    std::vector<unsigned char> pixels;
+    if ( !read_ppm(ppm_path, w, h, pixels) )
+        return false;
+
+    // The .ppm is sRGB encoded, so shrink it in linear light and encode back.
+    double to_linear[256];
+    for ( int k = 0; k < 256; ++k ) {
+        double v = k / 255.0;
+        to_linear[k] = v <= 0.04045 ? v / 12.92 : pow( (v + 0.055) / 1.055, 2.4 );
+    }
+    auto to_srgb = []( double x ) {
+        double v = x <= 0.0031308 ? 12.92 * x : 1.055 * pow(x, 1/2.4) - 0.055;
+        return static_cast<unsigned char>( 255 * clamp(v, 0.0, 1.0) + 0.5 );
+    };
+
+    // Written under a temporary name and renamed when it's complete, as
+    //      geometry_writer does, so a half written tile file is never opened.
+    std::ofstream out( tile_path + ".tmp", std::ios::binary | std::ios::trunc );
+    int32_t levels = 1;
+    while ( (w >> levels) > 0 || (h >> levels) > 0 )
+        ++levels;
+    int32_t header[3] = { w, h, levels };
+    out.write( magic, strlen(magic) + 1 );
+    out.write( reinterpret_cast<const char*>(header), sizeof(header) );
+
+    std::vector<unsigned char> tile( tile_bytes );
+    int lw = w, lh = h;
+    for ( int level = 0; level < levels; ++level ) {
+        // Write this level tile by tile. Pixels past the edge repeat the edge.
+        for ( int ty = 0; ty < (lh + tile_size - 1) / tile_size; ++ty ) {
+            for ( int tx = 0; tx < (lw + tile_size - 1) / tile_size; ++tx ) {
+                for ( int y = 0; y < tile_size; ++y ) {
+                    for ( int x = 0; x < tile_size; ++x ) {
+                        int sx = std::min( tx*tile_size + x, lw - 1 );
+                        int sy = std::min( ty*tile_size + y, lh - 1 );
+                        memcpy( &tile[3 * (y*tile_size + x)], &pixels[3 * (sy*lw + sx)], 3 );
+                    }
+                }
+                out.write( reinterpret_cast<const char*>(tile.data()), tile.size() );
+            }
+        }
+
+        // Average 2x2 blocks to make the next level down.
+        int nw = std::max( 1, lw / 2 ), nh = std::max( 1, lh / 2 );
+        std::vector<unsigned char> smaller( 3 * nw * nh );
+        for ( int y = 0; y < nh; ++y ) {
+            for ( int x = 0; x < nw; ++x ) {
+                for ( int c = 0; c < 3; ++c ) {
+                    double sum = 0;
+                    for ( int d = 0; d < 4; ++d ) {
+                        int sx = std::min( 2*x + d % 2, lw - 1 );
+                        int sy = std::min( 2*y + d / 2, lh - 1 );
+                        sum += to_linear[ pixels[3 * (sy*lw + sx) + c] ];
+                    }
+                    smaller[3 * (y*nw + x) + c] = to_srgb( sum / 4 );
+                }
+            }
+        }
+        pixels.swap( smaller );
+        lw = nw;
+        lh = nh;
+    }
+    out.close();
+    return !out.fail() && rename( (tile_path + ".tmp").c_str(), tile_path.c_str() ) == 0;
+}
+
+bool tiled_image::open( const std::string& file_path ) {
+    static std::atomic<uint32_t> next_id{ 1 };
+
+    // Opening again (say, after the file was rebuilt) starts from scratch.
+    if ( fd >= 0 )
+        close( fd );
+    level_offset.clear();
+    base_width = base_height = levels = 0;
+    id = 0;
+    path.clear();
+
+    fd = ::open( file_path.c_str(), O_RDONLY );
+    char header[8] = {};
+    int32_t dims[3];
+    struct stat info;
+    if ( fd < 0 || fstat(fd, &info) != 0 || pread(fd, header, 8, 0) != 8 || memcmp(header, magic, 8) != 0
+         || pread(fd, dims, sizeof(dims), 8) != sizeof(dims) )
+        return false;
+
+    // A level is at least one tile, and there's never more than 32 of them.
+    base_width = dims[0];
+    base_height = dims[1];
+    levels = dims[2];
+    if ( base_width <= 0 || base_height <= 0 || levels <= 0 || levels > 32 )
+        return false;
+
+    // Every tile of every level has to be in the file.
+    off_t at = header_bytes;
+    for ( int level = 0; level < levels; ++level ) {
+        level_offset.push_back( at );
+        at += static_cast<off_t>(tile_bytes) * tiles_across(level) * tiles_down(level);
+    }
+    if ( at > info.st_size )
+        return false;
+    path = file_path;
+    id = next_id++;
+    return true;
+}
+
+texture_cache::tile_ptr texture_cache::get( const tiled_image& image, int level, int tx, int ty ) {
+    uint64_t key = make_key( image.id, level, tx, ty );
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        auto found = index.find( key );
+        if ( found != index.end() ) {
+            lru.splice( lru.begin(), lru, found->second );
+            ++counters.hits;
+            return found->second->tile;
+        }
+        ++counters.misses;
+    }
+
+    // Read without holding the lock so other threads aren't stuck behind the
+    //      disk. If two threads miss the same tile, both read it and the
+    //      second one just uses the copy already in the cache.
+    auto tile = make_shared<std::vector<unsigned char>>( size_t(tiled_image::tile_bytes) );
+    if ( !image.read_tile(level, tx, ty, tile->data()) ) {
+        std::cerr << "Couldn't read tile " << tx << "," << ty << " of level " << level << " of " << image.path << '\n';
+        std::lock_guard<std::mutex> guard( lock );
+        ++counters.read_errors;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> guard( lock );
+    auto found = index.find( key );
+    if ( found != index.end() )
+        return found->second->tile;
+    lru.push_front( entry{ key, tile } );
+    index[key] = lru.begin();
+    counters.bytes += tile->size();
+    evict();
+    return tile;
+}
+
+texture_cache& global_texture_cache() {
+    static texture_cache cache( size_t(256) << 20 );
+    return cache;
+}
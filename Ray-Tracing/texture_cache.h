@@ -0,0 +1,150 @@
+// texture_cache.h
+// Image textures can be far bigger than the memory we want to spend on them,
+//      so they don't live in memory as whole pictures. Instead:
+//
+//      - A texture is converted once into a "tile file": the picture plus
+//        every half-size copy of it (the mip levels, down to 1x1), each cut
+//        into 64x64 squares (tiles) stored one after the other on disk.
+//      - The texture_cache keeps only the tiles that have actually been
+//        looked at, up to a fixed number of bytes. A tile is read from disk
+//        the first time someone needs it, and when the cache is full the
+//        tile that was used least recently is thrown out ("LRU").
+//
+// So a scene can use gigabytes of textures while only the tiles near what
+//      the camera sees, at the detail it needs, are ever in memory.
+
+# ifndef TEXTURE_CACHE_H
+# define TEXTURE_CACHE_H
+
+# include "rtweekend.h"
+
+# include <atomic>
+# include <cstring>
+# include <fstream>
+# include <iostream>
+# include <list>
+# include <mutex>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+
+// Reads a .ppm ("P3" text or "P6" binary, 8 bits per channel) into rgb
+//      triples, top row first. Returns false if it isn't one.
+bool read_ppm( const std::string& path, int& width, int& height, std::vector<unsigned char>& rgb );
+
+
+// One tile file on disk, opened for reading.
+class tiled_image {
+    public:
+        static const int tile_size = 64;
+        static const size_t tile_bytes = 3 * tile_size * tile_size;
+
+        tiled_image() {}
+        ~tiled_image() { if ( fd >= 0 ) close( fd ); }
+        tiled_image( const tiled_image& ) = delete;
+        tiled_image& operator=( const tiled_image& ) = delete;
+
+        // Converts a .ppm into a tile file. This is the one time the whole
+        //      picture is in memory.
+        static bool convert_ppm( const std::string& ppm_path, const std::string& tile_path );
+
+        // Opens a tile file, closing any opened before. One that's too short
+        //      for the picture its header describes is refused.
+        bool open( const std::string& file_path );
+
+        int width( int level ) const  { return std::max( 1, base_width >> level ); }
+        int height( int level ) const { return std::max( 1, base_height >> level ); }
+        int tiles_across( int level ) const { return (width(level) + tile_size - 1) / tile_size; }
+        int tiles_down( int level ) const   { return (height(level) + tile_size - 1) / tile_size; }
+
+        // Reads one tile from disk.
+        bool read_tile( int level, int tx, int ty, unsigned char* out ) const {
+            off_t at = level_offset[level] + tile_bytes * (static_cast<off_t>(ty) * tiles_across(level) + tx);
+            return pread( fd, out, tile_bytes, at ) == static_cast<ssize_t>(tile_bytes);
+        }
+
+    public:
+        int base_width = 0;
+        int base_height = 0;
+        int levels = 0;
+        uint32_t id = 0;     // tells tiles of different images apart in the cache
+        std::string path;
+
+    private:
+        static constexpr const char* magic = "RTTEX1\n";
+        static const int header_bytes = 8 + 3*4;
+        int fd = -1;
+        std::vector<off_t> level_offset;
+};
+
+
+class texture_cache {
+    public:
+        using tile_ptr = shared_ptr<const std::vector<unsigned char>>;
+
+        struct statistics {
+            uint64_t hits = 0;
+            uint64_t misses = 0;
+            uint64_t evictions = 0;
+            size_t bytes = 0;
+            uint64_t read_errors = 0;    // tiles that couldn't be read
+        };
+
+        explicit texture_cache( size_t budget_bytes ) : budget(budget_bytes) {}
+
+        // Returns a tile, reading it from disk if it isn't cached yet. The
+        //      tile stays valid for as long as the caller holds on to it, even
+        //      if the cache throws it out in the meantime. A tile that can't
+        //      be read is reported, counted in read_errors and not cached: we
+        //      return nullptr, and the next lookup tries again.
+        tile_ptr get( const tiled_image& image, int level, int tx, int ty );
+
+        void set_budget( size_t bytes ) {
+            std::lock_guard<std::mutex> guard( lock );
+            budget = bytes;
+            evict();
+        }
+
+        statistics stats() {
+            std::lock_guard<std::mutex> guard( lock );
+            return counters;
+        }
+
+    private:
+        struct entry {
+            uint64_t key;
+            tile_ptr tile;
+        };
+
+        static uint64_t make_key( uint32_t id, int level, int tx, int ty ) {
+            return (uint64_t(id) << 48) | (uint64_t(level) << 42) | (uint64_t(ty) << 21) | uint64_t(tx);
+        }
+
+        // Throws out least recently used tiles until we're within budget.
+        void evict() {
+            while ( counters.bytes > budget && !lru.empty() ) {
+                counters.bytes -= lru.back().tile->size();
+                index.erase( lru.back().key );
+                lru.pop_back();
+                ++counters.evictions;
+            }
+        }
+
+    private:
+        std::mutex lock;
+        size_t budget;
+        std::list<entry> lru;     // most recently used at the front
+        std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+        statistics counters;
+};
+
+
+// The cache shared by every image texture in the program (256 MB to start with).
+texture_cache& global_texture_cache();
+
+
+# endif
@@ -149,12 +149,26 @@ inline vec3 unit_vector(vec3 v) {
     return v / v.length();
 }
 
+// Maps two uniform numbers in [0,1) to a uniform point on the unit disk
+//      (Shirley and Chiu's "concentric" mapping). Squares are squashed into
+//      circles ring by ring, so there's no rejection loop and no branch-
+//      only selects, which lets the camera do this for many rays at once.
+inline void concentric_disk(double u1, double u2, double& x, double& y) {
+    double a = 2*u1 - 1;
+    double b = 2*u2 - 1;
+    bool wide = a*a > b*b;
+    double r = wide ? a : b;
+    double phi = wide ? (pi/4) * (b / a) : (pi/2) - (pi/4) * (a / (b != 0 ? b : 1));
+    x = r * cos(phi);
+    y = r * sin(phi);
+}
+
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
+    double u1 = random_double();
+    double u2 = random_double();
+    double x, y;
+    concentric_disk(u1, u2, x, y);
+    return vec3(x, y, 0);
 }
 
 inline vec3 random_in_unit_sphere() {
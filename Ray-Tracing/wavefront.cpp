@@ -0,0 +1,122 @@
+// wavefront.cpp
+// The wavefront integrator's stages (see wavefront.h).
+
+# include "wavefront.h"
+
+using namespace std ;
+
+
+void wavefront_integrator::render( const camera& cam, uint64_t seed, const render_region& region,
+                                   framebuffer& fb ) {
+    const int strip_rows = 16;
+    batch.resize( static_cast<size_t>( region.x1 - region.x0 ) * strip_rows );
+
+    for ( int y = region.y0; y < region.y1; y += strip_rows ) {
+        tile area{ region.x0, y, region.x1, min( y + strip_rows, region.y1 ) };
+        ray_span rays = batch.span();
+        rays.size = area.size();
+
+        for ( int s = region.s0; s < region.s1; ++s ) {
+            if ( !queue.empty() && queue.size() + rays.size > queue_size )
+                flush( fb );
+            cam.generate_rays( area, fb.width, fb.height, seed, s, rays );
+            for ( size_t k = 0; k < rays.size; ++k ) {
+                int slot = static_cast<int>( queue.size() );
+                queue.push_back( path{ rays.get(k), color(1,1,1), rays.rng[k], slot, 0, medium_stack(), 0 } );
+                pixels.push_back( { area.x0 + static_cast<int>(k) % area.width(),
+                                    area.y0 + static_cast<int>(k) / area.width() } );
+            }
+        }
+    }
+    flush( fb );
+}
+
+void wavefront_integrator::flush( framebuffer& fb ) {
+    radiance.assign( queue.size(), color(0,0,0) );
+    trace( queue, radiance );
+    release_geometry();    // every path in the queue is finished (see geometry_cache.h)
+
+    // In the order they were queued, which is the order ray_color's render()
+    //      adds them in, so the sums come out exactly the same.
+    for ( size_t k = 0; k < pixels.size(); ++k )
+        fb.add_sample( pixels[k].first, pixels[k].second, radiance[k] );
+    pixels.clear();
+}
+
+// Material kind first, then (if asked) the direction octant of the ray.
+int wavefront_integrator::sort_key( const path_hit& h, const std::vector<path>& queue ) const {
+    int key = static_cast<int>( h.rec.mat_ptr->bsdf.index() );
+    if ( sort == wavefront_sort::material_octant ) {
+        const vec3& d = queue[h.path].r.dir;
+        key = key*8 + (d.x() < 0) + 2*(d.y() < 0) + 4*(d.z() < 0);
+    }
+    return key;
+}
+
+void wavefront_integrator::trace( std::vector<path>& queue, std::vector<color>& radiance ) {
+    const int bins = std::variant_size_v<material::kinds> * 8;
+
+    while ( !queue.empty() ) {
+        // 1. Intersect
+        hits.clear();
+        for ( size_t k = 0; k < queue.size(); ++k ) {
+            path& p = queue[k];
+            if ( p.bounce >= settings.max_depth )
+                continue;    // out of bounces: no more light is gathered
+
+            // Fog and smoke use random numbers to decide where a ray hits,
+            //      so intersecting draws from the path's generator too.
+            ++stats.rays;
+            hit_record rec;
+            random_state() = p.rng;
+            bool hit = world.hit( p.r, 0.001, infinity, rec );
+            p.rng = random_state();
+            if ( hit )
+                hits.push_back( path_hit{ rec, static_cast<int>(k) } );
+            else
+                radiance[p.slot] += p.throughput * sky_color( p.r );
+        }
+
+        // 2. Sort: a counting sort by key, which keeps hits with the same
+        //      key in queue order.
+        order.resize( hits.size() );
+        if ( sort == wavefront_sort::none ) {
+            for ( size_t k = 0; k < hits.size(); ++k )
+                order[k] = static_cast<int>(k);
+        } else {
+            bin_start.assign( bins + 1, 0 );
+            for ( auto& h : hits )
+                ++bin_start[ sort_key(h, queue) + 1 ];
+            for ( int b = 0; b < bins; ++b )
+                bin_start[b + 1] += bin_start[b];
+            for ( size_t k = 0; k < hits.size(); ++k )
+                order[ bin_start[ sort_key(hits[k], queue) ]++ ] = static_cast<int>(k);
+        }
+
+        // 3. Shade
+        next.clear();
+        for ( int k : order ) {
+            path_hit& h = hits[k];
+            path p = queue[h.path];
+            random_state() = p.rng;
+
+            // The same steps, in the same order, as ray_color.
+            double distance = h.rec.t * p.r.direction().length();
+            p.travelled += distance;
+            h.rec.footprint = settings.pixel_angle * p.travelled;
+            p.media.absorb( distance, p.throughput );
+            ray scattered;
+            color attenuation;
+            if ( h.rec.mat_ptr->scatter(p.r, h.rec, attenuation, scattered, p.media) ) {
+                p.r = scattered;
+                p.throughput = p.throughput * attenuation;
+                if ( survives_roulette(p.throughput, p.bounce, settings) ) {
+                    p.rng = random_state();
+                    ++p.bounce;
+                    next.push_back( p );
+                }
+            }
+        }
+        queue.swap( next );
+    }
+}
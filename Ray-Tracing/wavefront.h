@@ -0,0 +1,102 @@
+// wavefront.h
+// A different way to run the same path tracer. ray_color follows one ray
+//      all the way (bounce, bounce, bounce...) before starting the next, so
+//      neighbouring rays end up hitting lambertian, metal, and glass spheres
+//      in a random order, and the CPU keeps guessing wrong about which
+//      scatter() comes next.
+//
+// "Wavefront" turns that sideways. We keep a big queue of paths and run one
+//      bounce for all of them at a time, as separate stages:
+//      1. intersect: find what every path in the queue hits. Misses pick up
+//         the sky color and are finished.
+//      2. sort: group the hits by material kind (and, optionally, by which
+//         of the 8 octants the ray was heading into).
+//      3. shade: scatter every hit, group by group, which puts the surviving
+//         paths into the next queue in that same order.
+// Each path carries its own random number generator state, so it draws the
+//      same random numbers it would have in ray_color, and the picture is the
+//      same as the recursive one.
+
+# ifndef WAVEFRONT_H
+# define WAVEFRONT_H
+
+# include "rtweekend.h"
+
+# include "camera.h"
+# include "framebuffer.h"
+# include "hittable.h"
+# include "material.h"
+# include "render.h"
+
+# include <vector>
+
+enum class wavefront_sort { none, material, material_octant };
+
+struct wavefront_stats {
+    uint64_t rays = 0;     // intersection tests against the whole world
+};
+
+class wavefront_integrator {
+    public:
+        // How many paths go through the stages together, unless told
+        //      otherwise. More sort into bigger groups, but past about this
+        //      many the paths and their hits no longer fit in the L2 cache,
+        //      and it gets slower again (see "./benchmark wavefront").
+        static const int default_queue = 4096;
+
+        // "queue" is how many paths to trace together: the more there are,
+        //      the more each material's group holds after sorting.
+        wavefront_integrator( const hittable& w, const path_settings& p, wavefront_sort s = wavefront_sort::material,
+                              int queue = default_queue )
+            : world(w), settings(p), sort(s), queue_size(std::max(queue, 1)) {}
+
+        // Same job as render() in render.h, one bounce at a time. The queue
+        //      is filled with whole 16 row strips of the region, one sample
+        //      after another and then strip after strip, until the next one
+        //      wouldn't fit; then all of them are traced at once.
+        void render( const camera& cam, uint64_t seed, const render_region& region, framebuffer& fb );
+
+    public:
+        wavefront_stats stats;
+
+    private:
+        struct path {
+            ray r;
+            color throughput;
+            uint64_t rng;
+            int slot;        // which entry of "radiance" this path adds to
+            int bounce;      // bounces so far
+            medium_stack media;
+            double travelled;    // distance so far, for texture footprints
+        };
+
+        struct path_hit {
+            hit_record rec;
+            int path;
+        };
+
+        // Traces everything in the queue and adds it into "fb".
+        void flush( framebuffer& fb );
+        void trace( std::vector<path>& queue, std::vector<color>& radiance );
+        int sort_key( const path_hit& h, const std::vector<path>& queue ) const;
+
+    private:
+        const hittable& world;
+        path_settings settings;
+        wavefront_sort sort;
+        size_t queue_size;
+
+        // Scratch space, kept between calls so we aren't allocating per strip
+        //      (or per tile). Each render thread has its own integrator.
+        ray_batch batch;
+        std::vector<path> queue;
+        std::vector<std::pair<int, int>> pixels;    // which pixel each queued path started from
+        std::vector<color> radiance;
+        std::vector<path> next;
+        std::vector<path_hit> hits;
+        std::vector<int> order;
+        std::vector<int> bin_start;
+};
+
+
+# endif